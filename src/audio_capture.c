@@ -0,0 +1,224 @@
+#include "audio_capture.h"
+#include "audio_output.h"
+#include "function_return_codes.h"
+#include <SDL.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+// Records the mixed output to a 16-bit mono WAV file. The mixer hands over
+// every sample in emulated time, whether or not a device is playing, through
+// a lock-free single-producer, single-consumer ring; a writer thread drains
+// it to disk so slow storage rarely holds up the emulation thread. If the
+// writer falls a whole ring behind, the emulation thread waits for it rather
+// than lose samples.
+
+#define RING_SIZE         65536 // samples, over a second at the output rate
+#define WRITE_BLOCK       4096  // samples per fwrite
+#define WAKE_FILL         (RING_SIZE / 4)
+#define WRITER_POLL_MS    50
+#define WAV_HEADER_LENGTH 44
+
+static int16_t ring[RING_SIZE];
+static atomic_uint ring_head; // next slot to write, emulation side
+static atomic_uint ring_tail; // next slot to read, writer side
+static atomic_bool active;
+static atomic_bool stopping;
+
+static FILE* capture_file = NULL;
+static SDL_Thread* writer = NULL;
+static SDL_sem* wake = NULL;
+static SDL_sem* drained = NULL; // posted by the writer as it frees space
+static uint32_t data_length = 0; // writer side, bytes
+
+static void put_le16(uint8_t* p, uint32_t value) {
+  p[0] = (uint8_t)value;
+  p[1] = (uint8_t)(value >> 8);
+}
+
+static void put_le32(uint8_t* p, uint32_t value) {
+  put_le16(p, value);
+  put_le16(p + 2, value >> 16);
+}
+
+static bool write_wav_header(uint32_t length) {
+  uint8_t header[WAV_HEADER_LENGTH];
+
+  memcpy(header, "RIFF", 4);
+  put_le32(header + 4, length + WAV_HEADER_LENGTH - 8);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  put_le32(header + 16, 16);                         // fmt chunk length
+  put_le16(header + 20, 1);                          // PCM
+  put_le16(header + 22, 1);                          // mono
+  put_le32(header + 24, AUDIO_OUTPUT_FREQUENCY);     // sample rate
+  put_le32(header + 28, AUDIO_OUTPUT_FREQUENCY * 2); // byte rate
+  put_le16(header + 32, 2);                          // block align
+  put_le16(header + 34, 16);                         // bits per sample
+  memcpy(header + 36, "data", 4);
+  put_le32(header + 40, length);
+
+  return fwrite(header, sizeof(header), 1, capture_file) == 1;
+}
+
+// Writes out everything in the ring, returning false if there was nothing
+static bool drain_ring(void) {
+  uint8_t block[WRITE_BLOCK * 2];
+  unsigned int tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+  unsigned int head = atomic_load_explicit(&ring_head, memory_order_acquire);
+
+  if (head == tail) {
+    return false;
+  }
+
+  while (head != tail) {
+    unsigned int count = head - tail;
+
+    if (count > WRITE_BLOCK) {
+      count = WRITE_BLOCK;
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+      put_le16(block + 2 * i, (uint16_t)ring[(tail + i) & (RING_SIZE - 1)]);
+    }
+
+    tail += count;
+    atomic_store_explicit(&ring_tail, tail, memory_order_release);
+
+    if (SDL_SemValue(drained) == 0) {
+      SDL_SemPost(drained);
+    }
+
+    // A WAV file can't describe more than 4 GB; stop growing it there
+    if (data_length <= UINT32_MAX - WAV_HEADER_LENGTH - 2 * count) {
+      if (fwrite(block, 2, count, capture_file) == count) {
+        data_length += 2 * count;
+      }
+    }
+  }
+
+  return true;
+}
+
+static int writer_thread(void* data) {
+  (void)data;
+
+  while (!atomic_load(&stopping)) {
+    if (!drain_ring()) {
+      SDL_SemWaitTimeout(wake, WRITER_POLL_MS);
+    }
+  }
+
+  drain_ring();
+  return 0;
+}
+
+int audio_capture_start(const char* filename) {
+  if (atomic_load(&active)) {
+    audio_capture_stop();
+  }
+
+  capture_file = fopen(filename, "wb");
+  if (!capture_file) {
+    printf("Unable to open [%s] for audio capture\r\n", filename);
+    return RV_FILE_OPEN_ERROR;
+  }
+
+  // Placeholder sizes, filled in when the capture stops
+  data_length = 0;
+  if (!write_wav_header(0)) {
+    fclose(capture_file);
+    capture_file = NULL;
+    return RV_FILE_WRITE_ERROR;
+  }
+
+  atomic_store(&ring_head, 0);
+  atomic_store(&ring_tail, 0);
+  atomic_store(&stopping, false);
+
+  wake = SDL_CreateSemaphore(0);
+  drained = SDL_CreateSemaphore(0);
+  if (wake && drained) {
+    writer = SDL_CreateThread(writer_thread, "audio capture", NULL);
+  }
+  if (!writer) {
+    printf("Unable to create audio capture thread: %s\r\n", SDL_GetError());
+    if (wake) {
+      SDL_DestroySemaphore(wake);
+      wake = NULL;
+    }
+    if (drained) {
+      SDL_DestroySemaphore(drained);
+      drained = NULL;
+    }
+    fclose(capture_file);
+    capture_file = NULL;
+    return RV_MEMORY_ALLOCATION_FAILURE;
+  }
+
+  atomic_store(&active, true);
+  return RV_OK;
+}
+
+// Called while the emulation thread is locked or stopped
+void audio_capture_stop(void) {
+  if (!atomic_load(&active)) {
+    return;
+  }
+
+  atomic_store(&active, false);
+  atomic_store(&stopping, true);
+  SDL_SemPost(wake);
+  SDL_WaitThread(writer, NULL);
+  writer = NULL;
+  SDL_DestroySemaphore(wake);
+  wake = NULL;
+  SDL_DestroySemaphore(drained);
+  drained = NULL;
+
+  if ((fseek(capture_file, 0, SEEK_SET) != 0) || !write_wav_header(data_length)) {
+    printf("Unable to finish the audio capture file\r\n");
+  }
+  fclose(capture_file);
+  capture_file = NULL;
+}
+
+bool audio_capture_is_active(void) {
+  return atomic_load(&active);
+}
+
+// Called by the mixer on the emulation thread
+void audio_capture_write(const int16_t* samples, int count) {
+  if (!atomic_load_explicit(&active, memory_order_relaxed)) {
+    return;
+  }
+
+  unsigned int head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+
+  while (count > 0) {
+    unsigned int space = RING_SIZE - (head - tail);
+
+    // Ring full: wait for the writer to make room
+    if (space == 0) {
+      SDL_SemPost(wake);
+      SDL_SemWaitTimeout(drained, WRITER_POLL_MS);
+      tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+      continue;
+    }
+
+    unsigned int n = ((unsigned int)count < space) ? (unsigned int)count : space;
+
+    for (unsigned int i = 0; i < n; i++) {
+      ring[(head + i) & (RING_SIZE - 1)] = samples[i];
+    }
+
+    head += n;
+    atomic_store_explicit(&ring_head, head, memory_order_release);
+    samples += n;
+    count -= (int)n;
+  }
+
+  if (head - tail >= WAKE_FILL) {
+    SDL_SemPost(wake);
+  }
+}
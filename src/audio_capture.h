@@ -0,0 +1,12 @@
+#ifndef __AUDIO_CAPTURE_H__
+#define __AUDIO_CAPTURE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+extern int audio_capture_start(const char* filename);
+extern void audio_capture_stop(void);
+extern bool audio_capture_is_active(void);
+extern void audio_capture_write(const int16_t* samples, int count);
+
+#endif // __AUDIO_CAPTURE_H__
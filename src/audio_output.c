@@ -0,0 +1,313 @@
+#include "audio_output.h"
+#include "audio_capture.h"
+#include "function_return_codes.h"
+#include <SDL.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifndef S_ISSOCK
+#ifdef S_IFSOCK
+#define S_ISSOCK(mode) (((mode) & S_IFMT) == S_IFSOCK)
+#else
+#define S_ISSOCK(mode) (0)
+#endif
+#endif
+
+// The single audio device and the mixer feeding it. Sound sources are
+// advanced by emulated time: before a source changes state at some CPU
+// cycle it syncs the mixer to that cycle, which has every source render up
+// to there, so all changes land on their exact sample. The mix goes as
+// 16-bit mono samples at AUDIO_OUTPUT_FREQUENCY into a lock-free
+// single-producer, single-consumer ring, and the SDL callback resamples it
+// to the device rate. The resampling ratio is nudged to hold the ring at a
+// steady fill, so drift between the emulated and audio clocks never starves
+// or floods it.
+
+#define RING_SIZE          16384
+#define MIN_BUFFER_SAMPLES 64
+#define MAX_BUFFER_SAMPLES 4096
+#define MAX_SOURCES        4
+
+// Longest stretch mixed in one go; anything longer, e.g. the first sync or a
+// jump in the cycle count, restarts from the current cycle
+#define MAX_CATCH_UP_SAMPLES AUDIO_OUTPUT_FREQUENCY
+
+// Fill aimed for on top of one device buffer. The emulation thread writes a
+// 20 ms slice at a time, so this covers a slice plus scheduling jitter.
+#define SLACK_SAMPLES (AUDIO_OUTPUT_FREQUENCY * 25 / 1000)
+
+// Largest change to the resampling ratio, well below audible pitch change.
+// The proportional term reacts to the fill error and the integral term
+// settles on the steady clock difference, so the fill returns to the target.
+// The measured fill follows the slice-sized bursts slowly.
+#define RATE_CONTROL_RANGE    0.005
+#define RATE_CONTROL_INTEGRAL 0.00001
+#define FILL_SMOOTHING        (1.0 / 64.0)
+
+static SDL_AudioDeviceID audio_device = 0;
+static bool audio_unavailable = false; // don't retry, or warn, for each source
+static int buffer_samples = AUDIO_OUTPUT_DEFAULT_BUFFER_SAMPLES;
+
+static int16_t ring[RING_SIZE];
+static atomic_uint ring_head; // next slot to write, emulation side
+static atomic_uint ring_tail; // next slot to read, audio side
+
+// Emulation side. The mix position is in units of cycles *
+// AUDIO_OUTPUT_FREQUENCY, so one sample is cpu_clock_frequency units and no
+// rounding builds up.
+static audio_output_source_t sources[MAX_SOURCES];
+static int source_count = 0;
+static float mix_buffer[AUDIO_OUTPUT_CHUNK_SAMPLES];
+static int16_t mix_samples[AUDIO_OUTPUT_CHUNK_SAMPLES];
+static uint64_t mix_position = 0;
+static int cpu_clock_frequency = 750000;
+
+// Set up while the device is paused, then owned by the audio callback.
+// Steps and phase are 16.16 fixed-point source samples.
+static double base_step = 65536.0;
+static unsigned int target_fill = 0;
+static double average_fill = 0.0;
+static double rate_integral = 0.0;
+static uint32_t resample_phase = 0;
+static int resample_previous = 0;
+static int resample_next = 0;
+static bool primed = false;
+
+static void audio_callback(void* userdata, uint8_t* stream, int len) {
+  int16_t* samples = (int16_t*)stream;
+  int count = len / (int)sizeof(int16_t);
+  unsigned int tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+  unsigned int head = atomic_load_explicit(&ring_head, memory_order_acquire);
+  unsigned int fill = head - tail;
+  (void)userdata;
+
+  // After an underrun, wait for a full target's worth before playing again.
+  // Anything far beyond the target, e.g. after the emulation caught up a
+  // backlog, is skipped rather than played late.
+  if (!primed) {
+    if (fill >= target_fill) {
+      primed = true;
+      average_fill = fill;
+    }
+  } else if (fill > 4 * target_fill) {
+    tail = head - target_fill;
+    fill = target_fill;
+    average_fill = fill;
+  }
+
+  average_fill += ((double)fill - average_fill) * FILL_SMOOTHING;
+
+  double error = (average_fill - target_fill) / target_fill;
+  if (error > 1.0) {
+    error = 1.0;
+  } else if (error < -1.0) {
+    error = -1.0;
+  }
+
+  rate_integral += error * RATE_CONTROL_INTEGRAL;
+  if (rate_integral > RATE_CONTROL_RANGE) {
+    rate_integral = RATE_CONTROL_RANGE;
+  } else if (rate_integral < -RATE_CONTROL_RANGE) {
+    rate_integral = -RATE_CONTROL_RANGE;
+  }
+
+  double adjust = RATE_CONTROL_RANGE * error + rate_integral;
+  if (adjust > RATE_CONTROL_RANGE) {
+    adjust = RATE_CONTROL_RANGE;
+  } else if (adjust < -RATE_CONTROL_RANGE) {
+    adjust = -RATE_CONTROL_RANGE;
+  }
+  uint32_t step = (uint32_t)(base_step * (1.0 + adjust));
+
+  for (int i = 0; i < count; i++) {
+    while (resample_phase >= 0x10000) {
+      resample_phase -= 0x10000;
+      resample_previous = resample_next;
+      if (primed && (tail != head)) {
+        resample_next = ring[tail & (RING_SIZE - 1)];
+        tail++;
+      } else {
+        // Ease towards silence rather than holding a level
+        primed = false;
+        resample_next -= resample_next / 256;
+      }
+    }
+
+    samples[i] = (int16_t)(resample_previous +
+                           (int)(((int64_t)(resample_next - resample_previous) * resample_phase) >> 16));
+    resample_phase += step;
+  }
+
+  atomic_store_explicit(&ring_tail, tail, memory_order_release);
+}
+
+int audio_output_open(void) {
+  if (audio_device != 0) {
+    return RV_OK;
+  }
+  if (audio_unavailable) {
+    return RV_DEVICE_OPEN_ERROR;
+  }
+
+  // For WSLg support - point PulseAudio to WSLg server if it exists
+  const char* wslg_pulse = "/mnt/wslg/PulseServer";
+  struct stat st;
+  if (stat(wslg_pulse, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    char pulse_server[256];
+    snprintf(pulse_server, sizeof(pulse_server), "unix:%s", wslg_pulse);
+    setenv("PULSE_SERVER", pulse_server, 0); // don't override if already set
+  }
+
+  if (SDL_WasInit(SDL_INIT_AUDIO) == 0) {
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+      printf("Warning: SDL_InitSubSystem(AUDIO) failed: %s\r\n", SDL_GetError());
+      printf("         Sound is disabled\r\n");
+      audio_unavailable = true;
+      return RV_DEVICE_OPEN_ERROR;
+    }
+  }
+
+  SDL_AudioSpec want, have;
+  SDL_zero(want);
+  want.freq = AUDIO_OUTPUT_FREQUENCY;
+  want.format = AUDIO_S16SYS;
+  want.channels = 1;
+  want.samples = (Uint16)buffer_samples;
+  want.callback = audio_callback;
+
+  audio_device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+  if (audio_device == 0) {
+    printf("Warning: SDL_OpenAudioDevice failed: %s\r\n", SDL_GetError());
+    printf("         Sound is disabled (this is normal in WSL1 or headless environments)\r\n");
+    audio_unavailable = true;
+    return RV_DEVICE_OPEN_ERROR;
+  }
+
+  base_step = 65536.0 * AUDIO_OUTPUT_FREQUENCY / have.freq;
+  target_fill = (unsigned int)((uint64_t)have.samples * AUDIO_OUTPUT_FREQUENCY / (uint64_t)have.freq) + SLACK_SAMPLES;
+  average_fill = 0.0;
+  rate_integral = 0.0;
+  resample_phase = 0;
+  resample_previous = resample_next = 0;
+  primed = false;
+  atomic_store(&ring_head, 0);
+  atomic_store(&ring_tail, 0);
+
+  SDL_PauseAudioDevice(audio_device, 0);
+  return RV_OK;
+}
+
+void audio_output_close(void) {
+  if (audio_device != 0) {
+    SDL_CloseAudioDevice(audio_device);
+    audio_device = 0;
+  }
+}
+
+bool audio_output_is_open(void) {
+  return audio_device != 0;
+}
+
+// Rounds to a power of two within range; reopens the device if it is open
+void audio_output_set_buffer_size(int samples) {
+  int size = MIN_BUFFER_SAMPLES;
+
+  while ((size < samples) && (size < MAX_BUFFER_SAMPLES)) {
+    size *= 2;
+  }
+
+  if (size == buffer_samples) {
+    return;
+  }
+
+  buffer_samples = size;
+  if (audio_device != 0) {
+    audio_output_close();
+    audio_output_open();
+  }
+}
+
+// Samples that do not fit are dropped; the callback only falls that far
+// behind when playback has stalled
+static void write_samples(const int16_t* samples, int count) {
+  unsigned int head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+  unsigned int space = RING_SIZE - (head - tail);
+
+  if ((unsigned int)count > space) {
+    count = (int)space;
+  }
+
+  for (int i = 0; i < count; i++) {
+    ring[(head + (unsigned int)i) & (RING_SIZE - 1)] = samples[i];
+  }
+
+  atomic_store_explicit(&ring_head, head + (unsigned int)count, memory_order_release);
+}
+
+void audio_output_add_source(audio_output_source_t source) {
+  for (int i = 0; i < source_count; i++) {
+    if (sources[i] == source) {
+      return;
+    }
+  }
+
+  if (source_count < MAX_SOURCES) {
+    sources[source_count++] = source;
+  }
+}
+
+void audio_output_set_clock_frequency(int frequency) {
+  cpu_clock_frequency = (frequency > 0) ? frequency : 1;
+}
+
+// Mixes every source up to the given CPU cycle, for the device and any
+// capture. Called after each emulation slice, and by sources before they
+// change state.
+void audio_output_sync(uint64_t cycles) {
+  uint64_t target = cycles * AUDIO_OUTPUT_FREQUENCY;
+  uint64_t sample_units = (uint64_t)cpu_clock_frequency;
+
+  if ((audio_device == 0) && !audio_capture_is_active()) {
+    return;
+  }
+
+  if ((target < mix_position) ||
+      (target - mix_position > MAX_CATCH_UP_SAMPLES * sample_units)) {
+    mix_position = target;
+    return;
+  }
+
+  uint64_t count = (target - mix_position) / sample_units;
+  mix_position += count * sample_units;
+
+  while (count > 0) {
+    int chunk = (count < AUDIO_OUTPUT_CHUNK_SAMPLES) ? (int)count : AUDIO_OUTPUT_CHUNK_SAMPLES;
+
+    memset(mix_buffer, 0, (size_t)chunk * sizeof(mix_buffer[0]));
+    for (int i = 0; i < source_count; i++) {
+      sources[i](mix_buffer, chunk);
+    }
+
+    for (int i = 0; i < chunk; i++) {
+      float sample = mix_buffer[i];
+
+      if (sample < -32768.0f) {
+        sample = -32768.0f;
+      } else if (sample > 32767.0f) {
+        sample = 32767.0f;
+      }
+
+      mix_samples[i] = (int16_t)sample;
+    }
+
+    if (audio_device != 0) {
+      write_samples(mix_samples, chunk);
+    }
+    audio_capture_write(mix_samples, chunk);
+    count -= (uint64_t)chunk;
+  }
+}
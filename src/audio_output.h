@@ -0,0 +1,27 @@
+#ifndef __AUDIO_OUTPUT_H__
+#define __AUDIO_OUTPUT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Rate that sources are mixed at; the device may run at another rate
+#define AUDIO_OUTPUT_FREQUENCY 48000
+
+// Most samples a source is asked for at once
+#define AUDIO_OUTPUT_CHUNK_SAMPLES 1024
+
+#define AUDIO_OUTPUT_DEFAULT_BUFFER_SAMPLES 256
+
+// A sound source adds its next num_samples of output, in 16-bit units, to
+// the mix. Sources run on the emulation thread.
+typedef void (*audio_output_source_t)(float* mix, int num_samples);
+
+extern int audio_output_open(void);
+extern void audio_output_close(void);
+extern bool audio_output_is_open(void);
+extern void audio_output_set_buffer_size(int samples);
+extern void audio_output_add_source(audio_output_source_t source);
+extern void audio_output_set_clock_frequency(int frequency);
+extern void audio_output_sync(uint64_t cycles);
+
+#endif // __AUDIO_OUTPUT_H__
@@ -1,45 +1,73 @@
 #include "ay8910.h"
-#include <SDL.h>
+#include "audio_output.h"
+#include "cpu_6502.h"
+#include <math.h>
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
-
-#ifndef S_ISSOCK
-#ifdef S_IFSOCK
-#define S_ISSOCK(mode) (((mode) & S_IFMT) == S_IFSOCK)
-#else
-#define S_ISSOCK(mode) (0)
-#endif
-#endif
 
 /* ---------------------------------------------------------------------------
  * AY-3-8910 Programmable Sound Generator Emulation
+ *
+ * The chips are advanced by emulated time on the emulation thread.  Before a
+ * register write takes effect the chips are synthesised up to the CPU cycle
+ * of the write, so every change lands on its exact sample.
+ *
+ * Synthesis works per edge rather than per sample.  Each change in a chip's
+ * output adds a band-limited step (BLEP), taken from a precomputed table at
+ * the change's sub-sample position, to the chip's delta buffer; the running
+ * sum of the chips' buffers is the alias-free output, added to the shared
+ * audio output's mix at PLAYBACK_FREQUENCY samples per emulated second.
  * --------------------------------------------------------------------------*/
 
 /* ---------------------------------------------------------------------------
  * Configuration
  * --------------------------------------------------------------------------*/
-#define PLAYBACK_FREQUENCY 22050 /* Hz - mono, 8-bit unsigned */
+#define PLAYBACK_FREQUENCY AUDIO_OUTPUT_FREQUENCY /* Hz - synthesis rate, mono */
 #define MAX_DEVICES        8     /* Microtan 65 has two AY8910s, we'll have 8 :) */
 
-/* SDL audio callback buffer size.  22050 Hz / 20 updates/sec = 1102 samples.
- * Round up to a power-of-two friendly size. */
-#define AUDIO_BUF_SIZE 2048
+
+/* AY8910_CLOCK / CLOCK_DIVIDER is the chip clock in Hz.  A tone flips every
+ * 8 * period clocks; the noise generator and the envelope step every
+ * 16 * period. */
+#define CLOCK_DIVIDER 1024
+
+/* Band-limited step table: BLEP_PHASES sub-sample positions, each a
+ * windowed-sinc impulse BLEP_TAPS samples long, cut off just below Nyquist */
+#define BLEP_TAPS   16
+#define BLEP_PHASES 64
+#define BLEP_CUTOFF 0.9
+
+/* Output of one channel at full volume, and the DC blocker coefficient
+ * (a high-pass of a few Hz, as the real board is AC coupled) */
+#define CHANNEL_AMPLITUDE 10000.0f
+#define DC_BLOCK_RATE     (1.0f / 4096.0f)
 
 /* ---------------------------------------------------------------------------
  * Module state
  * --------------------------------------------------------------------------*/
 static ay8910_t chips[MAX_DEVICES];
 static bool ay8910_initialised = false;
-static SDL_AudioDeviceID audio_device = 0;
 static uint16_t address_table[MAX_DEVICES] = {
   0xbc00, 0xbc02, 0xbc04, 0xbc06, 0xbc08, 0xbc0a, 0xbc0c, 0xbc0e
 };
 static uint8_t ay8910_memory_mapped_registers[MAX_DEVICES][2];
 
-/* Each chip has its own output buffer; the SDL callback mixes them together. */
-static uint8_t chip_buffer[MAX_DEVICES][AUDIO_BUF_SIZE];
+/* Band-limited steps of each chip, how far into its buffer they reach, and
+ * the running sum and DC level of the output.  The tail past the current
+ * chunk carries into the next.  Each chip has its own buffer so that steps
+ * are always summed in the same order, which keeps the output bit-identical
+ * however finely the chips are synchronised. */
+static float blep_table[BLEP_PHASES][BLEP_TAPS];
+static float delta_buffer[MAX_DEVICES][AUDIO_OUTPUT_CHUNK_SAMPLES + BLEP_TAPS];
+static int delta_length[MAX_DEVICES];
+static float output_integral = 0.0f;
+static float output_dc = 0.0f;
+
+/* The AY8910's logarithmic DAC, measured output for volumes 0-15 relative
+ * to full scale */
+static const float dac_table[16] = {
+  0.0f, 0.00999466f, 0.01445029f, 0.02105745f, 0.03070115f, 0.04554818f, 0.06449989f, 0.10736248f,
+  0.12658885f, 0.20498970f, 0.29221027f, 0.37283894f, 0.49253071f, 0.63532464f, 0.80558480f, 1.0f};
 
 /* ---------------------------------------------------------------------------
  * Envelope waveform table  (16 shapes x 32 steps)
@@ -64,158 +92,282 @@ static const uint8_t envelope_forms[16][32] =
     {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}};
 
 /* ---------------------------------------------------------------------------
- * Per-chip sample generation
+ * Band-limited step synthesis
  * --------------------------------------------------------------------------*/
-static void update_chip(int num, int num_samples) {
-  ay8910_t* psg = &chips[num];
-  int x;
-  int c0, c1, l0, l1, l2;
-  uint8_t* lpb;
 
-  x = psg->regs[AY_AFINE] + ((unsigned)(psg->regs[AY_ACOARSE] & 0x0F) << 8);
-  psg->inc_0 = x ? (int)((long)AY8910_CLOCK / PLAYBACK_FREQUENCY * 4 / x) : 0;
+/* Fills blep_table with Blackman-windowed sinc impulses, each normalised so
+ * a step settles at exactly its height */
+static void build_blep_table(void) {
+  const double pi = 3.14159265358979323846;
 
-  x = psg->regs[AY_BFINE] + ((unsigned)(psg->regs[AY_BCOARSE] & 0x0F) << 8);
-  psg->inc_1 = x ? (int)((long)AY8910_CLOCK / PLAYBACK_FREQUENCY * 4 / x) : 0;
+  for (int phase = 0; phase < BLEP_PHASES; phase++) {
+    double centre = BLEP_TAPS / 2 - 1 + (double)phase / BLEP_PHASES;
+    double kernel[BLEP_TAPS];
+    double total = 0.0;
 
-  x = psg->regs[AY_CFINE] + ((unsigned)(psg->regs[AY_CCOARSE] & 0x0F) << 8);
-  psg->inc_2 = x ? (int)((long)AY8910_CLOCK / PLAYBACK_FREQUENCY * 4 / x) : 0;
+    for (int tap = 0; tap < BLEP_TAPS; tap++) {
+      double x = tap - centre;
+      double u = x / (BLEP_TAPS / 2);
+      double window = (fabs(u) < 1.0) ? 0.42 + 0.5 * cos(pi * u) + 0.08 * cos(2.0 * pi * u) : 0.0;
+      double sinc = (x == 0.0) ? 1.0 : sin(pi * BLEP_CUTOFF * x) / (pi * BLEP_CUTOFF * x);
 
-  x = psg->regs[AY_NOISEPER] & 0x1F;
-  psg->inc_noise = (int)((long)AY8910_CLOCK / PLAYBACK_FREQUENCY * 4 / (x ? x : 1));
+      kernel[tap] = window * sinc;
+      total += kernel[tap];
+    }
 
-  x = psg->regs[AY_EFINE] + ((unsigned)psg->regs[AY_ECOARSE] << 8);
-  psg->inc_env = x ? (int)((long)AY8910_CLOCK / PLAYBACK_FREQUENCY * 4 / x * num_samples) : 0;
+    for (int tap = 0; tap < BLEP_TAPS; tap++) {
+      blep_table[phase][tap] = (float)(kernel[tap] / total);
+    }
+  }
+}
+
+/* Adds a step of the given height to a chip's output at a 16.16 fixed-point
+ * sample time within the current chunk */
+static inline void add_step(int num, uint32_t time, float height) {
+  const float* kernel = blep_table[((time & 0xFFFF) * BLEP_PHASES) >> 16];
+  float* delta = &delta_buffer[num][time >> 16];
+
+  if ((int)(time >> 16) + BLEP_TAPS > delta_length[num])
+    delta_length[num] = (int)(time >> 16) + BLEP_TAPS;
+
+#if defined(__GNUC__)
+  /* Every edge of every channel lands here, so the taps are added four at a
+   * time with GCC/Clang vector extensions, which map to SSE on x86 and NEON
+   * on ARM.  The step can start at any sample, so lanes are moved with
+   * memcpy rather than aligned loads. */
+  typedef float step_vector_t __attribute__((vector_size(16)));
+
+  for (int tap = 0; tap < BLEP_TAPS; tap += 4) {
+    step_vector_t k, d;
+
+    memcpy(&k, kernel + tap, sizeof(k));
+    memcpy(&d, delta + tap, sizeof(d));
+    d += k * height;
+    memcpy(delta + tap, &d, sizeof(d));
+  }
+#else
+  for (int tap = 0; tap < BLEP_TAPS; tap++) {
+    delta[tap] += kernel[tap] * height;
+  }
+#endif
+}
+
+/* Converts chip clock ticks to 16.16 fixed-point output samples */
+static uint64_t ticks_to_samples(unsigned int ticks) {
+  return ((uint64_t)ticks << 16) * PLAYBACK_FREQUENCY * CLOCK_DIVIDER / AY8910_CLOCK;
+}
+
+/* Moves a generator past the end of the chunk without producing output,
+ * returning the number of edges skipped */
+static uint32_t skip_edges(uint32_t* next, uint32_t period, uint32_t end) {
+  uint32_t edges = 0;
+
+  if (*next < end) {
+    edges = (end - *next - 1) / period + 1;
+    *next += edges * period;
+  }
+
+  return edges;
+}
 
-  /* Sample the envelope table once per update call */
-  psg->envelope = envelope_forms[psg->regs[AY_ESHAPE]][(psg->count_env >> 16) & 0x1F];
+/* Moves the envelope on by a number of steps.  Shapes 8, 10, 12 and 14
+ * repeat every 32 steps; the rest hold the level at step 16 of the table. */
+static void advance_envelope(ay8910_t* psg, uint64_t steps) {
+  if (psg->envelope_holding)
+    return;
+
+  steps += (uint64_t)psg->envelope_step;
 
-  if ((psg->count_env += psg->inc_env) & 0xFFE00000) {
+  if (steps >= 32) {
     switch (psg->regs[AY_ESHAPE]) {
       case 8:
       case 10:
       case 12:
       case 14:
-        psg->count_env -= 0x200000;
+        steps &= 0x1F;
         break;
       default:
-        psg->count_env = 0x100000;
-        psg->inc_env = 0;
+        steps = 16;
+        psg->envelope_holding = true;
         break;
     }
   }
 
-  /* Resolve volumes: bit 4 of VOLx selects envelope vs. fixed */
-  psg->volume_0 = (psg->regs[AY_AVOL] < 16) ? psg->regs[AY_AVOL] : psg->envelope;
-  psg->volume_1 = (psg->regs[AY_BVOL] < 16) ? psg->regs[AY_BVOL] : psg->envelope;
-  psg->volume_2 = (psg->regs[AY_CVOL] < 16) ? psg->regs[AY_CVOL] : psg->envelope;
+  psg->envelope_step = (int)steps;
+  psg->envelope = envelope_forms[psg->regs[AY_ESHAPE]][steps];
+}
 
-  /* Noise volume = average of the channels that have noise enabled */
-  psg->volume_noise = (((psg->regs[AY_ENABLE] & 010) ? 0 : psg->volume_0) +
-                       ((psg->regs[AY_ENABLE] & 020) ? 0 : psg->volume_1) +
-                       ((psg->regs[AY_ENABLE] & 040) ? 0 : psg->volume_2)) /
-                      2;
+/* Resolves the channel volumes: bit 4 of VOLx selects envelope vs. fixed */
+static void channel_amplitudes(const ay8910_t* psg, float* amplitude) {
+  for (int channel = 0; channel < 3; channel++) {
+    int volume = psg->regs[AY_AVOL + channel];
 
-  /* Mask out tone channels that are disabled */
-  psg->volume_0 = (psg->regs[AY_ENABLE] & 001) ? 0 : psg->volume_0;
-  psg->volume_1 = (psg->regs[AY_ENABLE] & 002) ? 0 : psg->volume_1;
-  psg->volume_2 = (psg->regs[AY_ENABLE] & 004) ? 0 : psg->volume_2;
+    amplitude[channel] = dac_table[(volume < 16) ? volume : psg->envelope] * CHANNEL_AMPLITUDE;
+  }
+}
 
-  lpb = psg->buffer;
+/* Sum of the channel outputs.  A channel is high when both its tone and its
+ * noise are high or disabled, which leaves a channel with both disabled at
+ * a steady level set by its volume. */
+static float chip_level(const ay8910_t* psg, const float* amplitude) {
+  float level = 0.0f;
 
-  for (int i = 0; i < num_samples; i++) {
-    /* --- Channel A anti-aliased square wave --- */
-    c0 = psg->counter_0;
-    c1 = psg->counter_0 + psg->inc_0;
-    l0 = ((c0 & 0x8000) ? -16 : 16);
+  for (int channel = 0; channel < 3; channel++) {
+    int enable = psg->regs[AY_ENABLE] >> channel;
 
-    if ((c0 ^ c1) & 0x8000) {
-      l0 = l0 * (0x8000 - (c0 & 0x7FFF) - (c1 & 0x7FFF)) / psg->inc_0;
-    }
+    if ((psg->tone_output[channel] | (enable & 1)) & (psg->noise_output | ((enable >> 3) & 1)))
+      level += amplitude[channel];
+  }
 
-    psg->counter_0 = c1 & 0xFFFF;
+  return level;
+}
 
-    /* --- Channel B --- */
-    c0 = psg->counter_1;
-    c1 = psg->counter_1 + psg->inc_1;
-    l1 = ((c0 & 0x8000) ? -16 : 16);
+/* ---------------------------------------------------------------------------
+ * Per-chip synthesis
+ *
+ * Tones, noise and the envelope are all edge generators: each keeps the time
+ * of its next change, and the output is only recomputed there, so every
+ * change lands at its exact sub-sample position whatever the chunk size.
+ * --------------------------------------------------------------------------*/
+static void update_chip(int num, int num_samples) {
+  ay8910_t* psg = &chips[num];
+  uint32_t end = (uint32_t)num_samples << 16;
+  float amplitude[3];
+  float level;
+  int x;
 
-    if ((c0 ^ c1) & 0x8000) {
-      l1 = l1 * (0x8000 - (c0 & 0x7FFF) - (c1 & 0x7FFF)) / psg->inc_1;
-    }
+  if (num_samples <= 0) {
+    return;
+  }
 
-    psg->counter_1 = c1 & 0xFFFF;
+  /* Periods, with a period of 0 behaving as 1.  A shorter period cuts the
+   * count in progress short. */
+  for (int channel = 0; channel < 3; channel++) {
+    x = psg->regs[AY_AFINE + 2 * channel] + ((unsigned)(psg->regs[AY_ACOARSE + 2 * channel] & 0x0F) << 8);
+    psg->tone_period[channel] = (uint32_t)ticks_to_samples(8 * (x ? x : 1));
+    if (psg->tone_next[channel] > psg->tone_period[channel])
+      psg->tone_next[channel] = psg->tone_period[channel];
+  }
+
+  x = psg->regs[AY_NOISEPER] & 0x1F;
+  psg->noise_period = (uint32_t)ticks_to_samples(16 * (x ? x : 1));
+  if (psg->noise_next > psg->noise_period)
+    psg->noise_next = psg->noise_period;
+
+  x = psg->regs[AY_EFINE] + ((unsigned)psg->regs[AY_ECOARSE] << 8);
+  psg->envelope_period = ticks_to_samples(16 * (unsigned)(x ? x : 1));
+  if (psg->envelope_next > psg->envelope_period)
+    psg->envelope_next = psg->envelope_period;
+
+  channel_amplitudes(psg, amplitude);
 
-    /* --- Channel C --- */
-    c0 = psg->counter_2;
-    c1 = psg->counter_2 + psg->inc_2;
-    l2 = ((c0 & 0x8000) ? -16 : 16);
+  /* Volume and mixer changes step the output at the start of the update */
+  level = chip_level(psg, amplitude);
+  if (level != psg->output_level) {
+    add_step(num, 0, level - psg->output_level);
+    psg->output_level = level;
+  }
+
+  /* A chip with every volume fixed at 0 stays silent; keep its generators
+   * in phase without producing any edges */
+  psg->active = ((psg->regs[AY_AVOL] | psg->regs[AY_BVOL] | psg->regs[AY_CVOL]) != 0);
 
-    if ((c0 ^ c1) & 0x8000) {
-      l2 = l2 * (0x8000 - (c0 & 0x7FFF) - (c1 & 0x7FFF)) / psg->inc_2;
+  if (!psg->active) {
+    for (int channel = 0; channel < 3; channel++) {
+      psg->tone_output[channel] ^= skip_edges(&psg->tone_next[channel], psg->tone_period[channel], end) & 1;
     }
+    skip_edges(&psg->noise_next, psg->noise_period, end);
+
+    if (!psg->envelope_holding && (psg->envelope_next < end)) {
+      uint64_t steps = (end - psg->envelope_next - 1) / psg->envelope_period + 1;
 
-    psg->counter_2 = c1 & 0xFFFF;
+      psg->envelope_next += steps * psg->envelope_period;
+      advance_envelope(psg, steps);
+    }
+  } else {
+    for (;;) {
+      uint64_t time = psg->envelope_holding ? UINT64_MAX : psg->envelope_next;
 
-    /* --- Noise LFSR --- */
-    psg->count_noise &= 0xFFFF;
+      if (psg->noise_next < time)
+        time = psg->noise_next;
+      for (int channel = 0; channel < 3; channel++) {
+        if (psg->tone_next[channel] < time)
+          time = psg->tone_next[channel];
+      }
 
-    if ((psg->count_noise += psg->inc_noise) & 0xFFFF0000) {
-      psg->state_noise =
-        ((psg->noise_gen <<= 1)& 0x80000000
-           ? psg->noise_gen ^= 0x00040001
-           : psg->noise_gen) &
-        1;
+      if (time >= end)
+        break;
+
+      for (int channel = 0; channel < 3; channel++) {
+        if (psg->tone_next[channel] == time) {
+          psg->tone_output[channel] ^= 1;
+          psg->tone_next[channel] += psg->tone_period[channel];
+        }
+      }
+
+      /* 17-bit LFSR, feedback from bits 0 and 3 */
+      if (psg->noise_next == time) {
+        psg->noise_gen = (psg->noise_gen >> 1) | (((psg->noise_gen ^ (psg->noise_gen >> 3)) & 1) << 16);
+        psg->noise_output = psg->noise_gen & 1;
+        psg->noise_next += psg->noise_period;
+      }
+
+      if (!psg->envelope_holding && (psg->envelope_next == time)) {
+        psg->envelope_next += psg->envelope_period;
+        advance_envelope(psg, 1);
+        channel_amplitudes(psg, amplitude);
+      }
+
+      level = chip_level(psg, amplitude);
+      if (level != psg->output_level) {
+        add_step(num, (uint32_t)time, level - psg->output_level);
+        psg->output_level = level;
+      }
     }
+  }
 
-    /* --- Mix and write sample --- */
-    *lpb++ = (uint8_t)AUDIO_CONV(
-      (l0 * psg->volume_0 + l1 * psg->volume_1 + l2 * psg->volume_2) / 6 +
-      (psg->state_noise ? psg->volume_noise : -psg->volume_noise));
+  /* Generator times are relative to the start of the next chunk */
+  for (int channel = 0; channel < 3; channel++) {
+    psg->tone_next[channel] -= end;
   }
+  psg->noise_next -= end;
+  if (!psg->envelope_holding)
+    psg->envelope_next -= end;
 }
 
-/* ---------------------------------------------------------------------------
- * SDL audio callback - called from SDL's audio thread.
- * Generates fresh samples for all chips, then mixes them into the output
- * buffer around the unsigned-audio midpoint (128).
- * --------------------------------------------------------------------------*/
-static void audio_callback(void* userdata, uint8_t* stream, int len) {
-  (void)userdata;
+/* Audio output source: synthesises every chip for one chunk and adds the
+ * integral of their delta buffers, less any DC, to the mix.  Chips without
+ * steps in reach of the chunk are left out. */
+static void render_chips(float* mix, int num_samples) {
+  float steps[AUDIO_OUTPUT_CHUNK_SAMPLES];
 
-  if (!ay8910_initialised) {
-    memset(stream, 128, len); /* silence */
-    return;
-  }
-
-  /* len is in bytes; for 8-bit mono that equals number of samples.
-   * Clamp to our internal buffer size just in case SDL asks for more. */
-  int num_samples = (len < AUDIO_BUF_SIZE) ? len : AUDIO_BUF_SIZE;
+  memset(steps, 0, (size_t)num_samples * sizeof(steps[0]));
 
-  /* Generate samples for each chip */
   for (int chip = 0; chip < MAX_DEVICES; chip++) {
-    update_chip(chip, num_samples);
-  }
-
-  /* Mix all chips with clamping */
-  for (int i = 0; i < num_samples; i++) {
-    int mixed = 128;
+    float* delta = delta_buffer[chip];
+    int length;
 
-    for (int chip = 0; chip < MAX_DEVICES; chip++) {
-      mixed += (int)chip_buffer[chip][i] - 128;
-    }
+    update_chip(chip, num_samples);
 
-    if (mixed < 0) {
-      mixed = 0;
-    } else if (mixed > 255) {
-      mixed = 255;
+    length = delta_length[chip];
+    for (int i = 0; (i < num_samples) && (i < length); i++)
+      steps[i] += delta[i];
+
+    /* Carry the tails of steps near the end of the chunk */
+    if (length > num_samples) {
+      memmove(delta, delta + num_samples, (size_t)(length - num_samples) * sizeof(delta[0]));
+      memset(delta + length - num_samples, 0, (size_t)num_samples * sizeof(delta[0]));
+      delta_length[chip] = length - num_samples;
+    } else {
+      memset(delta, 0, (size_t)length * sizeof(delta[0]));
+      delta_length[chip] = 0;
     }
-
-    stream[i] = (uint8_t)mixed;
   }
 
-  if (num_samples < len) {
-    memset(stream + num_samples, 128, (size_t)(len - num_samples));
+  for (int i = 0; i < num_samples; i++) {
+    output_integral += steps[i];
+    output_dc += (output_integral - output_dc) * DC_BLOCK_RATE;
+    mix[i] += output_integral - output_dc;
   }
 }
 
@@ -280,13 +432,11 @@ void ay8910_write_reg(int n, int r, int v) {
     return;
   }
 
-  uint8_t value = (uint8_t)v;
-
-  if (audio_device != 0)
-    SDL_LockAudioDevice(audio_device);
+  /* Everything up to this cycle was made with the old value */
+  audio_output_sync(cpu_6502_get_cycles());
 
   ay8910_t* psg = &chips[n];
-  psg->regs[r] = value;
+  psg->regs[r] = (uint8_t)v;
 
   switch (r) {
     case AY_AVOL:
@@ -296,23 +446,24 @@ void ay8910_write_reg(int n, int r, int v) {
       break;
 
     case AY_ESHAPE:
-      psg->count_env = 0;
+      /* Restart the shape with a full first step */
       psg->regs[AY_ESHAPE] &= 0x0F;
+      psg->envelope_step = 0;
+      psg->envelope_holding = false;
+      psg->envelope_next = UINT64_MAX;
+      psg->envelope = envelope_forms[psg->regs[AY_ESHAPE]][0];
       break;
 
     case AY_PORTA:
       if (psg->port[0])
-        psg->port[0](psg, AY_PORTA, 1, value);
+        psg->port[0](psg, AY_PORTA, 1, (uint8_t)v);
       break;
 
     case AY_PORTB:
       if (psg->port[1])
-        psg->port[1](psg, AY_PORTB, 1, value);
+        psg->port[1](psg, AY_PORTB, 1, (uint8_t)v);
       break;
   }
-
-  if (audio_device != 0)
-    SDL_UnlockAudioDevice(audio_device);
 }
 
 uint8_t ay8910_read_reg(int n, int r) {
@@ -324,9 +475,6 @@ uint8_t ay8910_read_reg(int n, int r) {
     return 0xff;
   }
 
-  if (audio_device != 0)
-    SDL_LockAudioDevice(audio_device);
-
   ay8910_t* psg = &chips[n];
 
   switch (r) {
@@ -341,12 +489,7 @@ uint8_t ay8910_read_reg(int n, int r) {
       break;
   }
 
-  uint8_t result = psg->regs[r];
-
-  if (audio_device != 0)
-    SDL_UnlockAudioDevice(audio_device);
-
-  return result;
+  return psg->regs[r];
 }
 
 void ay8910_set_port_handler(int n, int port, ay8910_port_handler_t func) {
@@ -361,19 +504,27 @@ void ay8910_set_port_handler(int n, int port, ay8910_port_handler_t func) {
 static void reset_chip(int num) {
   ay8910_t* psg = &chips[num];
 
-  memset(psg->buffer, 0, AUDIO_BUF_SIZE);
   memset(psg->regs, 0, sizeof(psg->regs));
 
+  /* Return the output to zero from wherever it was */
+  if (psg->output_level != 0.0f)
+    add_step(num, 0, -psg->output_level);
+  psg->output_level = 0.0f;
+
   psg->noise_gen = 1;
-  psg->envelope = 15;
-  psg->state_noise = 0;
-
-  psg->inc_0 = psg->inc_1 = psg->inc_2 = 0;
-  psg->inc_env = psg->inc_noise = 0;
-  psg->counter_0 = psg->counter_1 = psg->counter_2 = 0;
-  psg->count_env = psg->count_noise = 0;
-  psg->volume_0 = psg->volume_1 = psg->volume_2 = 0;
-  psg->volume_noise = 0;
+  psg->noise_output = 0;
+  psg->envelope = envelope_forms[0][0];
+
+  for (int channel = 0; channel < 3; channel++) {
+    psg->tone_period[channel] = psg->tone_next[channel] = 0;
+    psg->tone_output[channel] = 0;
+  }
+  psg->noise_period = psg->noise_next = 0;
+  psg->envelope_period = 0;
+  psg->envelope_next = UINT64_MAX;
+  psg->envelope_step = 0;
+  psg->envelope_holding = false;
+  psg->active = false;
 }
 
 int ay8910_initialise(uint8_t bank, uint16_t address, uint16_t param, char* identifier) {
@@ -385,10 +536,14 @@ int ay8910_initialise(uint8_t bank, uint16_t address, uint16_t param, char* iden
   if (ay8910_initialised)
     return 0; /* already open */
 
-  /* Point each chip's buffer at its slot in chip_buffer */
+  build_blep_table();
+  memset(delta_buffer, 0, sizeof(delta_buffer));
+  memset(delta_length, 0, sizeof(delta_length));
+  output_integral = output_dc = 0.0f;
+
   for (int i = 0; i < MAX_DEVICES; i++) {
-    chips[i].buffer = chip_buffer[i];
     chips[i].port[0] = chips[i].port[1] = NULL;
+    chips[i].output_level = 0.0f;
     reset_chip(i);
   }
 
@@ -396,44 +551,9 @@ int ay8910_initialise(uint8_t bank, uint16_t address, uint16_t param, char* iden
     system_register_memory_mapped_device(address_table[i], address_table[i] + 1, ay8910_read_callback, ay8910_write_callback, false);
   }
 
-  /* For WSLg support - point PulseAudio to WSLg server if it exists */
-  const char* wslg_pulse = "/mnt/wslg/PulseServer";
-  struct stat st;
-  if (stat(wslg_pulse, &st) == 0 && S_ISSOCK(st.st_mode)) {
-    char pulse_server[256];
-    snprintf(pulse_server, sizeof(pulse_server), "unix:%s", wslg_pulse);
-    setenv("PULSE_SERVER", pulse_server, 0); /* don't override if already set */
-  }
-
-  /* Initialize SDL audio subsystem if not already done */
-  if (SDL_WasInit(SDL_INIT_AUDIO) == 0) {
-    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
-      printf("Warning: SDL_InitSubSystem(AUDIO) failed: %s\n", SDL_GetError());
-      printf("         AY8910 will run silently\n");
-      ay8910_initialised = true;
-      return 0;
-    }
-  }
-
-  /* Configure SDL audio: mono, 8-bit unsigned, 22050 Hz */
-  SDL_AudioSpec want, have;
-  SDL_zero(want);
-  want.freq = PLAYBACK_FREQUENCY;
-  want.format = AUDIO_U8;
-  want.channels = 1;
-  want.samples = AUDIO_BUF_SIZE;
-  want.callback = audio_callback;
-  want.userdata = NULL;
-
-  audio_device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
-  if (audio_device == 0) {
-    printf("Warning: SDL_OpenAudioDevice failed: %s\n", SDL_GetError());
-    printf("         AY8910 will run silently (this is normal in WSL1 or headless environments)\n");
-    /* Continue anyway - emulator works without sound */
-  } else {
-    /* Start playback */
-    SDL_PauseAudioDevice(audio_device, 0);
-  }
+  /* The emulator works without sound if there is no device */
+  audio_output_add_source(render_chips);
+  audio_output_open();
 
   ay8910_initialised = true;
   return 0;
@@ -446,6 +566,7 @@ void ay8910_reset(uint8_t bank, uint16_t address) {
   if (!ay8910_initialised)
     return;
 
+  audio_output_sync(cpu_6502_get_cycles());
   for (int i = 0; i < MAX_DEVICES; i++) {
     reset_chip(i);
   }
@@ -455,10 +576,6 @@ void ay8910_close(void) {
   if (!ay8910_initialised)
     return;
 
-  if (audio_device != 0) {
-    SDL_CloseAudioDevice(audio_device);
-    audio_device = 0;
-  }
-
+  audio_output_close();
   ay8910_initialised = false;
 }
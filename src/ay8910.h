@@ -26,9 +26,6 @@
 /* Chip clock */
 #define AY8910_CLOCK 750000000
 
-/* Convert signed sample (-128..127) to unsigned (0..255) */
-#define AUDIO_CONV(A) (128 + (A))
-
 /* Port handler signature */
 typedef struct ay8910_t ay8910_t;
 
@@ -39,23 +36,28 @@ typedef uint8_t (*ay8910_port_handler_t)(ay8910_t* psg, int port, int iswrite, u
 
 /* Internal chip state - one per emulated AY8910 */
 typedef struct ay8910_t {
-    uint8_t* buffer;               /* sample output buffer */
     ay8910_port_handler_t port[2]; /* port A/B handler callbacks */
     uint8_t regs[16];              /* hardware registers */
 
-    /* Oscillator state */
-    int inc_0, inc_1, inc_2;
-    int counter_0, counter_1, counter_2;
-
-    /* Envelope state */
-    int inc_env, count_env, envelope;
+    /* Tone state - half periods and time to the next flip, in 16.16
+     * fixed-point output samples */
+    uint32_t tone_period[3], tone_next[3];
+    int tone_output[3];
 
     /* Noise state */
-    int inc_noise, count_noise;
-    int state_noise, noise_gen;
+    uint32_t noise_period, noise_next;
+    uint32_t noise_gen;            /* 17-bit LFSR */
+    int noise_output;
+
+    /* Envelope state - step period and time to the next step, in 16.16
+     * fixed-point output samples, which can need more than 32 bits */
+    uint64_t envelope_period, envelope_next;
+    int envelope_step;             /* position in the shape, 0-31 */
+    int envelope;                  /* current level, 0-15 */
+    bool envelope_holding;
 
-    /* Cached volume values (recomputed each update) */
-    int volume_0, volume_1, volume_2, volume_noise;
+    float output_level;            /* sum of the channel outputs */
+    bool active;                   /* audible during the last update */
 } ay8910_t;
 
 /* Lifecycle - called via system_devices table */
@@ -1,8 +1,9 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
 #include "colour_vdu.h"
+#include "cpu_6502.h"
 #include "external_filenames.h"
 #include "function_return_codes.h"
 #include "system.h"
@@ -24,6 +25,15 @@
 #define SAA5050_GLYPH_COUNT      (SAA5050_ALPHA_GLYPHS + (2 * SAA5050_MOSAIC_GLYPHS))
 #define SAA5050_CHARACTER_SIZE   10
 #define SAA5050_DATA_SIZE        (SAA5050_GLYPH_COUNT * SAA5050_CHARACTER_SIZE)
+#define COLOUR_VDU_CELL_PIXELS   (COLOUR_VDU_CELL_WIDTH * COLOUR_VDU_CELL_HEIGHT)
+#define COLOUR_VDU_HEIGHT_PARTS  3
+#define GLYPH_TILE_COUNT         (SAA5050_GLYPH_COUNT * COLOUR_VDU_HEIGHT_PARTS * 8 * 8)
+#define GLYPH_TILES_PER_SLAB     256
+#define GLYPH_TILE_SLABS         ((GLYPH_TILE_COUNT + GLYPH_TILES_PER_SLAB - 1) / GLYPH_TILES_PER_SLAB)
+#define NO_CURSOR                -1
+#define DEFAULT_CLOCK_FREQUENCY  750000
+#define COLOUR_VDU_RAM_ROWS      (COLOUR_VDU_RAM_SIZE / COLOUR_VDU_COLUMNS)
+#define COLOUR_VDU_ROW_PIXELS    (COLOUR_VDU_CELL_HEIGHT * COLOUR_VDU_WIDTH)
 
 static uint8_t colour_vdu_ram[COLOUR_VDU_RAM_SIZE];
 static uint8_t crtc_registers[CRTC_REGISTER_COUNT];
@@ -35,8 +45,60 @@ static bool output_changed;
 static bool output_selected;
 static bool tanbug_initialisation_pending;
 static bool tanbug_force_standard_output;
-static unsigned int last_flash_phase;
-static unsigned int last_cursor_phase;
+// Emulated time for flash and cursor blink, advanced from CPU cycles
+static uint64_t emulated_ms;
+static uint64_t emulated_ms_cycles;
+static uint32_t cycles_per_ms = DEFAULT_CLOCK_FREQUENCY / 1000;
+
+// What is drawn in each cell of the frame: the tile shown normally and the
+// tile shown during the flash off phase. Lower halves of double-height
+// characters are recorded against the cell they are drawn in.
+typedef struct colour_vdu_cell_t {
+  uint16_t tile;
+  uint16_t hidden_tile;
+  bool flash;
+} colour_vdu_cell_t;
+
+// Rows of pixels in a ring starting at ring_base, so a start address change
+// of whole rows moves ring_base and only the newly exposed rows are drawn.
+// The arrays below are indexed by displayed row for drawn_start_address.
+static uint32_t frame[COLOUR_VDU_RAM_ROWS * COLOUR_VDU_ROW_PIXELS];
+static int ring_base;
+static uint16_t drawn_start_address;
+static colour_vdu_cell_t cells[COLOUR_VDU_ROWS][COLOUR_VDU_COLUMNS];
+// Cells of the next row that hold the lower half of a double-height character
+static bool lower_half_map[COLOUR_VDU_ROWS][COLOUR_VDU_COLUMNS];
+static bool row_double_height[COLOUR_VDU_ROWS];
+static bool row_dirty[COLOUR_VDU_ROWS];
+static bool full_redraw = true;
+static int flash_cell_count;
+static bool flash_drawn_visible = true;
+static bool cursor_drawn_visible;
+static int cursor_cell = NO_CURSOR;
+
+// A row of display RAM with its control codes already applied. Entries are
+// keyed by the RAM address of the row, so they survive the start address
+// moving, and also depend on which cells the row above covers with
+// double-height lower halves.
+typedef struct colour_vdu_decoded_row_t {
+  bool valid;
+  uint16_t address;
+  bool lower_allowed;
+  bool double_height;
+  bool lower_half_valid[COLOUR_VDU_COLUMNS];
+  bool render_lower[COLOUR_VDU_COLUMNS];
+  colour_vdu_cell_t top[COLOUR_VDU_COLUMNS];
+  colour_vdu_cell_t bottom[COLOUR_VDU_COLUMNS];
+} colour_vdu_decoded_row_t;
+
+static colour_vdu_decoded_row_t decoded_rows[COLOUR_VDU_RAM_ROWS];
+
+// Pre-expanded RGBA tiles, built on first use and carved out of slabs
+static uint32_t* glyph_tiles[GLYPH_TILE_COUNT];
+static uint32_t* tile_slabs[GLYPH_TILE_SLABS];
+static int tile_slab_count;
+static int tiles_in_slab = GLYPH_TILES_PER_SLAB;
+static uint32_t scratch_tile[COLOUR_VDU_CELL_PIXELS];
 
 static const uint32_t teletext_palette[8] = {
   0x000000FF,
@@ -52,6 +114,7 @@ typedef struct teletext_state_t {
   uint8_t foreground;
   uint8_t background;
   uint8_t held_mosaic;
+  uint8_t flash_off_held_mosaic;
   bool graphics;
   bool flash;
   bool conceal;
@@ -59,12 +122,17 @@ typedef struct teletext_state_t {
   bool hold;
   bool double_height;
   bool have_held_mosaic;
+  bool have_flash_off_held_mosaic;
 } teletext_state_t;
 
+// Blink phases follow emulated time, so they stop while the CPU is stopped
+// and are identical from run to run
 static unsigned int colour_vdu_time_ms(void) {
-  struct timespec now;
-  timespec_get(&now, TIME_UTC);
-  return (unsigned int)((uint64_t)now.tv_sec * 1000U + (uint64_t)now.tv_nsec / 1000000U);
+  uint64_t elapsed = (cpu_6502_get_cycles() - emulated_ms_cycles) / cycles_per_ms;
+
+  emulated_ms += elapsed;
+  emulated_ms_cycles += elapsed * cycles_per_ms;
+  return (unsigned int)emulated_ms;
 }
 
 static uint8_t colour_vdu_crtc_mask(uint8_t reg, uint8_t value) {
@@ -74,6 +142,31 @@ static uint8_t colour_vdu_crtc_mask(uint8_t reg, uint8_t value) {
   return value & masks[reg];
 }
 
+static uint16_t colour_vdu_start_address(void) {
+  return (uint16_t)(((crtc_registers[12] & 0x3F) << 8) | crtc_registers[13]);
+}
+
+// Drops decoded rows holding a RAM offset and marks its displayed row for
+// redrawing
+static void colour_vdu_mark_dirty(uint16_t offset) {
+  int row = ((offset - drawn_start_address) & 0x07FF) / COLOUR_VDU_COLUMNS;
+  int slot = offset / COLOUR_VDU_COLUMNS;
+
+  // Rows start anywhere, so the offset can be in this slot's row or the previous one's
+  for (int n = 0; n < 2; n++) {
+    colour_vdu_decoded_row_t* decoded =
+      &decoded_rows[(slot - n) & (COLOUR_VDU_RAM_ROWS - 1)];
+    if (((offset - decoded->address) & 0x07FF) < COLOUR_VDU_COLUMNS) {
+      decoded->valid = false;
+    }
+  }
+
+  if (row < COLOUR_VDU_ROWS) {
+    row_dirty[row] = true;
+    colour_vdu_updated = true;
+  }
+}
+
 static uint8_t colour_vdu_read(uint16_t address) {
   if (!colour_vdu_enabled) {
     if (tanbug_force_standard_output &&
@@ -127,35 +220,28 @@ static void colour_vdu_write(uint16_t address, uint8_t value) {
       output_changed = true;
     }
 
-    colour_vdu_ram[address - COLOUR_VDU_BASE] = value;
-    colour_vdu_updated = true;
+    uint16_t offset = address - COLOUR_VDU_BASE;
+    if (colour_vdu_ram[offset] != value) {
+      colour_vdu_ram[offset] = value;
+      colour_vdu_mark_dirty(offset);
+    }
     return;
   }
 
   if ((address & 1U) == 0) {
     crtc_selected_register = value & 0x1F;
   } else if (crtc_selected_register < CRTC_REGISTER_COUNT) {
-    crtc_registers[crtc_selected_register] =
-      colour_vdu_crtc_mask(crtc_selected_register, value);
-    colour_vdu_updated = true;
-  }
-}
-
-static void colour_vdu_set_pixel(uint32_t* pixels, int x, int y, uint32_t colour) {
-  if ((x >= 0) && (x < COLOUR_VDU_WIDTH) &&
-      (y >= 0) && (y < COLOUR_VDU_HEIGHT)) {
-    pixels[y * COLOUR_VDU_WIDTH + x] = colour;
-  }
-}
-
-static void colour_vdu_fill_cell(uint32_t* pixels, int cell_x, int cell_y,
-                                 uint32_t colour) {
-  int left = cell_x * COLOUR_VDU_CELL_WIDTH;
-  int top = cell_y * COLOUR_VDU_CELL_HEIGHT;
-
-  for (int y = 0; y < COLOUR_VDU_CELL_HEIGHT; y++) {
-    for (int x = 0; x < COLOUR_VDU_CELL_WIDTH; x++) {
-      colour_vdu_set_pixel(pixels, left + x, top + y, colour);
+    uint8_t masked = colour_vdu_crtc_mask(crtc_selected_register, value);
+
+    if (crtc_registers[crtc_selected_register] != masked) {
+      crtc_registers[crtc_selected_register] = masked;
+      // The cursor shape and address (R10, R11, R14, R15) only affect the
+      // cursor pass and the start address (R12, R13) is handled by
+      // scrolling the ring; anything else changes the layout
+      if ((crtc_selected_register < 10) || (crtc_selected_register > 15)) {
+        full_redraw = true;
+      }
+      colour_vdu_updated = true;
     }
   }
 }
@@ -177,47 +263,111 @@ static int colour_vdu_glyph_row(int output_row,
   return output_row;
 }
 
-static void colour_vdu_draw_alpha(uint32_t* pixels, int cell_x, int cell_y,
-                                  uint8_t character, uint32_t foreground,
-                                  uint32_t background,
-                                  colour_vdu_height_part_t height_part) {
-  int left = cell_x * COLOUR_VDU_CELL_WIDTH;
-  int top = cell_y * COLOUR_VDU_CELL_HEIGHT;
-  int glyph_index = (character & 0x7F) - 0x20;
-  const uint8_t* glyph =
-    character_data + glyph_index * SAA5050_CHARACTER_SIZE;
+static uint16_t colour_vdu_tile_key(int glyph_index,
+                                    colour_vdu_height_part_t height_part,
+                                    uint8_t foreground, uint8_t background) {
+  return (uint16_t)((((glyph_index * COLOUR_VDU_HEIGHT_PARTS) + height_part) * 8 +
+                     foreground) * 8 + background);
+}
 
-  for (int y = 0; y < COLOUR_VDU_CELL_HEIGHT; y++) {
-    uint8_t row = glyph[colour_vdu_glyph_row(y, height_part)];
+// A solid background cell: any glyph drawn with matching colours
+static uint16_t colour_vdu_fill_key(uint8_t background) {
+  return colour_vdu_tile_key(0, COLOUR_VDU_HEIGHT_NORMAL, background, background);
+}
 
-    for (int x = 0; x < COLOUR_VDU_CELL_WIDTH; x++) {
-      uint32_t colour = (row & (0x20U >> x)) ? foreground : background;
-      colour_vdu_set_pixel(pixels, left + x, top + y, colour);
+static const uint32_t* colour_vdu_tile(uint16_t key) {
+  uint32_t* tile = glyph_tiles[key];
+
+  if (tile) {
+    return tile;
+  }
+
+  if ((tiles_in_slab == GLYPH_TILES_PER_SLAB) &&
+      (tile_slab_count < GLYPH_TILE_SLABS)) {
+    uint32_t* slab =
+      malloc(GLYPH_TILES_PER_SLAB * COLOUR_VDU_CELL_PIXELS * sizeof(uint32_t));
+    if (slab) {
+      tile_slabs[tile_slab_count++] = slab;
+      tiles_in_slab = 0;
     }
   }
-}
 
-static void colour_vdu_draw_mosaic(uint32_t* pixels, int cell_x, int cell_y,
-                                   uint8_t mosaic, bool separated,
-                                   uint32_t foreground, uint32_t background,
-                                   colour_vdu_height_part_t height_part) {
-  int left = cell_x * COLOUR_VDU_CELL_WIDTH;
-  int top = cell_y * COLOUR_VDU_CELL_HEIGHT;
-  int glyph_index = SAA5050_ALPHA_GLYPHS + mosaic;
-  if (separated) {
-    glyph_index += SAA5050_MOSAIC_GLYPHS;
+  if (tiles_in_slab < GLYPH_TILES_PER_SLAB) {
+    tile = tile_slabs[tile_slab_count - 1] +
+           (tiles_in_slab++ * COLOUR_VDU_CELL_PIXELS);
+    glyph_tiles[key] = tile;
+  } else {
+    // Out of memory: build the tile each time it is drawn
+    tile = scratch_tile;
   }
-  const uint8_t* glyph =
-    character_data + glyph_index * SAA5050_CHARACTER_SIZE;
+
+  uint32_t background = teletext_palette[key & 7];
+  uint32_t foreground = teletext_palette[(key >> 3) & 7];
+  colour_vdu_height_part_t height_part =
+    (colour_vdu_height_part_t)((key >> 6) % COLOUR_VDU_HEIGHT_PARTS);
+  const uint8_t* glyph = character_data +
+    ((key >> 6) / COLOUR_VDU_HEIGHT_PARTS) * SAA5050_CHARACTER_SIZE;
+  uint32_t* pixel = tile;
 
   for (int y = 0; y < COLOUR_VDU_CELL_HEIGHT; y++) {
     uint8_t row = glyph[colour_vdu_glyph_row(y, height_part)];
+
     for (int x = 0; x < COLOUR_VDU_CELL_WIDTH; x++) {
-      uint32_t colour = (row & (0x20U >> x)) ? foreground : background;
-      colour_vdu_set_pixel(pixels, left + x, top + y, colour);
+      *pixel++ = (row & (0x20U >> x)) ? foreground : background;
     }
   }
+
+  return tile;
+}
+
+static uint32_t* colour_vdu_frame_row(int row) {
+  return frame +
+    ((ring_base + row) & (COLOUR_VDU_RAM_ROWS - 1)) * COLOUR_VDU_ROW_PIXELS;
+}
+
+static void colour_vdu_draw_cell(int row, int column) {
+  const colour_vdu_cell_t* cell = &cells[row][column];
+  const uint32_t* tile = colour_vdu_tile(
+    (cell->flash && !flash_drawn_visible) ? cell->hidden_tile : cell->tile);
+  uint32_t* target =
+    colour_vdu_frame_row(row) + (column * COLOUR_VDU_CELL_WIDTH);
+
+  for (int y = 0; y < COLOUR_VDU_CELL_HEIGHT; y++) {
+    memcpy(target, tile, COLOUR_VDU_CELL_WIDTH * sizeof(uint32_t));
+    target += COLOUR_VDU_WIDTH;
+    tile += COLOUR_VDU_CELL_WIDTH;
+  }
+}
+
+// A glyph index < 0 is a plain background cell. The cell flashes if it shows
+// something else while flashing characters are off.
+static colour_vdu_cell_t colour_vdu_make_cell(int glyph_index,
+                                              int hidden_glyph_index,
+                                              colour_vdu_height_part_t height_part,
+                                              uint8_t foreground,
+                                              uint8_t background) {
+  colour_vdu_cell_t cell;
+
+  cell.tile = (glyph_index < 0)
+    ? colour_vdu_fill_key(background)
+    : colour_vdu_tile_key(glyph_index, height_part, foreground, background);
+  cell.hidden_tile = (hidden_glyph_index < 0)
+    ? colour_vdu_fill_key(background)
+    : colour_vdu_tile_key(hidden_glyph_index, height_part, foreground, background);
+  cell.flash = glyph_index != hidden_glyph_index;
+  return cell;
 }
+
+static void colour_vdu_set_cell(int row, int column,
+                                const colour_vdu_cell_t* cell) {
+  cells[row][column] = *cell;
+  colour_vdu_draw_cell(row, column);
+}
+
+static int colour_vdu_mosaic_glyph(uint8_t mosaic, bool separated) {
+  return SAA5050_ALPHA_GLYPHS + mosaic + (separated ? SAA5050_MOSAIC_GLYPHS : 0);
+}
+
 static bool colour_vdu_is_mosaic(uint8_t character) {
   uint8_t code = character & 0x7F;
   return ((code >= 0x20) && (code <= 0x3F)) ||
@@ -273,6 +423,7 @@ static void colour_vdu_apply_control(teletext_state_t* state, uint8_t code) {
       case 0x1F:
         state->hold = false;
         state->have_held_mosaic = false;
+        state->have_flash_off_held_mosaic = false;
         break;
       default:
         break;
@@ -293,166 +444,347 @@ static bool colour_vdu_cursor_visible(unsigned int now_ms) {
   return ((now_ms / ((cursor_mode == 2) ? 500U : 250U)) & 1U) == 0;
 }
 
-void colour_vdu_render(uint32_t* pixels) {
-  unsigned int now_ms = colour_vdu_time_ms();
-  bool flash_visible = ((now_ms / 500U) & 1U) == 0;
-  bool cursor_visible = colour_vdu_cursor_visible(now_ms);
-  uint16_t start_address =
-    (uint16_t)(((crtc_registers[12] & 0x3F) << 8) | crtc_registers[13]);
-  uint16_t cursor_address =
-    (uint16_t)(((crtc_registers[14] & 0x3F) << 8) | crtc_registers[15]);
+static bool colour_vdu_flash_visible(unsigned int now_ms) {
+  return ((now_ms / 500U) & 1U) == 0;
+}
+
+static int colour_vdu_displayed_rows(void) {
   int displayed_rows = crtc_registers[6];
   if (displayed_rows > COLOUR_VDU_ROWS) {
     displayed_rows = COLOUR_VDU_ROWS;
   }
-  bool lower_half_valid[COLOUR_VDU_COLUMNS] = {false};
-  bool next_lower_half_valid[COLOUR_VDU_COLUMNS];
-
-  for (int i = 0; i < COLOUR_VDU_WIDTH * COLOUR_VDU_HEIGHT; i++) {
-    pixels[i] = teletext_palette[0];
-  }
-
-  for (int row = 0; row < displayed_rows; row++) {
-    memset(next_lower_half_valid, 0, sizeof(next_lower_half_valid));
-    teletext_state_t state = {
-      .foreground = 7,
-      .background = 0,
-      .held_mosaic = 0,
-      .graphics = false,
-      .flash = false,
-      .conceal = false,
-      .separated = false,
-      .hold = false,
-      .double_height = false,
-      .have_held_mosaic = false};
+  return displayed_rows;
+}
 
-    for (int column = 0; column < COLOUR_VDU_COLUMNS; column++) {
-      uint16_t display_address =
-        (uint16_t)((start_address + row * COLOUR_VDU_COLUMNS + column) & 0x07FF);
-      uint8_t raw_character = colour_vdu_ram[display_address];
-      uint8_t character = raw_character & 0x7F;
-      bool inverse = (raw_character & 0x80) != 0;
-      bool render_cell = !lower_half_valid[column];
-      bool render_lower = render_cell && state.double_height &&
-                          (row + 1 < displayed_rows);
-      colour_vdu_height_part_t height_part = state.double_height
-        ? COLOUR_VDU_HEIGHT_TOP
-        : COLOUR_VDU_HEIGHT_NORMAL;
-      uint32_t foreground = teletext_palette[state.foreground];
-      uint32_t background = teletext_palette[state.background];
-
-      if (inverse) {
-        uint32_t swap = foreground;
-        foreground = background;
-        background = swap;
-      }
+// Runs the teletext state machine over one row of display RAM
+static void colour_vdu_decode_row(colour_vdu_decoded_row_t* decoded,
+                                  uint16_t address,
+                                  const bool* lower_half_valid,
+                                  bool lower_allowed) {
+  teletext_state_t state = {
+    .foreground = 7,
+    .background = 0,
+    .held_mosaic = 0,
+    .flash_off_held_mosaic = 0,
+    .graphics = false,
+    .flash = false,
+    .conceal = false,
+    .separated = false,
+    .hold = false,
+    .double_height = false,
+    .have_held_mosaic = false,
+    .have_flash_off_held_mosaic = false};
+
+  decoded->valid = true;
+  decoded->address = address;
+  decoded->lower_allowed = lower_allowed;
+  decoded->double_height = false;
+  memcpy(decoded->lower_half_valid, lower_half_valid,
+         sizeof(decoded->lower_half_valid));
+
+  for (int column = 0; column < COLOUR_VDU_COLUMNS; column++) {
+    uint8_t raw_character =
+      colour_vdu_ram[(address + column) & 0x07FF];
+    uint8_t character = raw_character & 0x7F;
+    bool render_cell = !lower_half_valid[column];
+    bool render_lower = render_cell && state.double_height && lower_allowed;
+    colour_vdu_height_part_t height_part = state.double_height
+      ? COLOUR_VDU_HEIGHT_TOP
+      : COLOUR_VDU_HEIGHT_NORMAL;
+    uint8_t foreground = state.foreground;
+    uint8_t background = state.background;
+    int glyph_index = -1;
+    int hidden_glyph_index = -1;
+
+    if (raw_character & 0x80) {
+      uint8_t swap = foreground;
+      foreground = background;
+      background = swap;
+    }
 
-      if (character < 0x20) {
-        if (render_cell) {
-          if (state.graphics && (state.hold || (character == 0x1E)) &&
-              state.have_held_mosaic) {
-            colour_vdu_draw_mosaic(pixels, column, row, state.held_mosaic,
-                                   state.separated, foreground, background,
-                                   height_part);
-            if (render_lower) {
-              colour_vdu_draw_mosaic(pixels, column, row + 1,
-                                     state.held_mosaic, state.separated,
-                                     foreground, background,
-                                     COLOUR_VDU_HEIGHT_BOTTOM);
-            }
-          } else {
-            colour_vdu_fill_cell(pixels, column, row, background);
-            if (render_lower) {
-              colour_vdu_fill_cell(pixels, column, row + 1, background);
-            }
-          }
+    if (character < 0x20) {
+      if (state.graphics && (state.hold || (character == 0x1E))) {
+        if (state.have_held_mosaic) {
+          glyph_index =
+            colour_vdu_mosaic_glyph(state.held_mosaic, state.separated);
         }
-        colour_vdu_apply_control(&state, character);
-      } else if (state.conceal || (state.flash && !flash_visible)) {
-        if (render_cell) {
-          colour_vdu_fill_cell(pixels, column, row, background);
-          if (render_lower) {
-            colour_vdu_fill_cell(pixels, column, row + 1, background);
-          }
-        }
-      } else if (state.graphics && colour_vdu_is_mosaic(character)) {
-        uint8_t mosaic = colour_vdu_mosaic_bits(character);
-        if (render_cell) {
-          colour_vdu_draw_mosaic(pixels, column, row, mosaic, state.separated,
-                                 foreground, background, height_part);
-          if (render_lower) {
-            colour_vdu_draw_mosaic(pixels, column, row + 1, mosaic,
-                                   state.separated, foreground, background,
-                                   COLOUR_VDU_HEIGHT_BOTTOM);
-          }
-        }
-        state.held_mosaic = mosaic;
-        state.have_held_mosaic = true;
-      } else if (render_cell) {
-        colour_vdu_draw_alpha(pixels, column, row, character,
-                              foreground, background, height_part);
-        if (render_lower) {
-          colour_vdu_draw_alpha(pixels, column, row + 1, character,
-                                foreground, background,
-                                COLOUR_VDU_HEIGHT_BOTTOM);
+        if (state.have_flash_off_held_mosaic) {
+          hidden_glyph_index =
+            colour_vdu_mosaic_glyph(state.flash_off_held_mosaic, state.separated);
         }
       }
+      colour_vdu_apply_control(&state, character);
+    } else if (state.conceal) {
+      // Concealed characters display as background
+    } else if (state.graphics && colour_vdu_is_mosaic(character)) {
+      uint8_t mosaic = colour_vdu_mosaic_bits(character);
+      glyph_index = colour_vdu_mosaic_glyph(mosaic, state.separated);
+      state.held_mosaic = mosaic;
+      state.have_held_mosaic = true;
+      // A flashing mosaic is not drawn, so not held, while flash is off
+      if (!state.flash) {
+        hidden_glyph_index = glyph_index;
+        state.flash_off_held_mosaic = mosaic;
+        state.have_flash_off_held_mosaic = true;
+      }
+    } else {
+      glyph_index = character - 0x20;
+      hidden_glyph_index = state.flash ? -1 : glyph_index;
+    }
+
+    decoded->top[column] =
+      colour_vdu_make_cell(glyph_index, hidden_glyph_index, height_part,
+                           foreground, background);
+    decoded->bottom[column] =
+      colour_vdu_make_cell(glyph_index, hidden_glyph_index,
+                           COLOUR_VDU_HEIGHT_BOTTOM, foreground, background);
+    decoded->render_lower[column] = render_lower;
+    decoded->double_height |= state.double_height;
+  }
+}
+
+static const colour_vdu_decoded_row_t* colour_vdu_decoded_row(
+  uint16_t address, const bool* lower_half_valid, bool lower_allowed) {
+  colour_vdu_decoded_row_t* decoded =
+    &decoded_rows[address / COLOUR_VDU_COLUMNS];
+
+  if (!decoded->valid || (decoded->address != address) ||
+      (decoded->lower_allowed != lower_allowed) ||
+      (memcmp(decoded->lower_half_valid, lower_half_valid,
+              sizeof(decoded->lower_half_valid)) != 0)) {
+    colour_vdu_decode_row(decoded, address, lower_half_valid, lower_allowed);
+  }
+
+  return decoded;
+}
 
-      if (render_lower) {
-        next_lower_half_valid[column] = true;
+static void colour_vdu_render_row(int row, int displayed_rows,
+                                  uint16_t start_address) {
+  static const bool no_lower_halves[COLOUR_VDU_COLUMNS];
+  const bool* lower_half_valid =
+    (row > 0) ? lower_half_map[row - 1] : no_lower_halves;
+  const colour_vdu_decoded_row_t* decoded = colour_vdu_decoded_row(
+    (uint16_t)((start_address + row * COLOUR_VDU_COLUMNS) & 0x07FF),
+    lower_half_valid, row + 1 < displayed_rows);
+
+  row_double_height[row] = decoded->double_height;
+
+  for (int column = 0; column < COLOUR_VDU_COLUMNS; column++) {
+    if (!lower_half_valid[column]) {
+      colour_vdu_set_cell(row, column, &decoded->top[column]);
+      if (decoded->render_lower[column]) {
+        colour_vdu_set_cell(row + 1, column, &decoded->bottom[column]);
       }
+    }
+  }
 
-      if (cursor_visible && (display_address == (cursor_address & 0x07FF))) {
-        int cursor_start = crtc_registers[10] & 0x1F;
-        int cursor_end = crtc_registers[11] & 0x1F;
-        if (cursor_start >= COLOUR_VDU_CELL_HEIGHT) {
-          cursor_start = COLOUR_VDU_CELL_HEIGHT - 1;
-        }
-        if (cursor_end >= COLOUR_VDU_CELL_HEIGHT) {
-          cursor_end = COLOUR_VDU_CELL_HEIGHT - 1;
-        }
-        if (cursor_end < cursor_start) {
-          cursor_end = cursor_start;
-        }
+  // The next row's own cells change if the double-height layout did
+  if (memcmp(lower_half_map[row], decoded->render_lower,
+             sizeof(decoded->render_lower)) != 0) {
+    memcpy(lower_half_map[row], decoded->render_lower,
+           sizeof(decoded->render_lower));
+    if (row + 1 < COLOUR_VDU_ROWS) {
+      row_dirty[row + 1] = true;
+    }
+  }
+}
+
+// Follows a start address change of whole rows (positive scrolls the text
+// up), keeping the pixels and cell records of rows that stay on screen
+static void colour_vdu_scroll(int rows, int displayed_rows) {
+  int kept = COLOUR_VDU_ROWS - abs(rows);
+  int from = (rows > 0) ? rows : 0;
+  int to = (rows > 0) ? 0 : -rows;
+  bool covered_from_above = false;
+
+  if (rows > 0) {
+    // The new top row loses the double-height cover of the row scrolled off
+    for (int column = 0; column < COLOUR_VDU_COLUMNS; column++) {
+      covered_from_above |= lower_half_map[rows - 1][column];
+    }
+  }
+
+  memmove(cells[to], cells[from], kept * sizeof(cells[0]));
+  memmove(lower_half_map[to], lower_half_map[from],
+          kept * sizeof(lower_half_map[0]));
+  memmove(&row_double_height[to], &row_double_height[from],
+          kept * sizeof(row_double_height[0]));
+  memmove(&row_dirty[to], &row_dirty[from], kept * sizeof(row_dirty[0]));
+  ring_base = (ring_base + rows) & (COLOUR_VDU_RAM_ROWS - 1);
+
+  for (int row = 0; row < displayed_rows; row++) {
+    if ((row < to) || (row >= displayed_rows - from)) {
+      // Newly exposed rows hold stale pixels and nothing covers the row below
+      memset(lower_half_map[row], 0, sizeof(lower_half_map[row]));
+      row_dirty[row] = true;
+    } else if (row_double_height[row]) {
+      // Double-height halves may now be cut off by the bottom edge; the
+      // kept map lets the redraw spot a change in the row below
+      row_dirty[row] = true;
+    }
+  }
+
+  if (covered_from_above) {
+    row_dirty[0] = true;
+  }
+}
+
+static void colour_vdu_erase_cursor(void) {
+  if (cursor_cell != NO_CURSOR) {
+    colour_vdu_draw_cell(cursor_cell / COLOUR_VDU_COLUMNS,
+                         cursor_cell % COLOUR_VDU_COLUMNS);
+    cursor_cell = NO_CURSOR;
+  }
+}
+
+static void colour_vdu_draw_cursor(int displayed_rows, uint16_t start_address) {
+  uint16_t cursor_address =
+    (uint16_t)(((crtc_registers[14] & 0x3F) << 8) | crtc_registers[15]);
+  int cell = (cursor_address - start_address) & 0x07FF;
+  int row = cell / COLOUR_VDU_COLUMNS;
+  int column = cell % COLOUR_VDU_COLUMNS;
+
+  if (row >= displayed_rows) {
+    return;
+  }
+
+  int cursor_start = crtc_registers[10] & 0x1F;
+  int cursor_end = crtc_registers[11] & 0x1F;
+  if (cursor_start >= COLOUR_VDU_CELL_HEIGHT) {
+    cursor_start = COLOUR_VDU_CELL_HEIGHT - 1;
+  }
+  if (cursor_end >= COLOUR_VDU_CELL_HEIGHT) {
+    cursor_end = COLOUR_VDU_CELL_HEIGHT - 1;
+  }
+  if (cursor_end < cursor_start) {
+    cursor_end = cursor_start;
+  }
+
+  uint32_t* target =
+    colour_vdu_frame_row(row) + (column * COLOUR_VDU_CELL_WIDTH);
+  for (int y = cursor_start; y <= cursor_end; y++) {
+    for (int x = 0; x < COLOUR_VDU_CELL_WIDTH; x++) {
+      target[y * COLOUR_VDU_WIDTH + x] ^= 0xFFFFFF00U;
+    }
+  }
+
+  cursor_cell = cell;
+}
+
+// Brings the frame up to date, redrawing only dirty rows, cells whose flash
+// phase changed and the cursor cell, then copies it out
+void colour_vdu_render(uint32_t* pixels) {
+  unsigned int now_ms = colour_vdu_time_ms();
+  bool flash_visible = colour_vdu_flash_visible(now_ms);
+  bool cursor_visible = colour_vdu_cursor_visible(now_ms);
+  uint16_t start_address = colour_vdu_start_address();
+  int displayed_rows = colour_vdu_displayed_rows();
+  bool rows_rendered = false;
+
+  colour_vdu_erase_cursor();
+
+  if (!full_redraw && (start_address != drawn_start_address)) {
+    int delta = (start_address - drawn_start_address) & 0x07FF;
+    int rows = delta / COLOUR_VDU_COLUMNS;
+
+    if (rows > COLOUR_VDU_RAM_ROWS / 2) {
+      rows -= COLOUR_VDU_RAM_ROWS;
+    }
+
+    if (((delta % COLOUR_VDU_COLUMNS) != 0) || (abs(rows) >= displayed_rows)) {
+      full_redraw = true;
+    } else {
+      colour_vdu_scroll(rows, displayed_rows);
+    }
+  }
+  drawn_start_address = start_address;
+
+  if (full_redraw) {
+    for (size_t i = 0; i < sizeof(frame) / sizeof(frame[0]); i++) {
+      frame[i] = teletext_palette[0];
+    }
+    memset(cells, 0, sizeof(cells));
+    memset(lower_half_map, 0, sizeof(lower_half_map));
+    memset(row_double_height, 0, sizeof(row_double_height));
+    for (int row = 0; row < COLOUR_VDU_ROWS; row++) {
+      row_dirty[row] = row < displayed_rows;
+    }
+    full_redraw = false;
+  }
+
+  if (flash_visible != flash_drawn_visible) {
+    flash_drawn_visible = flash_visible;
 
-        int left = column * COLOUR_VDU_CELL_WIDTH;
-        int top = row * COLOUR_VDU_CELL_HEIGHT;
-        for (int y = cursor_start; y <= cursor_end; y++) {
-          for (int x = 0; x < COLOUR_VDU_CELL_WIDTH; x++) {
-            uint32_t* pixel =
-              &pixels[(top + y) * COLOUR_VDU_WIDTH + left + x];
-            *pixel ^= 0xFFFFFF00U;
-          }
+    for (int row = 0; (row < displayed_rows) && (flash_cell_count > 0); row++) {
+      for (int column = 0; column < COLOUR_VDU_COLUMNS; column++) {
+        if (cells[row][column].flash) {
+          colour_vdu_draw_cell(row, column);
         }
       }
     }
+  }
+
+  for (int row = 0; row < displayed_rows; row++) {
+    if (row_dirty[row]) {
+      colour_vdu_render_row(row, displayed_rows, start_address);
+      row_dirty[row] = false;
+      rows_rendered = true;
+    }
+  }
 
-    memcpy(lower_half_valid, next_lower_half_valid,
-           sizeof(lower_half_valid));
+  if (rows_rendered) {
+    flash_cell_count = 0;
+    for (int row = 0; row < displayed_rows; row++) {
+      for (int column = 0; column < COLOUR_VDU_COLUMNS; column++) {
+        flash_cell_count += cells[row][column].flash;
+      }
+    }
   }
 
+  if (cursor_visible) {
+    colour_vdu_draw_cursor(displayed_rows, start_address);
+  }
+  cursor_drawn_visible = cursor_visible;
+
+  for (int row = 0; row < COLOUR_VDU_ROWS; row++) {
+    uint32_t* target = pixels + row * COLOUR_VDU_ROW_PIXELS;
+
+    if (row < displayed_rows) {
+      memcpy(target, colour_vdu_frame_row(row),
+             COLOUR_VDU_ROW_PIXELS * sizeof(uint32_t));
+    } else {
+      for (int i = 0; i < COLOUR_VDU_ROW_PIXELS; i++) {
+        target[i] = teletext_palette[0];
+      }
+    }
+  }
   colour_vdu_updated = false;
 }
+
 bool colour_vdu_updated_event(void) {
   unsigned int now_ms = colour_vdu_time_ms();
-  unsigned int flash_phase = now_ms / 500U;
-  unsigned int cursor_phase = now_ms / 250U;
   bool updated = colour_vdu_updated ||
-                 (flash_phase != last_flash_phase) ||
-                 (cursor_phase != last_cursor_phase);
+                 ((flash_cell_count > 0) &&
+                  (colour_vdu_flash_visible(now_ms) != flash_drawn_visible)) ||
+                 (colour_vdu_cursor_visible(now_ms) != cursor_drawn_visible);
 
-  last_flash_phase = flash_phase;
-  last_cursor_phase = cursor_phase;
   colour_vdu_updated = false;
   return updated;
 }
 
+void colour_vdu_set_clock_frequency(int frequency) {
+  // Bank the time elapsed at the old rate first
+  colour_vdu_time_ms();
+  cycles_per_ms = (frequency >= 1000) ? (uint32_t)(frequency / 1000) : 1;
+}
+
 void colour_vdu_set_enabled(bool enabled) {
   colour_vdu_enabled = enabled;
   if (!enabled) {
     output_changed = false;
     output_selected = false;
   }
+  full_redraw = true;
   colour_vdu_updated = true;
 }
 
@@ -484,9 +816,19 @@ void colour_vdu_reset(uint8_t bank, uint16_t address) {
   output_changed = false;
   output_selected = false;
   tanbug_initialisation_pending = true;
+  full_redraw = true;
   colour_vdu_updated = true;
 }
 
+void colour_vdu_close(void) {
+  for (int slab = 0; slab < tile_slab_count; slab++) {
+    free(tile_slabs[slab]);
+  }
+  memset(glyph_tiles, 0, sizeof(glyph_tiles));
+  tile_slab_count = 0;
+  tiles_in_slab = GLYPH_TILES_PER_SLAB;
+}
+
 int colour_vdu_initialise(uint8_t bank, uint16_t address, uint16_t param,
                           char* identifier) {
   (void)bank;
@@ -9,11 +9,13 @@
 
 extern int colour_vdu_initialise(uint8_t bank, uint16_t address, uint16_t param, char* identifier);
 extern void colour_vdu_reset(uint8_t bank, uint16_t address);
+extern void colour_vdu_set_clock_frequency(int frequency);
 extern void colour_vdu_set_enabled(bool enabled);
 extern bool colour_vdu_get_enabled(void);
 extern bool colour_vdu_output_changed_event(void);
 extern bool colour_vdu_output_selected(void);
 extern bool colour_vdu_updated_event(void);
 extern void colour_vdu_render(uint32_t* pixels);
+extern void colour_vdu_close(void);
 
 #endif // __COLOUR_VDU_H__
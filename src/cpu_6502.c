@@ -2,6 +2,8 @@
 #include <stdint.h>
 
 #include "cpu_6502.h"
+#include "cpu_trace.h"
+#include "debugger.h"
 #include "display.h"
 #include "function_return_codes.h"
 #include "rtc.h"
@@ -15,7 +17,10 @@ typedef struct
     void (*instruction)();
     void (*address_mode)();
 } instruction_t;
-static const instruction_t instruction_table[256];
+static const instruction_t nmos_instruction_table[256];
+static const instruction_t cmos_instruction_table[256];
+static const instruction_t* instruction_table = cmos_instruction_table;
+static cpu_6502_variant_t cpu_variant = CPU_6502_VARIANT_65C02;
 
 static uint8_t opcode;
 static uint8_t reg_a;
@@ -34,6 +39,9 @@ static uint16_t word_value;
 static int sum;
 static int delayed_nmi_counter = 0;
 static int instruction_length;
+static uint8_t interrupt_clear_flags = PSW_D;
+static uint32_t decimal_extra_ticks = 1;
+static uint64_t cpu_cycles = 0;
 
 uint16_t cpu_6502_get_pc() {
   return reg_pc;
@@ -59,6 +67,14 @@ uint8_t cpu_6502_get_psw() {
   return reg_psw;
 }
 
+uint64_t cpu_6502_get_cycles() {
+  return cpu_cycles;
+}
+
+static void set_nz_flags(uint8_t value) {
+  reg_psw = (reg_psw & ~(PSW_N | PSW_Z)) | (value & PSW_N) | (value ? 0 : PSW_Z);
+}
+
 /*
 ** Addressing modes
 */
@@ -86,7 +102,7 @@ static void relative() {
     save_pc -= 0x100;
   }
 
-  if ((save_pc >> 8) != (reg_pc >> 8)) {
+  if (((reg_pc + save_pc) & 0xff00) != (reg_pc & 0xff00)) {
     instruction_ticks++;
   }
 }
@@ -99,13 +115,23 @@ static void indirect() {
   reg_pc++;
 }
 
+/* NMOS JMP ($xxFF) fetches the high byte from $xx00 */
+static void indirect_page_wrap() {
+  instruction_length = 3;
+  word_value = system_read_memory(reg_pc) + (system_read_memory(reg_pc + 1) << 8);
+  save_pc = system_read_memory(word_value) + (system_read_memory((word_value & 0xff00) | ((word_value + 1) & 0x00ff)) << 8);
+  reg_pc++;
+  reg_pc++;
+}
+
 static void absolute_x() {
   instruction_length = 3;
   save_pc = system_read_memory(reg_pc) + (system_read_memory(reg_pc + 1) << 8);
   reg_pc++;
   reg_pc++;
 
-  if (instruction_table[opcode].ticks == 4) {
+  // 65C02 shifts and rotates only take their extra cycle on a page cross
+  if ((instruction_table[opcode].ticks == 4) || (instruction_table[opcode].ticks == 6)) {
     if ((save_pc >> 8) != ((save_pc + reg_x) >> 8)) {
       instruction_ticks++;
     }
@@ -149,13 +175,13 @@ static void zero_page_y() {
 static void indirect_x() {
   instruction_length = 4;
   byte_value = system_read_memory(reg_pc++) + reg_x;
-  save_pc = system_read_memory(byte_value) + (system_read_memory(byte_value + 1) << 8);
+  save_pc = system_read_memory(byte_value) + (system_read_memory((uint8_t)(byte_value + 1)) << 8);
 }
 
 static void indirect_y() {
   instruction_length = 4;
   byte_value = system_read_memory(reg_pc++);
-  save_pc = system_read_memory(byte_value) + (system_read_memory(byte_value + 1) << 8);
+  save_pc = system_read_memory(byte_value) + (system_read_memory((uint8_t)(byte_value + 1)) << 8);
 
   if (instruction_table[opcode].ticks == 5) {
     if ((save_pc >> 8) != ((save_pc + reg_y) >> 8)) {
@@ -175,15 +201,14 @@ static void indirect_absolute_x() {
 static void indirect_zero_page() {
   instruction_length = 2;
   byte_value = system_read_memory(reg_pc++);
-  save_pc = system_read_memory(byte_value) + (system_read_memory(byte_value + 1) << 8);
+  save_pc = system_read_memory(byte_value) + (system_read_memory((uint8_t)(byte_value + 1)) << 8);
 }
 
 /*
 ** Instructions
 */
-static void adc() {
-  instruction_table[opcode].address_mode();
-  byte_value = system_read_memory(save_pc);
+/* Add byte_value to the accumulator, shared by both cores */
+static void adc_value() {
   save_carry = (reg_psw & PSW_C) ? 1 : 0;
 
   if (reg_psw & PSW_D) {
@@ -237,8 +262,6 @@ static void adc() {
     }
   }
 
-  instruction_ticks++;
-
   if (reg_a) {
     reg_psw &= ~PSW_Z;
   } else {
@@ -246,6 +269,16 @@ static void adc() {
   }
 }
 
+static void adc() {
+  instruction_table[opcode].address_mode();
+  byte_value = system_read_memory(save_pc);
+  adc_value();
+
+  if (reg_psw & PSW_D) {
+    instruction_ticks += decimal_extra_ticks;
+  }
+}
+
 static void and () {
   instruction_table[opcode].address_mode();
   byte_value = system_read_memory(save_pc);
@@ -343,8 +376,10 @@ static void bit() {
     reg_psw |= 0x02;
   }
 
-  /* set negative and overflow flags from m_bValue */
-  reg_psw = (reg_psw & 0x3f) | (byte_value & 0xc0);
+  /* set negative and overflow flags from m_bValue, except for the 65C02's BIT # */
+  if (instruction_table[opcode].address_mode != immediate) {
+    reg_psw = (reg_psw & 0x3f) | (byte_value & 0xc0);
+  }
 }
 
 static void bmi() {
@@ -377,12 +412,14 @@ static void bpl() {
   }
 }
 
+// B only exists in the copy of P pushed by BRK and PHP
 static void brk() {
   reg_pc++;
-  reg_psw |= 0x14;
   system_write_memory(0x0100 + reg_sp--, (uint8_t)(reg_pc >> 8));
   system_write_memory(0x0100 + reg_sp--, (uint8_t)(reg_pc & 0xff));
-  system_write_memory(0x0100 + reg_sp--, reg_psw);
+  system_write_memory(0x0100 + reg_sp--, reg_psw | PSW_B | 0x20);
+  reg_psw |= PSW_I;
+  reg_psw &= ~interrupt_clear_flags;
   reg_pc = system_read_memory(0xfffe) + ((uint16_t)system_read_memory(0xffff) << 8);
 }
 
@@ -744,7 +781,7 @@ static void pha() {
 }
 
 static void php() {
-  system_write_memory(0x100 + reg_sp--, reg_psw);
+  system_write_memory(0x100 + reg_sp--, reg_psw | PSW_B | 0x20);
 }
 
 static void pla() {
@@ -868,9 +905,8 @@ static void rts() {
   reg_pc++;
 }
 
-static void sbc() {
-  instruction_table[opcode].address_mode();
-  byte_value = system_read_memory(save_pc);
+/* Subtract byte_value from the accumulator, shared by both cores */
+static void sbc_value() {
   save_carry = 1 - (reg_psw & 0x01);
   sum = ((int)reg_a) - ((int)byte_value) - save_carry;
 
@@ -902,8 +938,6 @@ static void sbc() {
     reg_a = sum & 0xff;
   }
 
-  instruction_ticks++;
-
   if (reg_a) {
     reg_psw &= 0xfd;
   } else {
@@ -917,6 +951,16 @@ static void sbc() {
   }
 }
 
+static void sbc() {
+  instruction_table[opcode].address_mode();
+  byte_value = system_read_memory(save_pc);
+  sbc_value();
+
+  if (reg_psw & PSW_D) {
+    instruction_ticks += decimal_extra_ticks;
+  }
+}
+
 static void sec() {
   reg_psw |= 0x01;
 }
@@ -1113,9 +1157,10 @@ static void stz() {
 
 static void tsb() {
   instruction_table[opcode].address_mode();
-  system_write_memory(save_pc, system_read_memory(save_pc) | reg_a);
+  byte_value = system_read_memory(save_pc);
+  system_write_memory(save_pc, byte_value | reg_a);
 
-  if (system_read_memory(save_pc)) {
+  if (byte_value & reg_a) {
     reg_psw &= 0xfd;
   } else {
     reg_psw |= 0x02;
@@ -1124,363 +1169,1650 @@ static void tsb() {
 
 static void trb() {
   instruction_table[opcode].address_mode();
-  system_write_memory(save_pc, system_read_memory(save_pc) & (reg_a ^ 0xff));
+  byte_value = system_read_memory(save_pc);
+  system_write_memory(save_pc, byte_value & (reg_a ^ 0xff));
 
-  if (system_read_memory(save_pc)) {
+  if (byte_value & reg_a) {
     reg_psw &= 0xfd;
   } else {
     reg_psw |= 0x02;
   }
 }
 
-static const instruction_t instruction_table[256] =
+/*
+** Undefined opcodes
+**
+** The NMOS part decodes these into combinations of the documented
+** operations. The *_value helpers work on byte_value so the cycle-exact core
+** can share them. The unstable opcodes use the usual magic-constant models.
+*/
+static void read_operand(void (*operation)()) {
+  instruction_table[opcode].address_mode();
+  byte_value = system_read_memory(save_pc);
+  operation();
+}
+
+static void write_operand(void (*operation)()) {
+  instruction_table[opcode].address_mode();
+  operation();
+  system_write_memory(save_pc, byte_value);
+}
+
+static void modify_operand(void (*operation)()) {
+  instruction_table[opcode].address_mode();
+  byte_value = system_read_memory(save_pc);
+  system_write_memory(save_pc, byte_value);
+  operation();
+  system_write_memory(save_pc, byte_value);
+}
+
+/* High byte of the un-indexed address plus one, as ANDed in by SHA/SHX/SHY/TAS */
+static uint8_t unstable_high_byte(uint8_t index) {
+  return (uint8_t)(((uint16_t)(save_pc - index) >> 8) + 1);
+}
+
+static void nop_value() {
+}
+
+static void slo_value() {
+  reg_psw = (reg_psw & ~PSW_C) | ((byte_value >> 7) & 0x01);
+  byte_value <<= 1;
+  reg_a |= byte_value;
+  set_nz_flags(reg_a);
+}
+
+static void rla_value() {
+  save_carry = reg_psw & PSW_C;
+  reg_psw = (reg_psw & ~PSW_C) | ((byte_value >> 7) & 0x01);
+  byte_value = (byte_value << 1) | save_carry;
+  reg_a &= byte_value;
+  set_nz_flags(reg_a);
+}
+
+static void sre_value() {
+  reg_psw = (reg_psw & ~PSW_C) | (byte_value & 0x01);
+  byte_value >>= 1;
+  reg_a ^= byte_value;
+  set_nz_flags(reg_a);
+}
+
+static void rra_value() {
+  save_carry = reg_psw & PSW_C;
+  reg_psw = (reg_psw & ~PSW_C) | (byte_value & 0x01);
+  byte_value = (byte_value >> 1) | (save_carry << 7);
+  adc_value();
+}
+
+static void dcp_value() {
+  byte_value--;
+
+  if (reg_a >= byte_value) {
+    reg_psw |= PSW_C;
+  } else {
+    reg_psw &= ~PSW_C;
+  }
+
+  set_nz_flags(reg_a - byte_value);
+}
+
+static void isc_value() {
+  byte_value++;
+  sbc_value();
+}
+
+static void sax_value() {
+  byte_value = reg_a & reg_x;
+}
+
+static void sha_value() {
+  byte_value = reg_a & reg_x & unstable_high_byte(reg_y);
+}
+
+static void shx_value() {
+  byte_value = reg_x & unstable_high_byte(reg_y);
+}
+
+static void shy_value() {
+  byte_value = reg_y & unstable_high_byte(reg_x);
+}
+
+static void tas_value() {
+  reg_sp = reg_a & reg_x;
+  byte_value = reg_sp & unstable_high_byte(reg_y);
+}
+
+static void lax_value() {
+  reg_a = reg_x = byte_value;
+  set_nz_flags(reg_a);
+}
+
+static void las_value() {
+  reg_a = reg_x = reg_sp = byte_value & reg_sp;
+  set_nz_flags(reg_a);
+}
+
+static void anc_value() {
+  reg_a &= byte_value;
+  set_nz_flags(reg_a);
+  reg_psw = (reg_psw & ~PSW_C) | (reg_a >> 7);
+}
+
+static void alr_value() {
+  reg_a &= byte_value;
+  reg_psw = (reg_psw & ~PSW_C) | (reg_a & 0x01);
+  reg_a >>= 1;
+  set_nz_flags(reg_a);
+}
+
+static void arr_value() {
+  reg_a &= byte_value;
+  reg_a = (reg_a >> 1) | ((reg_psw & PSW_C) << 7);
+  set_nz_flags(reg_a);
+  reg_psw = (reg_psw & ~(PSW_C | PSW_V)) | ((reg_a >> 6) & 0x01) | ((reg_a ^ (reg_a << 1)) & PSW_V);
+}
+
+static void sbx_value() {
+  uint8_t value = reg_a & reg_x;
+
+  if (value >= byte_value) {
+    reg_psw |= PSW_C;
+  } else {
+    reg_psw &= ~PSW_C;
+  }
+
+  reg_x = value - byte_value;
+  set_nz_flags(reg_x);
+}
+
+static void ane_value() {
+  reg_a = (reg_a | 0xee) & reg_x & byte_value;
+  set_nz_flags(reg_a);
+}
+
+static void lxa_value() {
+  reg_a = reg_x = (reg_a | 0xee) & byte_value;
+  set_nz_flags(reg_a);
+}
+
+static void nop_read() {
+  read_operand(nop_value);
+}
+
+static void slo() {
+  modify_operand(slo_value);
+}
+
+static void rla() {
+  modify_operand(rla_value);
+}
+
+static void sre() {
+  modify_operand(sre_value);
+}
+
+static void rra() {
+  modify_operand(rra_value);
+}
+
+static void dcp() {
+  modify_operand(dcp_value);
+}
+
+static void isc() {
+  modify_operand(isc_value);
+}
+
+static void sax() {
+  write_operand(sax_value);
+}
+
+static void sha() {
+  write_operand(sha_value);
+}
+
+static void shx() {
+  write_operand(shx_value);
+}
+
+static void shy() {
+  write_operand(shy_value);
+}
+
+static void tas() {
+  write_operand(tas_value);
+}
+
+static void lax() {
+  read_operand(lax_value);
+}
+
+static void las() {
+  read_operand(las_value);
+}
+
+static void anc() {
+  read_operand(anc_value);
+}
+
+static void alr() {
+  read_operand(alr_value);
+}
+
+static void arr() {
+  read_operand(arr_value);
+}
+
+static void sbx() {
+  read_operand(sbx_value);
+}
+
+static void ane() {
+  read_operand(ane_value);
+}
+
+static void lxa() {
+  read_operand(lxa_value);
+}
+
+/* Halts the NMOS part: keep fetching the same opcode until reset */
+static void jam() {
+  reg_pc--;
+}
+
+/* NMOS 6502, including the stable undocumented opcodes */
+static const instruction_t nmos_instruction_table[256] =
   {
     {7, brk, implied},             // 0x00
     {6, ora, indirect_x},          // 0x01
-    {2, brk, implied},             // 0x02
-    {2, brk, implied},             // 0x03
-    {3, tsb, zero_page},           // 0x04
+    {2, jam, implied},             // 0x02
+    {8, slo, indirect_x},          // 0x03
+    {3, nop_read, zero_page},      // 0x04
     {3, ora, zero_page},           // 0x05
     {5, asl, zero_page},           // 0x06
-    {2, brk, implied},             // 0x07
+    {5, slo, zero_page},           // 0x07
     {3, php, implied},             // 0x08
-    {3, ora, immediate},           // 0x09
+    {2, ora, immediate},           // 0x09
     {2, asla, implied},            // 0x0A
-    {2, brk, implied},             // 0x0B
-    {4, tsb, absolute},            // 0x0C
+    {2, anc, immediate},           // 0x0B
+    {4, nop_read, absolute},       // 0x0C
     {4, ora, absolute},            // 0x0D
     {6, asl, absolute},            // 0x0E
-    {2, brk, implied},             // 0x0F
+    {6, slo, absolute},            // 0x0F
     {2, bpl, relative},            // 0x10
     {5, ora, indirect_y},          // 0x11
-    {3, ora, indirect_zero_page},  // 0x12
-    {2, brk, implied},             // 0x13
-    {3, trb, zero_page},           // 0x14
+    {2, jam, implied},             // 0x12
+    {8, slo, indirect_y},          // 0x13
+    {4, nop_read, zero_page_x},    // 0x14
     {4, ora, zero_page_x},         // 0x15
     {6, asl, zero_page_x},         // 0x16
-    {2, brk, implied},             // 0x17
+    {6, slo, zero_page_x},         // 0x17
     {2, clc, implied},             // 0x18
     {4, ora, absolute_y},          // 0x19
-    {2, ina, implied},             // 0x1A
-    {2, brk, implied},             // 0x1B
-    {4, trb, absolute},            // 0x1C
+    {2, nop, implied},             // 0x1A
+    {7, slo, absolute_y},          // 0x1B
+    {4, nop_read, absolute_x},     // 0x1C
     {4, ora, absolute_x},          // 0x1D
     {7, asl, absolute_x},          // 0x1E
-    {2, brk, implied},             // 0x1F
+    {7, slo, absolute_x},          // 0x1F
     {6, jsr, absolute},            // 0x20
     {6, and, indirect_x},          // 0x21
-    {2, brk, implied},             // 0x22
-    {2, brk, implied},             // 0x23
+    {2, jam, implied},             // 0x22
+    {8, rla, indirect_x},          // 0x23
     {3, bit, zero_page},           // 0x24
     {3, and, zero_page},           // 0x25
     {5, rol, zero_page},           // 0x26
-    {2, brk, implied},             // 0x27
+    {5, rla, zero_page},           // 0x27
     {4, plp, implied},             // 0x28
-    {3, and, immediate},           // 0x29
+    {2, and, immediate},           // 0x29
     {2, rola, implied},            // 0x2A
-    {2, brk, implied},             // 0x2B
+    {2, anc, immediate},           // 0x2B
     {4, bit, absolute},            // 0x2C
     {4, and, absolute},            // 0x2D
     {6, rol, absolute},            // 0x2E
-    {2, brk, implied},             // 0x2F
+    {6, rla, absolute},            // 0x2F
     {2, bmi, relative},            // 0x30
     {5, and, indirect_y},          // 0x31
-    {3, and, indirect_zero_page},  // 0x32
-    {2, brk, implied},             // 0x33
-    {4, bit, zero_page_x},         // 0x34
+    {2, jam, implied},             // 0x32
+    {8, rla, indirect_y},          // 0x33
+    {4, nop_read, zero_page_x},    // 0x34
     {4, and, zero_page_x},         // 0x35
     {6, rol, zero_page_x},         // 0x36
-    {2, brk, implied},             // 0x37
+    {6, rla, zero_page_x},         // 0x37
     {2, sec, implied},             // 0x38
     {4, and, absolute_y},          // 0x39
-    {2, dea, implied},             // 0x3A
-    {2, brk, implied},             // 0x3B
-    {4, bit, absolute_x},          // 0x3C
+    {2, nop, implied},             // 0x3A
+    {7, rla, absolute_y},          // 0x3B
+    {4, nop_read, absolute_x},     // 0x3C
     {4, and, absolute_x},          // 0x3D
     {7, rol, absolute_x},          // 0x3E
-    {2, brk, implied},             // 0x3F
+    {7, rla, absolute_x},          // 0x3F
     {6, rti, implied},             // 0x40
     {6, eor, indirect_x},          // 0x41
-    {2, brk, implied},             // 0x42
-    {2, brk, implied},             // 0x43
-    {2, brk, implied},             // 0x44
+    {2, jam, implied},             // 0x42
+    {8, sre, indirect_x},          // 0x43
+    {3, nop_read, zero_page},      // 0x44
     {3, eor, zero_page},           // 0x45
     {5, lsr, zero_page},           // 0x46
-    {2, brk, implied},             // 0x47
+    {5, sre, zero_page},           // 0x47
     {3, pha, implied},             // 0x48
-    {3, eor, immediate},           // 0x49
+    {2, eor, immediate},           // 0x49
     {2, lsra, implied},            // 0x4A
-    {2, brk, implied},             // 0x4B
+    {2, alr, immediate},           // 0x4B
     {3, jmp, absolute},            // 0x4C
     {4, eor, absolute},            // 0x4D
     {6, lsr, absolute},            // 0x4E
-    {2, brk, implied},             // 0x4F
+    {6, sre, absolute},            // 0x4F
     {2, bvc, relative},            // 0x50
     {5, eor, indirect_y},          // 0x51
-    {3, eor, indirect_zero_page},  // 0x52
-    {2, brk, implied},             // 0x53
-    {2, brk, implied},             // 0x54
+    {2, jam, implied},             // 0x52
+    {8, sre, indirect_y},          // 0x53
+    {4, nop_read, zero_page_x},    // 0x54
     {4, eor, zero_page_x},         // 0x55
     {6, lsr, zero_page_x},         // 0x56
-    {2, brk, implied},             // 0x57
+    {6, sre, zero_page_x},         // 0x57
     {2, cli, implied},             // 0x58
     {4, eor, absolute_y},          // 0x59
-    {3, phy, implied},             // 0x5A
-    {2, brk, implied},             // 0x5B
-    {2, brk, implied},             // 0x5C
+    {2, nop, implied},             // 0x5A
+    {7, sre, absolute_y},          // 0x5B
+    {4, nop_read, absolute_x},     // 0x5C
     {4, eor, absolute_x},          // 0x5D
     {7, lsr, absolute_x},          // 0x5E
-    {2, brk, implied},             // 0x5F
+    {7, sre, absolute_x},          // 0x5F
     {6, rts, implied},             // 0x60
     {6, adc, indirect_x},          // 0x61
-    {2, brk, implied},             // 0x62
-    {2, brk, implied},             // 0x63
-    {3, stz, zero_page},           // 0x64
+    {2, jam, implied},             // 0x62
+    {8, rra, indirect_x},          // 0x63
+    {3, nop_read, zero_page},      // 0x64
     {3, adc, zero_page},           // 0x65
     {5, ror, zero_page},           // 0x66
-    {2, brk, implied},             // 0x67
+    {5, rra, zero_page},           // 0x67
     {4, pla, implied},             // 0x68
-    {3, adc, immediate},           // 0x69
+    {2, adc, immediate},           // 0x69
     {2, rora, implied},            // 0x6A
-    {2, brk, implied},             // 0x6B
-    {5, jmp, indirect},            // 0x6C
+    {2, arr, immediate},           // 0x6B
+    {5, jmp, indirect_page_wrap},  // 0x6C
     {4, adc, absolute},            // 0x6D
     {6, ror, absolute},            // 0x6E
-    {2, brk, implied},             // 0x6F
+    {6, rra, absolute},            // 0x6F
     {2, bvs, relative},            // 0x70
     {5, adc, indirect_y},          // 0x71
-    {3, adc, indirect_zero_page},  // 0x72
-    {2, brk, implied},             // 0x73
-    {4, stz, zero_page_x},         // 0x74
+    {2, jam, implied},             // 0x72
+    {8, rra, indirect_y},          // 0x73
+    {4, nop_read, zero_page_x},    // 0x74
     {4, adc, zero_page_x},         // 0x75
     {6, ror, zero_page_x},         // 0x76
-    {2, brk, implied},             // 0x77
+    {6, rra, zero_page_x},         // 0x77
     {2, sei, implied},             // 0x78
     {4, adc, absolute_y},          // 0x79
-    {4, ply, implied},             // 0x7A
-    {2, brk, implied},             // 0x7B
-    {6, jmp, indirect_absolute_x}, // 0x7C
+    {2, nop, implied},             // 0x7A
+    {7, rra, absolute_y},          // 0x7B
+    {4, nop_read, absolute_x},     // 0x7C
     {4, adc, absolute_x},          // 0x7D
     {7, ror, absolute_x},          // 0x7E
-    {2, brk, implied},             // 0x7F
-    {2, bra, relative},            // 0x80
+    {7, rra, absolute_x},          // 0x7F
+    {2, nop_read, immediate},      // 0x80
     {6, sta, indirect_x},          // 0x81
-    {2, brk, implied},             // 0x82
-    {2, brk, implied},             // 0x83
-    {2, sty, zero_page},           // 0x84
-    {2, sta, zero_page},           // 0x85
-    {2, stx, zero_page},           // 0x86
-    {2, brk, implied},             // 0x87
+    {2, nop_read, immediate},      // 0x82
+    {6, sax, indirect_x},          // 0x83
+    {3, sty, zero_page},           // 0x84
+    {3, sta, zero_page},           // 0x85
+    {3, stx, zero_page},           // 0x86
+    {3, sax, zero_page},           // 0x87
     {2, dey, implied},             // 0x88
-    {2, bit, immediate},           // 0x89
+    {2, nop_read, immediate},      // 0x89
     {2, txa, implied},             // 0x8A
-    {2, brk, implied},             // 0x8B
+    {2, ane, immediate},           // 0x8B
     {4, sty, absolute},            // 0x8C
     {4, sta, absolute},            // 0x8D
     {4, stx, absolute},            // 0x8E
-    {2, brk, implied},             // 0x8F
+    {4, sax, absolute},            // 0x8F
     {2, bcc, relative},            // 0x90
     {6, sta, indirect_y},          // 0x91
-    {3, sta, indirect_zero_page},  // 0x92
-    {2, brk, implied},             // 0x93
+    {2, jam, implied},             // 0x92
+    {6, sha, indirect_y},          // 0x93
     {4, sty, zero_page_x},         // 0x94
     {4, sta, zero_page_x},         // 0x95
     {4, stx, zero_page_y},         // 0x96
-    {2, brk, implied},             // 0x97
+    {4, sax, zero_page_y},         // 0x97
     {2, tya, implied},             // 0x98
     {5, sta, absolute_y},          // 0x99
     {2, txs, implied},             // 0x9A
-    {2, brk, implied},             // 0x9B
-    {4, stz, absolute},            // 0x9C
+    {5, tas, absolute_y},          // 0x9B
+    {5, shy, absolute_x},          // 0x9C
     {5, sta, absolute_x},          // 0x9D
-    {5, stz, absolute_x},          // 0x9E
-    {2, brk, implied},             // 0x9F
-    {3, ldy, immediate},           // 0xA0
+    {5, shx, absolute_y},          // 0x9E
+    {5, sha, absolute_y},          // 0x9F
+    {2, ldy, immediate},           // 0xA0
     {6, lda, indirect_x},          // 0xA1
-    {3, ldx, immediate},           // 0xA2
-    {2, brk, implied},             // 0xA3
+    {2, ldx, immediate},           // 0xA2
+    {6, lax, indirect_x},          // 0xA3
     {3, ldy, zero_page},           // 0xA4
     {3, lda, zero_page},           // 0xA5
     {3, ldx, zero_page},           // 0xA6
-    {2, brk, implied},             // 0xA7
+    {3, lax, zero_page},           // 0xA7
     {2, tay, implied},             // 0xA8
-    {3, lda, immediate},           // 0xA9
+    {2, lda, immediate},           // 0xA9
     {2, tax, implied},             // 0xAA
-    {2, brk, implied},             // 0xAB
+    {2, lxa, immediate},           // 0xAB
     {4, ldy, absolute},            // 0xAC
     {4, lda, absolute},            // 0xAD
     {4, ldx, absolute},            // 0xAE
-    {2, brk, implied},             // 0xAF
+    {4, lax, absolute},            // 0xAF
     {2, bcs, relative},            // 0xB0
     {5, lda, indirect_y},          // 0xB1
-    {3, lda, indirect_zero_page},  // 0xB2
-    {2, brk, implied},             // 0xB3
+    {2, jam, implied},             // 0xB2
+    {5, lax, indirect_y},          // 0xB3
     {4, ldy, zero_page_x},         // 0xB4
     {4, lda, zero_page_x},         // 0xB5
     {4, ldx, zero_page_y},         // 0xB6
-    {2, brk, implied},             // 0xB7
+    {4, lax, zero_page_y},         // 0xB7
     {2, clv, implied},             // 0xB8
     {4, lda, absolute_y},          // 0xB9
     {2, tsx, implied},             // 0xBA
-    {2, brk, implied},             // 0xBB
+    {4, las, absolute_y},          // 0xBB
     {4, ldy, absolute_x},          // 0xBC
     {4, lda, absolute_x},          // 0xBD
     {4, ldx, absolute_y},          // 0xBE
-    {2, brk, implied},             // 0xBF
-    {3, cpy, immediate},           // 0xC0
+    {4, lax, absolute_y},          // 0xBF
+    {2, cpy, immediate},           // 0xC0
     {6, cmp, indirect_x},          // 0xC1
-    {2, brk, implied},             // 0xC2
-    {2, brk, implied},             // 0xC3
+    {2, nop_read, immediate},      // 0xC2
+    {8, dcp, indirect_x},          // 0xC3
     {3, cpy, zero_page},           // 0xC4
     {3, cmp, zero_page},           // 0xC5
     {5, dec, zero_page},           // 0xC6
-    {2, brk, implied},             // 0xC7
+    {5, dcp, zero_page},           // 0xC7
     {2, iny, implied},             // 0xC8
-    {3, cmp, immediate},           // 0xC9
+    {2, cmp, immediate},           // 0xC9
     {2, dex, implied},             // 0xCA
-    {2, brk, implied},             // 0xCB
+    {2, sbx, immediate},           // 0xCB
     {4, cpy, absolute},            // 0xCC
     {4, cmp, absolute},            // 0xCD
     {6, dec, absolute},            // 0xCE
-    {2, brk, implied},             // 0xCF
+    {6, dcp, absolute},            // 0xCF
     {2, bne, relative},            // 0xD0
     {5, cmp, indirect_y},          // 0xD1
-    {3, cmp, indirect_zero_page},  // 0xD2
-    {2, brk, implied},             // 0xD3
-    {2, brk, implied},             // 0xD4
+    {2, jam, implied},             // 0xD2
+    {8, dcp, indirect_y},          // 0xD3
+    {4, nop_read, zero_page_x},    // 0xD4
     {4, cmp, zero_page_x},         // 0xD5
     {6, dec, zero_page_x},         // 0xD6
-    {2, brk, implied},             // 0xD7
+    {6, dcp, zero_page_x},         // 0xD7
     {2, cld, implied},             // 0xD8
     {4, cmp, absolute_y},          // 0xD9
-    {3, phx, implied},             // 0xDA
-    {2, brk, implied},             // 0xDB
-    {2, brk, implied},             // 0xDC
+    {2, nop, implied},             // 0xDA
+    {7, dcp, absolute_y},          // 0xDB
+    {4, nop_read, absolute_x},     // 0xDC
     {4, cmp, absolute_x},          // 0xDD
     {7, dec, absolute_x},          // 0xDE
-    {2, brk, implied},             // 0xDF
-    {3, cpx, immediate},           // 0xE0
+    {7, dcp, absolute_x},          // 0xDF
+    {2, cpx, immediate},           // 0xE0
     {6, sbc, indirect_x},          // 0xE1
-    {2, brk, implied},             // 0xE2
-    {2, brk, implied},             // 0xE3
+    {2, nop_read, immediate},      // 0xE2
+    {8, isc, indirect_x},          // 0xE3
     {3, cpx, zero_page},           // 0xE4
     {3, sbc, zero_page},           // 0xE5
     {5, inc, zero_page},           // 0xE6
-    {2, brk, implied},             // 0xE7
+    {5, isc, zero_page},           // 0xE7
     {2, inx, implied},             // 0xE8
-    {3, sbc, immediate},           // 0xE9
+    {2, sbc, immediate},           // 0xE9
     {2, nop, implied},             // 0xEA
-    {2, brk, implied},             // 0xEB
+    {2, sbc, immediate},           // 0xEB
     {4, cpx, absolute},            // 0xEC
     {4, sbc, absolute},            // 0xED
     {6, inc, absolute},            // 0xEE
-    {2, brk, implied},             // 0xEF
+    {6, isc, absolute},            // 0xEF
     {2, beq, relative},            // 0xF0
     {5, sbc, indirect_y},          // 0xF1
-    {3, sbc, indirect_zero_page},  // 0xF2
-    {2, brk, implied},             // 0xF3
-    {2, brk, implied},             // 0xF4
+    {2, jam, implied},             // 0xF2
+    {8, isc, indirect_y},          // 0xF3
+    {4, nop_read, zero_page_x},    // 0xF4
     {4, sbc, zero_page_x},         // 0xF5
     {6, inc, zero_page_x},         // 0xF6
-    {2, brk, implied},             // 0xF7
+    {6, isc, zero_page_x},         // 0xF7
     {2, sed, implied},             // 0xF8
     {4, sbc, absolute_y},          // 0xF9
-    {4, plx, implied},             // 0xFA
-    {2, brk, implied},             // 0xFB
-    {2, brk, implied},             // 0xFC
+    {2, nop, implied},             // 0xFA
+    {7, isc, absolute_y},          // 0xFB
+    {4, nop_read, absolute_x},     // 0xFC
     {4, sbc, absolute_x},          // 0xFD
     {7, inc, absolute_x},          // 0xFE
-    {2, brk, implied},             // 0xFF
+    {7, isc, absolute_x},          // 0xFF
 };
 
-/* Non maskable interrupt */
-void cpu_6502_assert_nmi() {
-  flag_nmi = true;
-  reg_psw &= ~PSW_B;
-}
-
-void nmi() {
-  system_write_memory(0x0100 + reg_sp--, (uint8_t)(reg_pc >> 8));
-  system_write_memory(0x0100 + reg_sp--, (uint8_t)(reg_pc & 0xff));
-  system_write_memory(0x0100 + reg_sp--, reg_psw);
-  reg_psw |= 0x04;
-  reg_pc = system_read_memory(0xfffa);
-  reg_pc |= (uint16_t)system_read_memory(0xfffb) << 8;
-  flag_nmi = false;
-}
-
-/* Maskable Interrupt */
-void cpu_6502_assert_irq() {
-  flag_irq = true;
-  reg_psw &= ~PSW_B;
-}
-
-void irq() {
-  system_write_memory(0x0100 + reg_sp--, (uint8_t)(reg_pc >> 8));
-  system_write_memory(0x0100 + reg_sp--, (uint8_t)(reg_pc & 0xff));
-  system_write_memory(0x0100 + reg_sp--, reg_psw);
-  reg_psw |= 0x04;
-  reg_pc = system_read_memory(0xfffe);
-  reg_pc |= (uint16_t)system_read_memory(0xffff) << 8;
-  flag_irq = false;
-}
-
-/* Execute a number of instructions */
-void cpu_6502_execute(int timer_ticks) {
-  uint32_t cpu_ticks;
-
-  rtc_update();
-
-  while (timer_ticks > 0) {
-    opcode = system_read_memory(reg_pc++);
-    instruction_ticks = instruction_table[opcode].ticks;
-    instruction_table[opcode].instruction();
-    cpu_ticks = instruction_ticks;
-    timer_ticks -= cpu_ticks;
-
-    if (via_6522_update(instruction_ticks)) {
-      flag_irq = true;
-    }
-    tandos_update(instruction_ticks);
-
-    if (delayed_nmi_counter > 0) {
-      delayed_nmi_counter -= instruction_length;
-
-      if (delayed_nmi_counter <= 0) {
-        flag_nmi = true;
-      }
-    }
-
-    if ((flag_irq) && ((reg_psw & PSW_I) == 0)) {
-      irq();
-    }
-
-    if (flag_nmi) {
-      nmi();
-    }
-  }
-}
-
-void cpu_6502_delayed_nmi_callback(uint16_t address, uint8_t value) {
-  (void)value;
-  if ((address & 0x03) == 1) {
-    delayed_nmi_counter = 8;
-  }
-}
-
-void cpu_6502_continue(uint16_t pc, uint8_t a, uint8_t ix, uint8_t iy, uint8_t sp, uint8_t psw) {
-  reg_pc = pc;
-  reg_a = a;
-  reg_x = ix;
-  reg_y = iy;
-  reg_sp = sp;
-  reg_psw = psw;
-  flag_irq = false;
-  flag_nmi = false;
-}
-
-void cpu_6502_reset(uint8_t bank, uint16_t address) {
-  (void)bank;
+/* 65C02, where every undefined opcode is a NOP */
+static const instruction_t cmos_instruction_table[256] =
+  {
+    {7, brk, implied},             // 0x00
+    {6, ora, indirect_x},          // 0x01
+    {2, nop_read, immediate},      // 0x02
+    {1, nop, implied},             // 0x03
+    {5, tsb, zero_page},           // 0x04
+    {3, ora, zero_page},           // 0x05
+    {5, asl, zero_page},           // 0x06
+    {1, nop, implied},             // 0x07
+    {3, php, implied},             // 0x08
+    {2, ora, immediate},           // 0x09
+    {2, asla, implied},            // 0x0A
+    {1, nop, implied},             // 0x0B
+    {6, tsb, absolute},            // 0x0C
+    {4, ora, absolute},            // 0x0D
+    {6, asl, absolute},            // 0x0E
+    {1, nop, implied},             // 0x0F
+    {2, bpl, relative},            // 0x10
+    {5, ora, indirect_y},          // 0x11
+    {5, ora, indirect_zero_page},  // 0x12
+    {1, nop, implied},             // 0x13
+    {5, trb, zero_page},           // 0x14
+    {4, ora, zero_page_x},         // 0x15
+    {6, asl, zero_page_x},         // 0x16
+    {1, nop, implied},             // 0x17
+    {2, clc, implied},             // 0x18
+    {4, ora, absolute_y},          // 0x19
+    {2, ina, implied},             // 0x1A
+    {1, nop, implied},             // 0x1B
+    {6, trb, absolute},            // 0x1C
+    {4, ora, absolute_x},          // 0x1D
+    {6, asl, absolute_x},          // 0x1E
+    {1, nop, implied},             // 0x1F
+    {6, jsr, absolute},            // 0x20
+    {6, and, indirect_x},          // 0x21
+    {2, nop_read, immediate},      // 0x22
+    {1, nop, implied},             // 0x23
+    {3, bit, zero_page},           // 0x24
+    {3, and, zero_page},           // 0x25
+    {5, rol, zero_page},           // 0x26
+    {1, nop, implied},             // 0x27
+    {4, plp, implied},             // 0x28
+    {2, and, immediate},           // 0x29
+    {2, rola, implied},            // 0x2A
+    {1, nop, implied},             // 0x2B
+    {4, bit, absolute},            // 0x2C
+    {4, and, absolute},            // 0x2D
+    {6, rol, absolute},            // 0x2E
+    {1, nop, implied},             // 0x2F
+    {2, bmi, relative},            // 0x30
+    {5, and, indirect_y},          // 0x31
+    {5, and, indirect_zero_page},  // 0x32
+    {1, nop, implied},             // 0x33
+    {4, bit, zero_page_x},         // 0x34
+    {4, and, zero_page_x},         // 0x35
+    {6, rol, zero_page_x},         // 0x36
+    {1, nop, implied},             // 0x37
+    {2, sec, implied},             // 0x38
+    {4, and, absolute_y},          // 0x39
+    {2, dea, implied},             // 0x3A
+    {1, nop, implied},             // 0x3B
+    {4, bit, absolute_x},          // 0x3C
+    {4, and, absolute_x},          // 0x3D
+    {6, rol, absolute_x},          // 0x3E
+    {1, nop, implied},             // 0x3F
+    {6, rti, implied},             // 0x40
+    {6, eor, indirect_x},          // 0x41
+    {2, nop_read, immediate},      // 0x42
+    {1, nop, implied},             // 0x43
+    {3, nop_read, zero_page},      // 0x44
+    {3, eor, zero_page},           // 0x45
+    {5, lsr, zero_page},           // 0x46
+    {1, nop, implied},             // 0x47
+    {3, pha, implied},             // 0x48
+    {2, eor, immediate},           // 0x49
+    {2, lsra, implied},            // 0x4A
+    {1, nop, implied},             // 0x4B
+    {3, jmp, absolute},            // 0x4C
+    {4, eor, absolute},            // 0x4D
+    {6, lsr, absolute},            // 0x4E
+    {1, nop, implied},             // 0x4F
+    {2, bvc, relative},            // 0x50
+    {5, eor, indirect_y},          // 0x51
+    {5, eor, indirect_zero_page},  // 0x52
+    {1, nop, implied},             // 0x53
+    {4, nop_read, zero_page_x},    // 0x54
+    {4, eor, zero_page_x},         // 0x55
+    {6, lsr, zero_page_x},         // 0x56
+    {1, nop, implied},             // 0x57
+    {2, cli, implied},             // 0x58
+    {4, eor, absolute_y},          // 0x59
+    {3, phy, implied},             // 0x5A
+    {1, nop, implied},             // 0x5B
+    {8, nop_read, absolute},       // 0x5C
+    {4, eor, absolute_x},          // 0x5D
+    {6, lsr, absolute_x},          // 0x5E
+    {1, nop, implied},             // 0x5F
+    {6, rts, implied},             // 0x60
+    {6, adc, indirect_x},          // 0x61
+    {2, nop_read, immediate},      // 0x62
+    {1, nop, implied},             // 0x63
+    {3, stz, zero_page},           // 0x64
+    {3, adc, zero_page},           // 0x65
+    {5, ror, zero_page},           // 0x66
+    {1, nop, implied},             // 0x67
+    {4, pla, implied},             // 0x68
+    {2, adc, immediate},           // 0x69
+    {2, rora, implied},            // 0x6A
+    {1, nop, implied},             // 0x6B
+    {6, jmp, indirect},            // 0x6C
+    {4, adc, absolute},            // 0x6D
+    {6, ror, absolute},            // 0x6E
+    {1, nop, implied},             // 0x6F
+    {2, bvs, relative},            // 0x70
+    {5, adc, indirect_y},          // 0x71
+    {5, adc, indirect_zero_page},  // 0x72
+    {1, nop, implied},             // 0x73
+    {4, stz, zero_page_x},         // 0x74
+    {4, adc, zero_page_x},         // 0x75
+    {6, ror, zero_page_x},         // 0x76
+    {1, nop, implied},             // 0x77
+    {2, sei, implied},             // 0x78
+    {4, adc, absolute_y},          // 0x79
+    {4, ply, implied},             // 0x7A
+    {1, nop, implied},             // 0x7B
+    {6, jmp, indirect_absolute_x}, // 0x7C
+    {4, adc, absolute_x},          // 0x7D
+    {6, ror, absolute_x},          // 0x7E
+    {1, nop, implied},             // 0x7F
+    {2, bra, relative},            // 0x80
+    {6, sta, indirect_x},          // 0x81
+    {2, nop_read, immediate},      // 0x82
+    {1, nop, implied},             // 0x83
+    {3, sty, zero_page},           // 0x84
+    {3, sta, zero_page},           // 0x85
+    {3, stx, zero_page},           // 0x86
+    {1, nop, implied},             // 0x87
+    {2, dey, implied},             // 0x88
+    {2, bit, immediate},           // 0x89
+    {2, txa, implied},             // 0x8A
+    {1, nop, implied},             // 0x8B
+    {4, sty, absolute},            // 0x8C
+    {4, sta, absolute},            // 0x8D
+    {4, stx, absolute},            // 0x8E
+    {1, nop, implied},             // 0x8F
+    {2, bcc, relative},            // 0x90
+    {6, sta, indirect_y},          // 0x91
+    {5, sta, indirect_zero_page},  // 0x92
+    {1, nop, implied},             // 0x93
+    {4, sty, zero_page_x},         // 0x94
+    {4, sta, zero_page_x},         // 0x95
+    {4, stx, zero_page_y},         // 0x96
+    {1, nop, implied},             // 0x97
+    {2, tya, implied},             // 0x98
+    {5, sta, absolute_y},          // 0x99
+    {2, txs, implied},             // 0x9A
+    {1, nop, implied},             // 0x9B
+    {4, stz, absolute},            // 0x9C
+    {5, sta, absolute_x},          // 0x9D
+    {5, stz, absolute_x},          // 0x9E
+    {1, nop, implied},             // 0x9F
+    {2, ldy, immediate},           // 0xA0
+    {6, lda, indirect_x},          // 0xA1
+    {2, ldx, immediate},           // 0xA2
+    {1, nop, implied},             // 0xA3
+    {3, ldy, zero_page},           // 0xA4
+    {3, lda, zero_page},           // 0xA5
+    {3, ldx, zero_page},           // 0xA6
+    {1, nop, implied},             // 0xA7
+    {2, tay, implied},             // 0xA8
+    {2, lda, immediate},           // 0xA9
+    {2, tax, implied},             // 0xAA
+    {1, nop, implied},             // 0xAB
+    {4, ldy, absolute},            // 0xAC
+    {4, lda, absolute},            // 0xAD
+    {4, ldx, absolute},            // 0xAE
+    {1, nop, implied},             // 0xAF
+    {2, bcs, relative},            // 0xB0
+    {5, lda, indirect_y},          // 0xB1
+    {5, lda, indirect_zero_page},  // 0xB2
+    {1, nop, implied},             // 0xB3
+    {4, ldy, zero_page_x},         // 0xB4
+    {4, lda, zero_page_x},         // 0xB5
+    {4, ldx, zero_page_y},         // 0xB6
+    {1, nop, implied},             // 0xB7
+    {2, clv, implied},             // 0xB8
+    {4, lda, absolute_y},          // 0xB9
+    {2, tsx, implied},             // 0xBA
+    {1, nop, implied},             // 0xBB
+    {4, ldy, absolute_x},          // 0xBC
+    {4, lda, absolute_x},          // 0xBD
+    {4, ldx, absolute_y},          // 0xBE
+    {1, nop, implied},             // 0xBF
+    {2, cpy, immediate},           // 0xC0
+    {6, cmp, indirect_x},          // 0xC1
+    {2, nop_read, immediate},      // 0xC2
+    {1, nop, implied},             // 0xC3
+    {3, cpy, zero_page},           // 0xC4
+    {3, cmp, zero_page},           // 0xC5
+    {5, dec, zero_page},           // 0xC6
+    {1, nop, implied},             // 0xC7
+    {2, iny, implied},             // 0xC8
+    {2, cmp, immediate},           // 0xC9
+    {2, dex, implied},             // 0xCA
+    {1, nop, implied},             // 0xCB
+    {4, cpy, absolute},            // 0xCC
+    {4, cmp, absolute},            // 0xCD
+    {6, dec, absolute},            // 0xCE
+    {1, nop, implied},             // 0xCF
+    {2, bne, relative},            // 0xD0
+    {5, cmp, indirect_y},          // 0xD1
+    {5, cmp, indirect_zero_page},  // 0xD2
+    {1, nop, implied},             // 0xD3
+    {4, nop_read, zero_page_x},    // 0xD4
+    {4, cmp, zero_page_x},         // 0xD5
+    {6, dec, zero_page_x},         // 0xD6
+    {1, nop, implied},             // 0xD7
+    {2, cld, implied},             // 0xD8
+    {4, cmp, absolute_y},          // 0xD9
+    {3, phx, implied},             // 0xDA
+    {1, nop, implied},             // 0xDB
+    {4, nop_read, absolute},       // 0xDC
+    {4, cmp, absolute_x},          // 0xDD
+    {7, dec, absolute_x},          // 0xDE
+    {1, nop, implied},             // 0xDF
+    {2, cpx, immediate},           // 0xE0
+    {6, sbc, indirect_x},          // 0xE1
+    {2, nop_read, immediate},      // 0xE2
+    {1, nop, implied},             // 0xE3
+    {3, cpx, zero_page},           // 0xE4
+    {3, sbc, zero_page},           // 0xE5
+    {5, inc, zero_page},           // 0xE6
+    {1, nop, implied},             // 0xE7
+    {2, inx, implied},             // 0xE8
+    {2, sbc, immediate},           // 0xE9
+    {2, nop, implied},             // 0xEA
+    {1, nop, implied},             // 0xEB
+    {4, cpx, absolute},            // 0xEC
+    {4, sbc, absolute},            // 0xED
+    {6, inc, absolute},            // 0xEE
+    {1, nop, implied},             // 0xEF
+    {2, beq, relative},            // 0xF0
+    {5, sbc, indirect_y},          // 0xF1
+    {5, sbc, indirect_zero_page},  // 0xF2
+    {1, nop, implied},             // 0xF3
+    {4, nop_read, zero_page_x},    // 0xF4
+    {4, sbc, zero_page_x},         // 0xF5
+    {6, inc, zero_page_x},         // 0xF6
+    {1, nop, implied},             // 0xF7
+    {2, sed, implied},             // 0xF8
+    {4, sbc, absolute_y},          // 0xF9
+    {4, plx, implied},             // 0xFA
+    {1, nop, implied},             // 0xFB
+    {4, nop_read, absolute},       // 0xFC
+    {4, sbc, absolute_x},          // 0xFD
+    {7, inc, absolute_x},          // 0xFE
+    {1, nop, implied},             // 0xFF
+};
+
+
+/* Non maskable interrupt */
+void cpu_6502_assert_nmi() {
+  flag_nmi = true;
+  reg_psw &= ~PSW_B;
+}
+
+void nmi() {
+  system_write_memory(0x0100 + reg_sp--, (uint8_t)(reg_pc >> 8));
+  system_write_memory(0x0100 + reg_sp--, (uint8_t)(reg_pc & 0xff));
+  system_write_memory(0x0100 + reg_sp--, (reg_psw & ~PSW_B) | 0x20);
+  reg_psw |= 0x04;
+  reg_psw &= ~interrupt_clear_flags;
+  reg_pc = system_read_memory(0xfffa);
+  reg_pc |= (uint16_t)system_read_memory(0xfffb) << 8;
+  flag_nmi = false;
+}
+
+/* Maskable Interrupt */
+void cpu_6502_assert_irq() {
+  flag_irq = true;
+  reg_psw &= ~PSW_B;
+}
+
+void irq() {
+  system_write_memory(0x0100 + reg_sp--, (uint8_t)(reg_pc >> 8));
+  system_write_memory(0x0100 + reg_sp--, (uint8_t)(reg_pc & 0xff));
+  system_write_memory(0x0100 + reg_sp--, (reg_psw & ~PSW_B) | 0x20);
+  reg_psw |= 0x04;
+  reg_psw &= ~interrupt_clear_flags;
+  reg_pc = system_read_memory(0xfffe);
+  reg_pc |= (uint16_t)system_read_memory(0xffff) << 8;
+  flag_irq = false;
+}
+
+/*
+** Cycle-exact core
+**
+** Executes the same instruction table, but performs every bus access on the
+** cycle it happens on the real part, including the dummy reads and writes,
+** and clocks the VIAs, TANDOS and the delayed NMI once per cycle. It is
+** slower than the table-driven core above, so it is only used on request.
+*/
+typedef enum {
+  CYCLE_ACCESS_IMPLIED,
+  CYCLE_ACCESS_READ,
+  CYCLE_ACCESS_WRITE,
+  CYCLE_ACCESS_MODIFY,
+  CYCLE_ACCESS_SPECIAL
+} cycle_access_t;
+
+typedef enum {
+  CYCLE_MODE_IMPLIED,
+  CYCLE_MODE_IMMEDIATE,
+  CYCLE_MODE_ABSOLUTE,
+  CYCLE_MODE_RELATIVE,
+  CYCLE_MODE_INDIRECT,
+  CYCLE_MODE_INDIRECT_PAGE_WRAP,
+  CYCLE_MODE_ABSOLUTE_X,
+  CYCLE_MODE_ABSOLUTE_Y,
+  CYCLE_MODE_ZERO_PAGE,
+  CYCLE_MODE_ZERO_PAGE_X,
+  CYCLE_MODE_ZERO_PAGE_Y,
+  CYCLE_MODE_INDIRECT_X,
+  CYCLE_MODE_INDIRECT_Y,
+  CYCLE_MODE_INDIRECT_ABSOLUTE_X,
+  CYCLE_MODE_INDIRECT_ZERO_PAGE
+} cycle_mode_t;
+
+typedef struct
+{
+    void (*instruction)();
+    cycle_access_t access;
+    void (*operation)();
+} cycle_operation_t;
+
+typedef struct
+{
+    void (*address_mode)();
+    cycle_mode_t mode;
+} cycle_address_mode_t;
+
+typedef struct
+{
+    cycle_access_t access;
+    cycle_mode_t mode;
+    void (*operation)();
+} cycle_decode_t;
+
+static bool cycle_exact = false;
+static bool cycle_cmos = true;
+static int cycle_budget = 0;
+static cycle_decode_t cycle_decode[256];
+
+static void cycle_tick() {
+  cycle_budget--;
+  cpu_cycles++;
+
+  if (via_6522_update(1)) {
+    flag_irq = true;
+  }
+
+  tandos_update(1);
+
+  if (delayed_nmi_counter > 0) {
+    delayed_nmi_counter--;
+
+    if (delayed_nmi_counter == 0) {
+      flag_nmi = true;
+    }
+  }
+}
+
+static uint8_t cycle_read(uint16_t address) {
+  uint8_t value = system_read_memory(address);
+  cycle_tick();
+  return value;
+}
+
+static void cycle_write(uint16_t address, uint8_t value) {
+  system_write_memory(address, value);
+  cycle_tick();
+}
+
+static void cycle_push(uint8_t value) {
+  cycle_write(0x0100 + reg_sp--, value);
+}
+
+static uint8_t cycle_pull() {
+  return cycle_read(0x0100 + ++reg_sp);
+}
+
+/*
+** Add an index. The NMOS part reads the un-carried address during the fix-up
+** cycle, the 65C02 re-reads the last operand byte instead.
+*/
+static uint16_t cycle_indexed(uint16_t base, uint8_t index, bool always_fix_up) {
+  uint16_t address = base + index;
+
+  if (always_fix_up || ((address ^ base) & 0xff00)) {
+    cycle_read(cycle_cmos ? (uint16_t)(reg_pc - 1) : ((base & 0xff00) | (address & 0x00ff)));
+  }
+
+  return address;
+}
+
+/* Writes and read-modify-writes always take the fix-up cycle */
+static uint16_t cycle_effective_address(cycle_mode_t mode, bool always_fix_up) {
+  uint8_t pointer;
+  uint16_t base;
+
+  switch (mode) {
+    case CYCLE_MODE_ZERO_PAGE:
+      return cycle_read(reg_pc++);
+
+    case CYCLE_MODE_ZERO_PAGE_X:
+      pointer = cycle_read(reg_pc++);
+      cycle_read(pointer);
+      return (uint8_t)(pointer + reg_x);
+
+    case CYCLE_MODE_ZERO_PAGE_Y:
+      pointer = cycle_read(reg_pc++);
+      cycle_read(pointer);
+      return (uint8_t)(pointer + reg_y);
+
+    case CYCLE_MODE_ABSOLUTE:
+      base = cycle_read(reg_pc++);
+      return base | (cycle_read(reg_pc++) << 8);
+
+    case CYCLE_MODE_ABSOLUTE_X:
+      base = cycle_read(reg_pc++);
+      base |= cycle_read(reg_pc++) << 8;
+      return cycle_indexed(base, reg_x, always_fix_up);
+
+    case CYCLE_MODE_ABSOLUTE_Y:
+      base = cycle_read(reg_pc++);
+      base |= cycle_read(reg_pc++) << 8;
+      return cycle_indexed(base, reg_y, always_fix_up);
+
+    case CYCLE_MODE_INDIRECT_X:
+      pointer = cycle_read(reg_pc++);
+      cycle_read(pointer);
+      pointer += reg_x;
+      base = cycle_read(pointer);
+      return base | (cycle_read((uint8_t)(pointer + 1)) << 8);
+
+    case CYCLE_MODE_INDIRECT_Y:
+      pointer = cycle_read(reg_pc++);
+      base = cycle_read(pointer);
+      base |= cycle_read((uint8_t)(pointer + 1)) << 8;
+      return cycle_indexed(base, reg_y, always_fix_up);
+
+    case CYCLE_MODE_INDIRECT_ZERO_PAGE:
+      pointer = cycle_read(reg_pc++);
+      base = cycle_read(pointer);
+      return base | (cycle_read((uint8_t)(pointer + 1)) << 8);
+
+    default: /* Immediate */
+      return reg_pc++;
+  }
+}
+
+static void cycle_branch(bool taken) {
+  uint8_t offset = cycle_read(reg_pc++);
+  uint16_t target;
+
+  if (!taken) {
+    return;
+  }
+
+  target = reg_pc + offset - ((offset & 0x80) ? 0x100 : 0);
+  cycle_read(reg_pc);
+
+  if ((target ^ reg_pc) & 0xff00) {
+    cycle_read((reg_pc & 0xff00) | (target & 0x00ff));
+  }
+
+  reg_pc = target;
+}
+
+static void cycle_interrupt(uint16_t vector) {
+  cycle_read(reg_pc);
+  cycle_read(reg_pc);
+  cycle_push((uint8_t)(reg_pc >> 8));
+  cycle_push((uint8_t)(reg_pc & 0xff));
+  cycle_push((reg_psw & ~PSW_B) | 0x20);
+  reg_psw |= PSW_I;
+  reg_psw &= ~interrupt_clear_flags;
+  reg_pc = cycle_read(vector);
+  reg_pc |= (uint16_t)cycle_read(vector + 1) << 8;
+}
+
+static void cycle_compare(uint8_t value) {
+  if (value >= byte_value) {
+    reg_psw |= PSW_C;
+  } else {
+    reg_psw &= ~PSW_C;
+  }
+
+  set_nz_flags(value - byte_value);
+}
+
+/* Read operations, applied to the operand in byte_value */
+static void cycle_adc() {
+  adc_value();
+
+  if (cycle_cmos && (reg_psw & PSW_D)) {
+    cycle_read(reg_pc - 1);
+  }
+}
+
+static void cycle_and() {
+  reg_a &= byte_value;
+  set_nz_flags(reg_a);
+}
+
+static void cycle_bit() {
+  if (byte_value & reg_a) {
+    reg_psw &= ~PSW_Z;
+  } else {
+    reg_psw |= PSW_Z;
+  }
+
+  if (cycle_decode[opcode].mode != CYCLE_MODE_IMMEDIATE) {
+    reg_psw = (reg_psw & 0x3f) | (byte_value & 0xc0);
+  }
+}
+
+static void cycle_cmp() {
+  cycle_compare(reg_a);
+}
+
+static void cycle_cpx() {
+  cycle_compare(reg_x);
+}
+
+static void cycle_cpy() {
+  cycle_compare(reg_y);
+}
+
+static void cycle_eor() {
+  reg_a ^= byte_value;
+  set_nz_flags(reg_a);
+}
+
+static void cycle_lda() {
+  reg_a = byte_value;
+  set_nz_flags(reg_a);
+}
+
+static void cycle_ldx() {
+  reg_x = byte_value;
+  set_nz_flags(reg_x);
+}
+
+static void cycle_ldy() {
+  reg_y = byte_value;
+  set_nz_flags(reg_y);
+}
+
+static void cycle_ora() {
+  reg_a |= byte_value;
+  set_nz_flags(reg_a);
+}
+
+static void cycle_sbc() {
+  sbc_value();
+
+  if (cycle_cmos && (reg_psw & PSW_D)) {
+    cycle_read(reg_pc - 1);
+  }
+}
+
+/* Write operations, leaving the value to store in byte_value */
+static void cycle_sta() {
+  byte_value = reg_a;
+}
+
+static void cycle_stx() {
+  byte_value = reg_x;
+}
+
+static void cycle_sty() {
+  byte_value = reg_y;
+}
+
+static void cycle_stz() {
+  byte_value = 0;
+}
+
+/* Read-modify-write operations, updating byte_value in place */
+static void cycle_asl() {
+  reg_psw = (reg_psw & ~PSW_C) | ((byte_value >> 7) & 0x01);
+  byte_value <<= 1;
+  set_nz_flags(byte_value);
+}
+
+static void cycle_lsr() {
+  reg_psw = (reg_psw & ~PSW_C) | (byte_value & 0x01);
+  byte_value >>= 1;
+  set_nz_flags(byte_value);
+}
+
+static void cycle_rol() {
+  save_carry = reg_psw & PSW_C;
+  reg_psw = (reg_psw & ~PSW_C) | ((byte_value >> 7) & 0x01);
+  byte_value = (byte_value << 1) | save_carry;
+  set_nz_flags(byte_value);
+}
+
+static void cycle_ror() {
+  save_carry = reg_psw & PSW_C;
+  reg_psw = (reg_psw & ~PSW_C) | (byte_value & 0x01);
+  byte_value = (byte_value >> 1) | (save_carry << 7);
+  set_nz_flags(byte_value);
+}
+
+static void cycle_inc() {
+  byte_value++;
+  set_nz_flags(byte_value);
+}
+
+static void cycle_dec() {
+  byte_value--;
+  set_nz_flags(byte_value);
+}
+
+static void cycle_tsb() {
+  if (byte_value & reg_a) {
+    reg_psw &= ~PSW_Z;
+  } else {
+    reg_psw |= PSW_Z;
+  }
+
+  byte_value |= reg_a;
+}
+
+static void cycle_trb() {
+  if (byte_value & reg_a) {
+    reg_psw &= ~PSW_Z;
+  } else {
+    reg_psw |= PSW_Z;
+  }
+
+  byte_value &= ~reg_a;
+}
+
+/* Instructions that run their own bus sequence after the opcode fetch */
+static void cycle_bcc() {
+  cycle_branch((reg_psw & PSW_C) == 0);
+}
+
+static void cycle_bcs() {
+  cycle_branch((reg_psw & PSW_C) != 0);
+}
+
+static void cycle_beq() {
+  cycle_branch((reg_psw & PSW_Z) != 0);
+}
+
+static void cycle_bmi() {
+  cycle_branch((reg_psw & PSW_N) != 0);
+}
+
+static void cycle_bne() {
+  cycle_branch((reg_psw & PSW_Z) == 0);
+}
+
+static void cycle_bpl() {
+  cycle_branch((reg_psw & PSW_N) == 0);
+}
+
+static void cycle_bvc() {
+  cycle_branch((reg_psw & PSW_V) == 0);
+}
+
+static void cycle_bvs() {
+  cycle_branch((reg_psw & PSW_V) != 0);
+}
+
+static void cycle_bra() {
+  cycle_branch(true);
+}
+
+static void cycle_brk() {
+  cycle_read(reg_pc++);
+  cycle_push((uint8_t)(reg_pc >> 8));
+  cycle_push((uint8_t)(reg_pc & 0xff));
+  cycle_push(reg_psw | PSW_B | 0x20);
+  reg_psw |= PSW_I;
+  reg_psw &= ~interrupt_clear_flags;
+  reg_pc = cycle_read(0xfffe);
+  reg_pc |= (uint16_t)cycle_read(0xffff) << 8;
+}
+
+static void cycle_jmp() {
+  word_value = cycle_read(reg_pc++);
+  word_value |= (uint16_t)cycle_read(reg_pc) << 8;
+
+  switch (cycle_decode[opcode].mode) {
+    case CYCLE_MODE_INDIRECT:
+      cycle_read(reg_pc);
+      reg_pc = cycle_read(word_value);
+      reg_pc |= (uint16_t)cycle_read(word_value + 1) << 8;
+      break;
+
+    case CYCLE_MODE_INDIRECT_PAGE_WRAP:
+      reg_pc = cycle_read(word_value);
+      reg_pc |= (uint16_t)cycle_read((word_value & 0xff00) | ((word_value + 1) & 0x00ff)) << 8;
+      break;
+
+    case CYCLE_MODE_INDIRECT_ABSOLUTE_X:
+      cycle_read(reg_pc);
+      word_value += reg_x;
+      reg_pc = cycle_read(word_value);
+      reg_pc |= (uint16_t)cycle_read(word_value + 1) << 8;
+      break;
+
+    default:
+      reg_pc = word_value;
+      break;
+  }
+}
+
+static void cycle_jam() {
+  reg_pc--;
+  cycle_read(0xffff);
+}
+
+/* 65C02 opcode $5C: a three byte NOP that takes eight cycles */
+static void cycle_nop_long() {
+  word_value = cycle_read(reg_pc++);
+  cycle_read(reg_pc++);
+
+  for (int n = 0; n < 5; n++) {
+    cycle_read(0xff00 | word_value);
+  }
+}
+
+static void cycle_jsr() {
+  byte_value = cycle_read(reg_pc++);
+  cycle_read(0x0100 + reg_sp);
+  cycle_push((uint8_t)(reg_pc >> 8));
+  cycle_push((uint8_t)(reg_pc & 0xff));
+  reg_pc = byte_value | ((uint16_t)cycle_read(reg_pc) << 8);
+}
+
+static void cycle_rti() {
+  cycle_read(reg_pc);
+  cycle_read(0x0100 + reg_sp);
+  reg_psw = cycle_pull() | 0x20;
+  reg_pc = cycle_pull();
+  reg_pc |= (uint16_t)cycle_pull() << 8;
+}
+
+static void cycle_rts() {
+  cycle_read(reg_pc);
+  cycle_read(0x0100 + reg_sp);
+  reg_pc = cycle_pull();
+  reg_pc |= (uint16_t)cycle_pull() << 8;
+  cycle_read(reg_pc++);
+}
+
+static void cycle_pha() {
+  cycle_read(reg_pc);
+  cycle_push(reg_a);
+}
+
+static void cycle_php() {
+  cycle_read(reg_pc);
+  cycle_push(reg_psw | PSW_B | 0x20);
+}
+
+static void cycle_phx() {
+  cycle_read(reg_pc);
+  cycle_push(reg_x);
+}
+
+static void cycle_phy() {
+  cycle_read(reg_pc);
+  cycle_push(reg_y);
+}
+
+static void cycle_pla() {
+  cycle_read(reg_pc);
+  cycle_read(0x0100 + reg_sp);
+  reg_a = cycle_pull();
+  set_nz_flags(reg_a);
+}
+
+static void cycle_plp() {
+  cycle_read(reg_pc);
+  cycle_read(0x0100 + reg_sp);
+  reg_psw = cycle_pull() | 0x20;
+}
+
+static void cycle_plx() {
+  cycle_read(reg_pc);
+  cycle_read(0x0100 + reg_sp);
+  reg_x = cycle_pull();
+  set_nz_flags(reg_x);
+}
+
+static void cycle_ply() {
+  cycle_read(reg_pc);
+  cycle_read(0x0100 + reg_sp);
+  reg_y = cycle_pull();
+  set_nz_flags(reg_y);
+}
+
+/* Map the table-driven instructions on to their bus behaviour */
+static const cycle_operation_t cycle_operations[] =
+  {
+    {adc, CYCLE_ACCESS_READ, cycle_adc},
+    {and, CYCLE_ACCESS_READ, cycle_and},
+    {bit, CYCLE_ACCESS_READ, cycle_bit},
+    {cmp, CYCLE_ACCESS_READ, cycle_cmp},
+    {cpx, CYCLE_ACCESS_READ, cycle_cpx},
+    {cpy, CYCLE_ACCESS_READ, cycle_cpy},
+    {eor, CYCLE_ACCESS_READ, cycle_eor},
+    {lda, CYCLE_ACCESS_READ, cycle_lda},
+    {ldx, CYCLE_ACCESS_READ, cycle_ldx},
+    {ldy, CYCLE_ACCESS_READ, cycle_ldy},
+    {ora, CYCLE_ACCESS_READ, cycle_ora},
+    {sbc, CYCLE_ACCESS_READ, cycle_sbc},
+    {lax, CYCLE_ACCESS_READ, lax_value},
+    {las, CYCLE_ACCESS_READ, las_value},
+    {anc, CYCLE_ACCESS_READ, anc_value},
+    {alr, CYCLE_ACCESS_READ, alr_value},
+    {arr, CYCLE_ACCESS_READ, arr_value},
+    {sbx, CYCLE_ACCESS_READ, sbx_value},
+    {ane, CYCLE_ACCESS_READ, ane_value},
+    {lxa, CYCLE_ACCESS_READ, lxa_value},
+    {nop_read, CYCLE_ACCESS_READ, nop_value},
+    {sta, CYCLE_ACCESS_WRITE, cycle_sta},
+    {stx, CYCLE_ACCESS_WRITE, cycle_stx},
+    {sty, CYCLE_ACCESS_WRITE, cycle_sty},
+    {stz, CYCLE_ACCESS_WRITE, cycle_stz},
+    {sax, CYCLE_ACCESS_WRITE, sax_value},
+    {sha, CYCLE_ACCESS_WRITE, sha_value},
+    {shx, CYCLE_ACCESS_WRITE, shx_value},
+    {shy, CYCLE_ACCESS_WRITE, shy_value},
+    {tas, CYCLE_ACCESS_WRITE, tas_value},
+    {asl, CYCLE_ACCESS_MODIFY, cycle_asl},
+    {lsr, CYCLE_ACCESS_MODIFY, cycle_lsr},
+    {rol, CYCLE_ACCESS_MODIFY, cycle_rol},
+    {ror, CYCLE_ACCESS_MODIFY, cycle_ror},
+    {inc, CYCLE_ACCESS_MODIFY, cycle_inc},
+    {dec, CYCLE_ACCESS_MODIFY, cycle_dec},
+    {tsb, CYCLE_ACCESS_MODIFY, cycle_tsb},
+    {trb, CYCLE_ACCESS_MODIFY, cycle_trb},
+    {slo, CYCLE_ACCESS_MODIFY, slo_value},
+    {rla, CYCLE_ACCESS_MODIFY, rla_value},
+    {sre, CYCLE_ACCESS_MODIFY, sre_value},
+    {rra, CYCLE_ACCESS_MODIFY, rra_value},
+    {dcp, CYCLE_ACCESS_MODIFY, dcp_value},
+    {isc, CYCLE_ACCESS_MODIFY, isc_value},
+    {asla, CYCLE_ACCESS_IMPLIED, asla},
+    {lsra, CYCLE_ACCESS_IMPLIED, lsra},
+    {rola, CYCLE_ACCESS_IMPLIED, rola},
+    {rora, CYCLE_ACCESS_IMPLIED, rora},
+    {clc, CYCLE_ACCESS_IMPLIED, clc},
+    {cld, CYCLE_ACCESS_IMPLIED, cld},
+    {cli, CYCLE_ACCESS_IMPLIED, cli},
+    {clv, CYCLE_ACCESS_IMPLIED, clv},
+    {sec, CYCLE_ACCESS_IMPLIED, sec},
+    {sed, CYCLE_ACCESS_IMPLIED, sed},
+    {sei, CYCLE_ACCESS_IMPLIED, sei},
+    {dex, CYCLE_ACCESS_IMPLIED, dex},
+    {dey, CYCLE_ACCESS_IMPLIED, dey},
+    {inx, CYCLE_ACCESS_IMPLIED, inx},
+    {iny, CYCLE_ACCESS_IMPLIED, iny},
+    {dea, CYCLE_ACCESS_IMPLIED, dea},
+    {ina, CYCLE_ACCESS_IMPLIED, ina},
+    {tax, CYCLE_ACCESS_IMPLIED, tax},
+    {tay, CYCLE_ACCESS_IMPLIED, tay},
+    {tsx, CYCLE_ACCESS_IMPLIED, tsx},
+    {txa, CYCLE_ACCESS_IMPLIED, txa},
+    {txs, CYCLE_ACCESS_IMPLIED, txs},
+    {tya, CYCLE_ACCESS_IMPLIED, tya},
+    {nop, CYCLE_ACCESS_IMPLIED, nop},
+    {bcc, CYCLE_ACCESS_SPECIAL, cycle_bcc},
+    {bcs, CYCLE_ACCESS_SPECIAL, cycle_bcs},
+    {beq, CYCLE_ACCESS_SPECIAL, cycle_beq},
+    {bmi, CYCLE_ACCESS_SPECIAL, cycle_bmi},
+    {bne, CYCLE_ACCESS_SPECIAL, cycle_bne},
+    {bpl, CYCLE_ACCESS_SPECIAL, cycle_bpl},
+    {bvc, CYCLE_ACCESS_SPECIAL, cycle_bvc},
+    {bvs, CYCLE_ACCESS_SPECIAL, cycle_bvs},
+    {bra, CYCLE_ACCESS_SPECIAL, cycle_bra},
+    {brk, CYCLE_ACCESS_SPECIAL, cycle_brk},
+    {jmp, CYCLE_ACCESS_SPECIAL, cycle_jmp},
+    {jsr, CYCLE_ACCESS_SPECIAL, cycle_jsr},
+    {rti, CYCLE_ACCESS_SPECIAL, cycle_rti},
+    {rts, CYCLE_ACCESS_SPECIAL, cycle_rts},
+    {pha, CYCLE_ACCESS_SPECIAL, cycle_pha},
+    {php, CYCLE_ACCESS_SPECIAL, cycle_php},
+    {phx, CYCLE_ACCESS_SPECIAL, cycle_phx},
+    {phy, CYCLE_ACCESS_SPECIAL, cycle_phy},
+    {pla, CYCLE_ACCESS_SPECIAL, cycle_pla},
+    {plp, CYCLE_ACCESS_SPECIAL, cycle_plp},
+    {plx, CYCLE_ACCESS_SPECIAL, cycle_plx},
+    {ply, CYCLE_ACCESS_SPECIAL, cycle_ply},
+    {jam, CYCLE_ACCESS_SPECIAL, cycle_jam},
+    {NULL, CYCLE_ACCESS_SPECIAL, NULL}};
+
+static const cycle_address_mode_t cycle_address_modes[] =
+  {
+    {implied, CYCLE_MODE_IMPLIED},
+    {immediate, CYCLE_MODE_IMMEDIATE},
+    {absolute, CYCLE_MODE_ABSOLUTE},
+    {relative, CYCLE_MODE_RELATIVE},
+    {indirect, CYCLE_MODE_INDIRECT},
+    {indirect_page_wrap, CYCLE_MODE_INDIRECT_PAGE_WRAP},
+    {absolute_x, CYCLE_MODE_ABSOLUTE_X},
+    {absolute_y, CYCLE_MODE_ABSOLUTE_Y},
+    {zero_page, CYCLE_MODE_ZERO_PAGE},
+    {zero_page_x, CYCLE_MODE_ZERO_PAGE_X},
+    {zero_page_y, CYCLE_MODE_ZERO_PAGE_Y},
+    {indirect_x, CYCLE_MODE_INDIRECT_X},
+    {indirect_y, CYCLE_MODE_INDIRECT_Y},
+    {indirect_absolute_x, CYCLE_MODE_INDIRECT_ABSOLUTE_X},
+    {indirect_zero_page, CYCLE_MODE_INDIRECT_ZERO_PAGE},
+    {NULL, CYCLE_MODE_IMPLIED}};
+
+/* Derive the per-opcode bus behaviour from the instruction table */
+static void cycle_build_decode() {
+  for (int n = 0; n < 256; n++) {
+    cycle_decode[n].access = CYCLE_ACCESS_SPECIAL;
+    cycle_decode[n].mode = CYCLE_MODE_IMPLIED;
+    cycle_decode[n].operation = cycle_brk;
+
+    for (int i = 0; cycle_operations[i].instruction != NULL; i++) {
+      if (cycle_operations[i].instruction == instruction_table[n].instruction) {
+        cycle_decode[n].access = cycle_operations[i].access;
+        cycle_decode[n].operation = cycle_operations[i].operation;
+        break;
+      }
+    }
+
+    for (int i = 0; cycle_address_modes[i].address_mode != NULL; i++) {
+      if (cycle_address_modes[i].address_mode == instruction_table[n].address_mode) {
+        cycle_decode[n].mode = cycle_address_modes[i].mode;
+        break;
+      }
+    }
+
+    /* The 65C02's single-byte NOPs take one cycle and $5C takes eight */
+    if ((instruction_table[n].instruction == nop) && (instruction_table[n].ticks == 1)) {
+      cycle_decode[n].access = CYCLE_ACCESS_SPECIAL;
+    } else if ((instruction_table[n].instruction == nop_read) && (instruction_table[n].ticks == 8)) {
+      cycle_decode[n].access = CYCLE_ACCESS_SPECIAL;
+      cycle_decode[n].operation = cycle_nop_long;
+    }
+  }
+}
+
+static void cycle_execute(int timer_ticks) {
+  const cycle_decode_t* decode;
+  uint16_t address;
+
+  cycle_budget += timer_ticks;
+
+  while (cycle_budget > 0) {
+    if (debugger_enabled && debugger_check(reg_pc)) {
+      // Time stands still while stopped; don't bank the unused budget
+      cycle_budget = 0;
+      break;
+    }
+
+    opcode = cycle_read(reg_pc++);
+    decode = &cycle_decode[opcode];
+
+    if (cpu_trace_enabled) {
+      cpu_trace_record(cpu_cycles - 1, reg_pc - 1, opcode, reg_a, reg_x, reg_y, reg_sp, reg_psw);
+    }
+
+    switch (decode->access) {
+      case CYCLE_ACCESS_IMPLIED:
+        cycle_read(reg_pc);
+        decode->operation();
+        break;
+
+      case CYCLE_ACCESS_READ:
+        address = cycle_effective_address(decode->mode, false);
+        byte_value = cycle_read(address);
+        decode->operation();
+        break;
+
+      case CYCLE_ACCESS_WRITE:
+        address = cycle_effective_address(decode->mode, true);
+        save_pc = address;
+        decode->operation();
+        cycle_write(address, byte_value);
+        break;
+
+      case CYCLE_ACCESS_MODIFY:
+        /* The 65C02 skips the fix-up cycle for shifts and re-reads instead of writing back */
+        address = cycle_effective_address(decode->mode, !cycle_cmos || (decode->operation == cycle_inc) || (decode->operation == cycle_dec));
+        byte_value = cycle_read(address);
+
+        if (cycle_cmos) {
+          cycle_read(address);
+        } else {
+          cycle_write(address, byte_value);
+        }
+
+        decode->operation();
+        cycle_write(address, byte_value);
+        break;
+
+      case CYCLE_ACCESS_SPECIAL:
+        decode->operation();
+        break;
+    }
+
+    if (flag_nmi) {
+      flag_nmi = false;
+      cycle_interrupt(0xfffa);
+    } else if ((flag_irq) && ((reg_psw & PSW_I) == 0)) {
+      flag_irq = false;
+      cycle_interrupt(0xfffe);
+    }
+  }
+}
+
+void cpu_6502_set_cycle_exact(bool enabled) {
+  cycle_exact = enabled;
+  cycle_budget = 0;
+}
+
+bool cpu_6502_get_cycle_exact() {
+  return cycle_exact;
+}
+
+void cpu_6502_set_variant(cpu_6502_variant_t variant) {
+  cpu_variant = variant;
+
+  if (variant == CPU_6502_VARIANT_NMOS) {
+    instruction_table = nmos_instruction_table;
+    interrupt_clear_flags = 0;
+    decimal_extra_ticks = 0;
+    cycle_cmos = false;
+  } else {
+    instruction_table = cmos_instruction_table;
+    interrupt_clear_flags = PSW_D;
+    decimal_extra_ticks = 1;
+    cycle_cmos = true;
+  }
+
+  cycle_build_decode();
+}
+
+cpu_6502_variant_t cpu_6502_get_variant() {
+  return cpu_variant;
+}
+
+/* Execute a number of instructions */
+void cpu_6502_execute(int timer_ticks) {
+  uint32_t cpu_ticks;
+
+  rtc_update();
+
+  if (cycle_exact) {
+    cycle_execute(timer_ticks);
+    return;
+  }
+
+  while (timer_ticks > 0) {
+    if (debugger_enabled && debugger_check(reg_pc)) {
+      break;
+    }
+
+    opcode = system_read_memory(reg_pc++);
+
+    if (cpu_trace_enabled) {
+      cpu_trace_record(cpu_cycles, reg_pc - 1, opcode, reg_a, reg_x, reg_y, reg_sp, reg_psw);
+    }
+
+    instruction_ticks = instruction_table[opcode].ticks;
+    instruction_table[opcode].instruction();
+    cpu_ticks = instruction_ticks;
+    timer_ticks -= cpu_ticks;
+    cpu_cycles += cpu_ticks;
+
+    if (via_6522_update(instruction_ticks)) {
+      flag_irq = true;
+    }
+    tandos_update(instruction_ticks);
+
+    if (delayed_nmi_counter > 0) {
+      delayed_nmi_counter -= instruction_length;
+
+      if (delayed_nmi_counter <= 0) {
+        flag_nmi = true;
+      }
+    }
+
+    if ((flag_irq) && ((reg_psw & PSW_I) == 0)) {
+      irq();
+    }
+
+    if (flag_nmi) {
+      nmi();
+    }
+  }
+}
+
+void cpu_6502_delayed_nmi_callback(uint16_t address, uint8_t value) {
+  (void)value;
+  if ((address & 0x03) == 1) {
+    delayed_nmi_counter = 8;
+  }
+}
+
+void cpu_6502_set_registers(uint16_t pc, uint8_t a, uint8_t ix, uint8_t iy, uint8_t sp, uint8_t psw) {
+  reg_pc = pc;
+  reg_a = a;
+  reg_x = ix;
+  reg_y = iy;
+  reg_sp = sp;
+  reg_psw = psw;
+}
+
+void cpu_6502_continue(uint16_t pc, uint8_t a, uint8_t ix, uint8_t iy, uint8_t sp, uint8_t psw) {
+  cpu_6502_set_registers(pc, a, ix, iy, sp, psw);
+  flag_irq = false;
+  flag_nmi = false;
+}
+
+void cpu_6502_reset(uint8_t bank, uint16_t address) {
+  (void)bank;
   (void)address;
   reg_a = 0;
   reg_x = 0;
@@ -1504,8 +2836,9 @@ int cpu_6502_initialise(uint8_t bank, uint16_t address, uint16_t param, char* id
   (void)param;
   (void)identifier;
   system_register_memory_mapped_device(0xBFF0, 0xBFFF, NULL, cpu_6502_delayed_nmi_callback, false);
+  cycle_build_decode();
   cpu_6502_reset(bank, address);
   return RV_OK;
 }
-
-
+
+
@@ -2,6 +2,7 @@
 #define __CPU_6502_H__
 
 #include "system.h"
+#include <stdbool.h>
 #include <stdint.h>
 
 #define PSW_C (1 << 0)
@@ -12,11 +13,17 @@
 #define PSW_V (1 << 6)
 #define PSW_N (1 << 7)
 
+typedef enum {
+  CPU_6502_VARIANT_NMOS,
+  CPU_6502_VARIANT_65C02
+} cpu_6502_variant_t;
+
 extern void cpu_6502_reset(uint8_t bank, uint16_t address);
 extern void cpu_6502_execute(int timer_ticks);
 extern void cpu_6502_assert_nmi();
 extern void cpu_6502_assert_irq();
 extern void cpu_6502_set_delayed_nmi();
+extern void cpu_6502_set_registers(uint16_t pc, uint8_t a, uint8_t ix, uint8_t iy, uint8_t sp, uint8_t psw);
 extern void cpu_6502_continue(uint16_t pc, uint8_t a, uint8_t ix, uint8_t iy, uint8_t sp, uint8_t psw);
 extern int cpu_6502_initialise(uint8_t bank, uint16_t address, uint16_t param, char* identifier);
 extern uint16_t cpu_6502_get_pc();
@@ -25,5 +32,10 @@ extern uint8_t cpu_6502_get_x();
 extern uint8_t cpu_6502_get_y();
 extern uint8_t cpu_6502_get_sp();
 extern uint8_t cpu_6502_get_psw();
+extern uint64_t cpu_6502_get_cycles();
+extern void cpu_6502_set_cycle_exact(bool enabled);
+extern bool cpu_6502_get_cycle_exact();
+extern void cpu_6502_set_variant(cpu_6502_variant_t variant);
+extern cpu_6502_variant_t cpu_6502_get_variant();
 
 #endif // __CPU_6502_H__
@@ -0,0 +1,196 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cpu_trace.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cpu_6502.h"
+#include "function_return_codes.h"
+
+#define CPU_TRACE_VERSION 1
+
+/*
+** Trace file layout, little-endian:
+**   8 bytes   "M65TRACE"
+**   uint16    version
+**   uint8     CPU variant, 0 = NMOS 6502, 1 = 65C02
+**   uint8     record size
+**   uint32    record count
+** followed by the records, oldest first.
+*/
+typedef struct
+{
+    uint64_t cycle;
+    uint16_t pc;
+    uint8_t opcode;
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t sp;
+    uint8_t psw;
+} cpu_trace_record_t;
+
+typedef struct
+{
+    char magic[8];
+    uint16_t version;
+    uint8_t variant;
+    uint8_t record_size;
+    uint32_t record_count;
+} cpu_trace_header_t;
+
+bool cpu_trace_enabled = false;
+
+static cpu_trace_record_t* records = NULL;
+static size_t record_capacity = 0;
+static size_t next_record = 0;
+// Total records written, published after each record so a reader never
+// sees a slot that is still being filled.
+static _Atomic uint64_t records_written = 0;
+static char crash_file_name[256];
+
+int cpu_trace_start(size_t instruction_count) {
+  cpu_trace_stop();
+
+  if (instruction_count == 0) {
+    instruction_count = CPU_TRACE_DEFAULT_INSTRUCTIONS;
+  }
+
+  if (instruction_count <= SIZE_MAX / sizeof(cpu_trace_record_t)) {
+    records = malloc(instruction_count * sizeof(cpu_trace_record_t));
+  }
+
+  if (!records) {
+    printf("Unable to allocate a trace buffer for %zu instructions\r\n", instruction_count);
+    return RV_MEMORY_ALLOCATION_FAILURE;
+  }
+
+  record_capacity = instruction_count;
+  next_record = 0;
+  atomic_store_explicit(&records_written, 0, memory_order_relaxed);
+  cpu_trace_enabled = true;
+  return RV_OK;
+}
+
+void cpu_trace_stop(void) {
+  cpu_trace_enabled = false;
+  free(records);
+  records = NULL;
+  record_capacity = 0;
+  next_record = 0;
+  atomic_store_explicit(&records_written, 0, memory_order_relaxed);
+}
+
+void cpu_trace_record(uint64_t cycle, uint16_t pc, uint8_t opcode,
+                      uint8_t a, uint8_t x, uint8_t y, uint8_t sp,
+                      uint8_t psw) {
+  cpu_trace_record_t* record = &records[next_record];
+  record->cycle = cycle;
+  record->pc = pc;
+  record->opcode = opcode;
+  record->a = a;
+  record->x = x;
+  record->y = y;
+  record->sp = sp;
+  record->psw = psw;
+
+  if (++next_record == record_capacity) {
+    next_record = 0;
+  }
+
+  atomic_fetch_add_explicit(&records_written, 1, memory_order_release);
+}
+
+static bool write_all(int fd, const void* data, size_t size) {
+  const uint8_t* ptr = data;
+
+  while (size > 0) {
+    ssize_t written = write(fd, ptr, size);
+
+    if (written <= 0) {
+      return false;
+    }
+
+    ptr += written;
+    size -= (size_t)written;
+  }
+
+  return true;
+}
+
+// Only uses async-signal-safe calls so it can run from the crash handler.
+static bool write_trace(int fd) {
+  uint64_t written = atomic_load_explicit(&records_written, memory_order_acquire);
+  size_t count = (written < record_capacity) ? (size_t)written : record_capacity;
+  size_t first = (size_t)((written - count) % (record_capacity ? record_capacity : 1));
+  size_t first_run = (first + count > record_capacity) ? (record_capacity - first) : count;
+  cpu_trace_header_t header;
+
+  memcpy(header.magic, "M65TRACE", sizeof(header.magic));
+  header.version = CPU_TRACE_VERSION;
+  header.variant = (cpu_6502_get_variant() == CPU_6502_VARIANT_NMOS) ? 0 : 1;
+  header.record_size = sizeof(cpu_trace_record_t);
+  header.record_count = (uint32_t)count;
+
+  return write_all(fd, &header, sizeof(header)) &&
+         write_all(fd, records + first, first_run * sizeof(cpu_trace_record_t)) &&
+         write_all(fd, records, (count - first_run) * sizeof(cpu_trace_record_t));
+}
+
+int cpu_trace_dump(const char* file_name) {
+  if (!records) {
+    return RV_INVALID_FILE;
+  }
+
+  int fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0) {
+    printf("Error opening [%s]\r\n", file_name);
+    return RV_FILE_OPEN_ERROR;
+  }
+
+  bool written = write_trace(fd);
+  close(fd);
+
+  if (!written) {
+    printf("Error writing [%s]\r\n", file_name);
+    return RV_FILE_WRITE_ERROR;
+  }
+
+  printf("Instruction trace written to [%s]\r\n", file_name);
+  return RV_OK;
+}
+
+static void crash_handler(int signal_number) {
+  if (records) {
+    int fd = open(crash_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd >= 0) {
+      write_trace(fd);
+      close(fd);
+    }
+  }
+
+  signal(signal_number, SIG_DFL);
+  raise(signal_number);
+}
+
+void cpu_trace_dump_on_crash(const char* file_name) {
+  static const int crash_signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+  struct sigaction action;
+
+  snprintf(crash_file_name, sizeof(crash_file_name), "%s", file_name);
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = crash_handler;
+  sigemptyset(&action.sa_mask);
+
+  for (size_t n = 0; n < sizeof(crash_signals) / sizeof(crash_signals[0]); n++) {
+    sigaction(crash_signals[n], &action, NULL);
+  }
+}
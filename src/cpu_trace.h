@@ -0,0 +1,22 @@
+#ifndef __CPU_TRACE_H__
+#define __CPU_TRACE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CPU_TRACE_FILENAME              "microtan_trace.bin"
+#define CPU_TRACE_DEFAULT_INSTRUCTIONS  1000000
+
+// Checked by the CPU cores before every instruction; false unless tracing.
+extern bool cpu_trace_enabled;
+
+extern int cpu_trace_start(size_t instruction_count);
+extern void cpu_trace_stop(void);
+extern void cpu_trace_record(uint64_t cycle, uint16_t pc, uint8_t opcode,
+                             uint8_t a, uint8_t x, uint8_t y, uint8_t sp,
+                             uint8_t psw);
+extern int cpu_trace_dump(const char* file_name);
+extern void cpu_trace_dump_on_crash(const char* file_name);
+
+#endif // __CPU_TRACE_H__
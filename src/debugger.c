@@ -0,0 +1,327 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "debugger.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cpu_6502.h"
+#include "function_return_codes.h"
+#include "system.h"
+
+#define MAX_BREAKPOINTS 32
+#define MAX_WATCHPOINTS 32
+
+typedef struct
+{
+    int address;
+    bool conditional;
+    debugger_condition_t condition;
+} breakpoint_t;
+
+typedef struct
+{
+    uint16_t start;
+    uint16_t end;
+    debugger_watch_type_t type;
+} watchpoint_t;
+
+bool debugger_enabled = false;
+
+static breakpoint_t breakpoints[MAX_BREAKPOINTS];
+static int breakpoint_count = 0;
+// Number of breakpoints at each address, so an unconditional miss is one lookup
+static uint8_t breakpoint_map[65536];
+static int any_address_count = 0;
+static watchpoint_t watchpoints[MAX_WATCHPOINTS];
+static int watchpoint_count = 0;
+
+static bool stopped = false;
+static bool stop_requested = false;
+static bool step_pending = false;
+static bool resuming = false;
+static debugger_stop_reason_t pending_reason = DEBUGGER_STOP_NONE;
+static debugger_stop_reason_t stop_reason = DEBUGGER_STOP_NONE;
+static uint16_t pending_address;
+static uint16_t stop_address;
+
+static void update_enabled(void) {
+  debugger_enabled = stopped || stop_requested || step_pending || resuming ||
+                     (pending_reason != DEBUGGER_STOP_NONE) ||
+                     (breakpoint_count > 0) || (watchpoint_count > 0);
+}
+
+static void update_watched_pages(void) {
+  bool watched[256] = {false};
+
+  for (int n = 0; n < watchpoint_count; n++) {
+    for (int page = watchpoints[n].start >> 8; page <= (watchpoints[n].end >> 8); page++) {
+      watched[page] = true;
+    }
+  }
+
+  for (int page = 0; page < 256; page++) {
+    system_set_page_watched((uint8_t)page, watched[page]);
+  }
+}
+
+static uint16_t register_value(debugger_register_t reg) {
+  switch (reg) {
+    case DEBUGGER_REGISTER_A:
+      return cpu_6502_get_a();
+
+    case DEBUGGER_REGISTER_X:
+      return cpu_6502_get_x();
+
+    case DEBUGGER_REGISTER_Y:
+      return cpu_6502_get_y();
+
+    case DEBUGGER_REGISTER_SP:
+      return cpu_6502_get_sp();
+
+    case DEBUGGER_REGISTER_PSW:
+      return cpu_6502_get_psw();
+
+    default:
+      return cpu_6502_get_pc();
+  }
+}
+
+static bool condition_met(const debugger_condition_t* condition) {
+  uint16_t value = register_value(condition->reg);
+
+  switch (condition->compare) {
+    case DEBUGGER_COMPARE_EQUAL:
+      return value == condition->value;
+
+    case DEBUGGER_COMPARE_NOT_EQUAL:
+      return value != condition->value;
+
+    case DEBUGGER_COMPARE_LESS:
+      return value < condition->value;
+
+    default:
+      return value > condition->value;
+  }
+}
+
+static bool breakpoint_hit(uint16_t pc) {
+  if ((breakpoint_map[pc] == 0) && (any_address_count == 0)) {
+    return false;
+  }
+
+  for (int n = 0; n < breakpoint_count; n++) {
+    if ((breakpoints[n].address == pc) || (breakpoints[n].address == DEBUGGER_ANY_ADDRESS)) {
+      if (!breakpoints[n].conditional || condition_met(&breakpoints[n].condition)) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+int debugger_add_breakpoint(int address, const debugger_condition_t* condition) {
+  if ((breakpoint_count == MAX_BREAKPOINTS) ||
+      ((address == DEBUGGER_ANY_ADDRESS) && !condition)) {
+    return RV_INVALID_PARAMETER;
+  }
+
+  breakpoint_t* breakpoint = &breakpoints[breakpoint_count++];
+  breakpoint->address = address;
+  breakpoint->conditional = (condition != NULL);
+
+  if (condition) {
+    breakpoint->condition = *condition;
+  }
+
+  if (address == DEBUGGER_ANY_ADDRESS) {
+    any_address_count++;
+  } else {
+    breakpoint_map[address & 0xffff]++;
+  }
+
+  update_enabled();
+  return RV_OK;
+}
+
+static bool breakpoint_matches(const breakpoint_t* breakpoint, int address,
+                               const debugger_condition_t* condition) {
+  if ((breakpoint->address != address) || (breakpoint->conditional != (condition != NULL))) {
+    return false;
+  }
+
+  return !condition ||
+         ((breakpoint->condition.reg == condition->reg) &&
+          (breakpoint->condition.compare == condition->compare) &&
+          (breakpoint->condition.value == condition->value));
+}
+
+// Removes one breakpoint with the same address and condition, leaving any
+// others at the address, such as one set on the command line, in place
+int debugger_remove_breakpoint(int address, const debugger_condition_t* condition) {
+  for (int n = 0; n < breakpoint_count; n++) {
+    if (breakpoint_matches(&breakpoints[n], address, condition)) {
+      if (address == DEBUGGER_ANY_ADDRESS) {
+        any_address_count--;
+      } else {
+        breakpoint_map[address & 0xffff]--;
+      }
+
+      memmove(&breakpoints[n], &breakpoints[n + 1],
+              (size_t)(breakpoint_count - n - 1) * sizeof(breakpoints[0]));
+      breakpoint_count--;
+      update_enabled();
+      return RV_OK;
+    }
+  }
+
+  return RV_INVALID_PARAMETER;
+}
+
+int debugger_add_watchpoint(uint16_t start, uint16_t end, debugger_watch_type_t type) {
+  if ((watchpoint_count == MAX_WATCHPOINTS) || (end < start)) {
+    return RV_INVALID_PARAMETER;
+  }
+
+  watchpoints[watchpoint_count].start = start;
+  watchpoints[watchpoint_count].end = end;
+  watchpoints[watchpoint_count].type = type;
+  watchpoint_count++;
+  update_watched_pages();
+  update_enabled();
+  return RV_OK;
+}
+
+// Removes one watchpoint with the same range and type
+int debugger_remove_watchpoint(uint16_t start, uint16_t end, debugger_watch_type_t type) {
+  for (int n = 0; n < watchpoint_count; n++) {
+    if ((watchpoints[n].start == start) && (watchpoints[n].end == end) &&
+        (watchpoints[n].type == type)) {
+      memmove(&watchpoints[n], &watchpoints[n + 1],
+              (size_t)(watchpoint_count - n - 1) * sizeof(watchpoints[0]));
+      watchpoint_count--;
+      update_watched_pages();
+      update_enabled();
+      return RV_OK;
+    }
+  }
+
+  return RV_INVALID_PARAMETER;
+}
+
+void debugger_clear_all(void) {
+  breakpoint_count = 0;
+  any_address_count = 0;
+  memset(breakpoint_map, 0, sizeof(breakpoint_map));
+  watchpoint_count = 0;
+  update_watched_pages();
+  update_enabled();
+}
+
+void debugger_stop(void) {
+  stop_requested = true;
+  update_enabled();
+}
+
+void debugger_continue(void) {
+  if (stopped) {
+    stopped = false;
+    resuming = true;
+  }
+
+  stop_requested = false;
+  update_enabled();
+}
+
+void debugger_step(void) {
+  debugger_continue();
+  step_pending = true;
+  update_enabled();
+}
+
+bool debugger_is_stopped(void) {
+  return stopped;
+}
+
+debugger_stop_reason_t debugger_get_stop_reason(uint16_t* address) {
+  if (address) {
+    *address = stop_address;
+  }
+
+  return stop_reason;
+}
+
+static void stop_at(uint16_t pc, debugger_stop_reason_t reason, uint16_t address) {
+  static const char* reason_names[] = {"", "Stopped", "Step", "Breakpoint", "Read watchpoint", "Write watchpoint"};
+
+  stopped = true;
+  stop_requested = false;
+  step_pending = false;
+  stop_reason = reason;
+  stop_address = address;
+  update_enabled();
+
+  printf("%s at $%04X: PC=%04X A=%02X X=%02X Y=%02X SP=%02X P=%02X\r\n",
+         reason_names[reason], address, pc, cpu_6502_get_a(), cpu_6502_get_x(),
+         cpu_6502_get_y(), cpu_6502_get_sp(), cpu_6502_get_psw());
+}
+
+// Called before each instruction while debugger_enabled is set. Returns true
+// if the CPU should stop before executing the instruction at pc.
+bool debugger_check(uint16_t pc) {
+  if (stopped) {
+    return true;
+  }
+
+  if (pending_reason != DEBUGGER_STOP_NONE) {
+    debugger_stop_reason_t reason = pending_reason;
+    pending_reason = DEBUGGER_STOP_NONE;
+    stop_at(pc, reason, pending_address);
+    return true;
+  }
+
+  if (resuming) {
+    // Execute the instruction we stopped on without hitting its breakpoint again
+    resuming = false;
+    update_enabled();
+    return false;
+  }
+
+  if (step_pending) {
+    stop_at(pc, DEBUGGER_STOP_STEP, pc);
+    return true;
+  }
+
+  if (stop_requested) {
+    stop_at(pc, DEBUGGER_STOP_REQUESTED, pc);
+    return true;
+  }
+
+  if (breakpoint_hit(pc)) {
+    stop_at(pc, DEBUGGER_STOP_BREAKPOINT, pc);
+    return true;
+  }
+
+  return false;
+}
+
+// Called by system.c for accesses to watched pages only. The CPU stops
+// before the next instruction, after the access has completed.
+void debugger_memory_access(uint16_t address, uint8_t value, bool is_write) {
+  (void)value;
+
+  if (stopped || (pending_reason != DEBUGGER_STOP_NONE)) {
+    return;
+  }
+
+  for (int n = 0; n < watchpoint_count; n++) {
+    if ((address >= watchpoints[n].start) && (address <= watchpoints[n].end) &&
+        (watchpoints[n].type & (is_write ? DEBUGGER_WATCH_WRITE : DEBUGGER_WATCH_READ))) {
+      pending_reason = is_write ? DEBUGGER_STOP_WATCH_WRITE : DEBUGGER_STOP_WATCH_READ;
+      pending_address = address;
+      update_enabled();
+      return;
+    }
+  }
+}
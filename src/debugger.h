@@ -0,0 +1,66 @@
+#ifndef __DEBUGGER_H__
+#define __DEBUGGER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DEBUGGER_ANY_ADDRESS -1
+
+typedef enum {
+  DEBUGGER_WATCH_READ = 1,
+  DEBUGGER_WATCH_WRITE = 2,
+  DEBUGGER_WATCH_ACCESS = 3
+} debugger_watch_type_t;
+
+typedef enum {
+  DEBUGGER_REGISTER_A,
+  DEBUGGER_REGISTER_X,
+  DEBUGGER_REGISTER_Y,
+  DEBUGGER_REGISTER_SP,
+  DEBUGGER_REGISTER_PSW,
+  DEBUGGER_REGISTER_PC
+} debugger_register_t;
+
+typedef enum {
+  DEBUGGER_COMPARE_EQUAL,
+  DEBUGGER_COMPARE_NOT_EQUAL,
+  DEBUGGER_COMPARE_LESS,
+  DEBUGGER_COMPARE_GREATER
+} debugger_compare_t;
+
+typedef struct
+{
+    debugger_register_t reg;
+    debugger_compare_t compare;
+    uint16_t value;
+} debugger_condition_t;
+
+typedef enum {
+  DEBUGGER_STOP_NONE,
+  DEBUGGER_STOP_REQUESTED,
+  DEBUGGER_STOP_STEP,
+  DEBUGGER_STOP_BREAKPOINT,
+  DEBUGGER_STOP_WATCH_READ,
+  DEBUGGER_STOP_WATCH_WRITE
+} debugger_stop_reason_t;
+
+// Checked by the CPU cores before every instruction; true while any
+// breakpoint or watchpoint is set, or the CPU is stopped or stepping.
+extern bool debugger_enabled;
+
+extern int debugger_add_breakpoint(int address, const debugger_condition_t* condition);
+extern int debugger_remove_breakpoint(int address, const debugger_condition_t* condition);
+extern int debugger_add_watchpoint(uint16_t start, uint16_t end, debugger_watch_type_t type);
+extern int debugger_remove_watchpoint(uint16_t start, uint16_t end, debugger_watch_type_t type);
+extern void debugger_clear_all(void);
+
+extern void debugger_stop(void);
+extern void debugger_continue(void);
+extern void debugger_step(void);
+extern bool debugger_is_stopped(void);
+extern debugger_stop_reason_t debugger_get_stop_reason(uint16_t* address);
+
+extern bool debugger_check(uint16_t pc);
+extern void debugger_memory_access(uint16_t address, uint8_t value, bool is_write);
+
+#endif // __DEBUGGER_H__
@@ -33,7 +33,7 @@
 
 #define NUM_GPU_PLANES       4
 #define MAX_STAMPS           256
-#define MAX_SPRITES          64
+#define MAX_SPRITES          DISPLAY_MAX_SPRITES
 #define SPRITE_FLAGS_ENABLED (1 << 0)
 #define SPRITE_FLAGS_VISIBLE (1 << 1)
 
@@ -82,6 +82,32 @@ static uint8_t palette_blue[256];
 
 static display_hires_mode_t hires_mode = DISPLAY_HIRES_MODE_NONE;
 static bool display_updated = true;
+
+// Generations of the emulated layers, advanced by the emulation thread
+// whenever their contents change and copied into captured frames. They start
+// at 1 so that 0 can mean nothing has been uploaded.
+static uint32_t text_generation = 1;
+static uint32_t hires_generation[4] = {1, 1, 1, 1};
+static uint32_t gpu_generation = 1;
+static uint32_t sprite_generation[MAX_SPRITES];
+static uint8_t captured_text_bits[8192];
+
+// Layer textures composited by the SDL renderer on the UI thread. Each layer
+// is uploaded only when the generation in the frame differs from the one
+// last uploaded.
+static SDL_Renderer* layer_renderer = NULL;
+static SDL_Texture* composed_texture = NULL;
+static int composed_width = 0;
+static int composed_height = 0;
+static SDL_Texture* text_texture = NULL;
+static SDL_Texture* hires_textures[4];
+static SDL_Texture* gpu_texture = NULL;
+static SDL_Texture* sprite_textures[MAX_SPRITES];
+static SDL_Texture* colour_vdu_texture = NULL;
+static uint32_t uploaded_text_generation;
+static uint32_t uploaded_hires_generation[4];
+static uint32_t uploaded_gpu_generation;
+static uint32_t uploaded_sprite_generation[MAX_SPRITES];
 static bool sprite_is_enabled(const sprite_t* sprite);
 static bool sprite_is_visible(const sprite_t* sprite);
 
@@ -145,6 +171,7 @@ void hires_display_write_callback(uint16_t address, uint8_t value) {
   for (int index = 0; index < 4; index++) {
     if (display_hires_bank[index] == current_bank) {
       display_hires_memory[index][address - display_hires_start_address[index]] = value;
+      hires_generation[index]++;
       break;
     }
   }
@@ -156,8 +183,8 @@ static void hires_bank_select_write_callback(uint16_t address, uint8_t value) {
   display_hires_selected_bank = value;
 }
 
-void display_render(uint32_t* pixels) {
-  // Render the text display into the white_array pixel map
+// Renders the text display into the white_array pixel map
+static void display_render_text(void) {
   uint8_t* character_value = text_display_ram;
   uint8_t* chunky_bit = chunky_graphics_bits;
   uint8_t* inverse = inverse_video_bits;
@@ -183,16 +210,112 @@ void display_render(uint32_t* pixels) {
       inverse++;
     }
   }
+}
+
+static uint32_t display_palette_colour(uint8_t index) {
+  return ((uint32_t)palette_red[index] << 24) | ((uint32_t)palette_green[index] << 16) |
+         ((uint32_t)palette_blue[index] << 8) | 0xff;
+}
+
+// Copies everything the display shows into a frame for the UI thread. Layers
+// whose generation already matches the frame are not copied again.
+void display_capture_frame(display_frame_t* frame) {
+  frame->mode = hires_mode;
+
+  display_render_text();
+  if (memcmp(captured_text_bits, white_array, sizeof(captured_text_bits)) != 0) {
+    memcpy(captured_text_bits, white_array, sizeof(captured_text_bits));
+    text_generation++;
+  }
+  if (frame->text_generation != text_generation) {
+    memcpy(frame->text_bits, captured_text_bits, sizeof(frame->text_bits));
+    frame->text_generation = text_generation;
+  }
+
+  for (int index = 0; index < 4; index++) {
+    if (frame->hires_generation[index] != hires_generation[index]) {
+      memcpy(frame->hires_bits[index], display_hires_memory[index], sizeof(frame->hires_bits[index]));
+      frame->hires_generation[index] = hires_generation[index];
+    }
+  }
+
+  if (frame->gpu_generation != gpu_generation) {
+    memcpy(frame->gpu_pixels, gpu_pixels, sizeof(frame->gpu_pixels));
+    frame->gpu_generation = gpu_generation;
+  }
+  for (int i = 0; i < 256; i++) {
+    frame->palette[i] = display_palette_colour(i);
+  }
+  frame->show_gpu = (gpu_reg[GPU_PLANE_DISPLAY_MASK] & ((1 << NUM_GPU_PLANES) - 1)) != 0;
+  frame->border_left = border_left;
+  frame->border_top = border_top;
+  frame->border_right = border_right;
+  frame->border_bottom = border_bottom;
+
+  size_t image_size = 0;
+  for (int id = 0; id < MAX_SPRITES; id++) {
+    sprite_ptr_t sprite = &gpu_sprite_table[id];
+    display_frame_sprite_t* captured = &frame->sprites[id];
+
+    captured->visible = (sprite->active) && sprite_is_enabled(sprite) && sprite_is_visible(sprite) &&
+                        (NULL != sprite->image_ptr) && (sprite->width > 0) && (sprite->height > 0);
+    captured->x = sprite->x;
+    captured->y = sprite->y;
+    captured->width = sprite->width;
+    captured->height = sprite->height;
+    captured->generation = sprite_generation[id];
+    captured->image_offset = image_size;
+    if (captured->visible) {
+      image_size += (size_t)sprite->width * sprite->height;
+    }
+  }
 
-  // Render the text and hi-res graphics cards into the pixels array, which is then
-  // used to draw the window
-  switch (hires_mode) {
+  if (image_size > frame->sprite_images_size) {
+    uint8_t* images = realloc(frame->sprite_images, image_size);
+    if (NULL == images) {
+      image_size = 0;
+      for (int id = 0; id < MAX_SPRITES; id++) {
+        frame->sprites[id].visible = false;
+      }
+    } else {
+      frame->sprite_images = images;
+      frame->sprite_images_size = image_size;
+    }
+  }
+  for (int id = 0; (id < MAX_SPRITES) && (image_size > 0); id++) {
+    if (frame->sprites[id].visible) {
+      memcpy(frame->sprite_images + frame->sprites[id].image_offset, gpu_sprite_table[id].image_ptr,
+             (size_t)gpu_sprite_table[id].width * gpu_sprite_table[id].height);
+    }
+  }
+
+  if (hires_mode == DISPLAY_HIRES_MODE_COLOUR_VDU) {
+    colour_vdu_render(frame->colour_vdu_pixels);
+  }
+}
+
+void display_get_frame_size(const display_frame_t* frame, int* width, int* height) {
+  if (frame->mode == DISPLAY_HIRES_MODE_COLOUR_VDU) {
+    *width = COLOUR_VDU_WIDTH;
+    *height = COLOUR_VDU_HEIGHT;
+  } else {
+    *width = DISPLAY_WIDTH;
+    *height = DISPLAY_HEIGHT;
+  }
+}
+
+// Software compositing of a captured frame, used when the renderer cannot
+// composite the layers itself
+void display_render_frame(const display_frame_t* frame, uint32_t* pixels) {
+  const uint8_t* text_bits = frame->text_bits;
+
+  switch (frame->mode) {
     case DISPLAY_HIRES_MODE_NONE: {
       for (int i = 0; i < 8192; i++) {
         for (int bit = 0; bit < 8; bit++) {
           int x = (i * 8 + bit) % DISPLAY_WIDTH;
           int y = (i * 8 + bit) / DISPLAY_WIDTH;
-          uint8_t w_bit = (white_array[i] >> (7 - bit)) & 1;
+          uint8_t w_bit = (text_bits[i] >> (7 - bit)) & 1;
           uint32_t w = w_bit * 0xffffffff;
           pixels[y * DISPLAY_WIDTH + x] = w | 0xff;
         }
@@ -204,11 +327,11 @@ void display_render(uint32_t* pixels) {
         for (int bit = 0; bit < 8; bit++) {
           int x = (i * 8 + bit) % DISPLAY_WIDTH;
           int y = (i * 8 + bit) / DISPLAY_WIDTH;
-          uint8_t w_bit = (white_array[i] >> (7 - bit)) & 1;
-          uint8_t r_bit = (display_hires_memory[0][i] >> (7 - bit)) & 1;
-          uint8_t g_bit = (display_hires_memory[1][i] >> (7 - bit)) & 1;
-          uint8_t b_bit = (display_hires_memory[2][i] >> (7 - bit)) & 1;
-          uint8_t intensity = ((display_hires_memory[3][i] >> (7 - bit)) & 1) ? 0xff : 0x80;
+          uint8_t w_bit = (text_bits[i] >> (7 - bit)) & 1;
+          uint8_t r_bit = (frame->hires_bits[0][i] >> (7 - bit)) & 1;
+          uint8_t g_bit = (frame->hires_bits[1][i] >> (7 - bit)) & 1;
+          uint8_t b_bit = (frame->hires_bits[2][i] >> (7 - bit)) & 1;
+          uint8_t intensity = ((frame->hires_bits[3][i] >> (7 - bit)) & 1) ? 0xff : 0x80;
           uint32_t w = w_bit * 0xffffffff;
           uint32_t r = r_bit * intensity;
           uint32_t g = g_bit * intensity;
@@ -219,61 +342,292 @@ void display_render(uint32_t* pixels) {
     } break;
 
     case DISPLAY_HIRES_MODE_EXTENDED: {
-      bool show_gpu = (gpu_reg[GPU_PLANE_DISPLAY_MASK] & ((1 << NUM_GPU_PLANES) - 1)) != 0;
       for (int y = 0; y < DISPLAY_HEIGHT; y++) {
         for (int x = 0; x < DISPLAY_WIDTH; x++) {
           int i = (y * 32) + (x >> 3);
-          uint32_t w = ((white_array[i] >> (7 - (x & 0x07))) & 1) * 0xffffffff;
-          uint32_t red = 0;
-          uint32_t green = 0;
-          uint32_t blue = 0;
-          if (show_gpu &&
-              (x >= border_left) && (x <= 255 - border_right) &&
-              (y >= border_top) && (y <= 255 - border_bottom)) {
-            red = palette_red[gpu_pixels[x][y]];
-            green = palette_green[gpu_pixels[x][y]];
-            blue = palette_blue[gpu_pixels[x][y]];
+          uint32_t w = ((text_bits[i] >> (7 - (x & 0x07))) & 1) * 0xffffffff;
+          uint32_t colour = 0xff;
+          if (frame->show_gpu &&
+              (x >= frame->border_left) && (x <= 255 - frame->border_right) &&
+              (y >= frame->border_top) && (y <= 255 - frame->border_bottom)) {
+            colour = frame->palette[frame->gpu_pixels[x][y]];
           }
-          pixels[y * DISPLAY_WIDTH + x] = w | (red << 24) | (green << 16) | (blue << 8) | 0xff;
+          pixels[y * DISPLAY_WIDTH + x] = w | colour;
         }
       }
 
-      sprite_ptr_t sprite = gpu_sprite_table;
       for (int i = 0; i < MAX_SPRITES; i++) {
-        if ((sprite->active) && sprite_is_enabled(sprite) && sprite_is_visible(sprite) && (NULL != sprite->image_ptr) &&
-            (sprite->width > 0) && (sprite->height > 0)) {
-          uint32_t red = 0;
-          uint32_t green = 0;
-          uint32_t blue = 0;
-          uint8_t* sprite_pixel = sprite->image_ptr;
-          for (int sy = 0; sy < sprite->height; sy++) {
-            int y = sprite->y + sy;
-            if ((y < 0) || (y >= DISPLAY_HEIGHT)) {
-              sprite_pixel += sprite->width;
-              continue;
-            }
-            for (int sx = 0; sx < sprite->width; sx++) {
-              int x = sprite->x + sx;
-              if ((*sprite_pixel != 0xff) && (x >= 0) && (x < DISPLAY_WIDTH)) {
-                red = palette_red[*sprite_pixel];
-                green = palette_green[*sprite_pixel];
-                blue = palette_blue[*sprite_pixel];
-                pixels[y * DISPLAY_WIDTH + x] = (red << 24) | (green << 16) | (blue << 8) | 0xff;
-              }
-              sprite_pixel++;
+        const display_frame_sprite_t* sprite = &frame->sprites[i];
+        if (!sprite->visible) {
+          continue;
+        }
+        const uint8_t* sprite_pixel = frame->sprite_images + sprite->image_offset;
+        for (int sy = 0; sy < sprite->height; sy++) {
+          int y = sprite->y + sy;
+          if ((y < 0) || (y >= DISPLAY_HEIGHT)) {
+            sprite_pixel += sprite->width;
+            continue;
+          }
+          for (int sx = 0; sx < sprite->width; sx++) {
+            int x = sprite->x + sx;
+            if ((*sprite_pixel != 0xff) && (x >= 0) && (x < DISPLAY_WIDTH)) {
+              pixels[y * DISPLAY_WIDTH + x] = frame->palette[*sprite_pixel];
             }
+            sprite_pixel++;
           }
         }
-        sprite++;
       }
     } break;
 
     case DISPLAY_HIRES_MODE_COLOUR_VDU:
-      colour_vdu_render(pixels);
+      memcpy(pixels, frame->colour_vdu_pixels, sizeof(frame->colour_vdu_pixels));
       break;
   }
 }
 
+static SDL_Texture* display_create_layer(int width, int height, SDL_BlendMode blend_mode) {
+  SDL_Texture* texture = SDL_CreateTexture(layer_renderer, SDL_PIXELFORMAT_RGBA8888,
+                                           SDL_TEXTUREACCESS_STREAMING, width, height);
+
+  if ((NULL != texture) && (SDL_SetTextureBlendMode(texture, blend_mode) != 0)) {
+    SDL_DestroyTexture(texture);
+    texture = NULL;
+  }
+  return texture;
+}
+
+// Expands a 256x256 one bit per pixel map into a layer texture
+static void display_upload_bitmap(SDL_Texture* texture, const uint8_t* bits, uint32_t set, uint32_t clear) {
+  void* locked_pixels;
+  int pitch;
+
+  if (SDL_LockTexture(texture, NULL, &locked_pixels, &pitch) != 0) {
+    return;
+  }
+
+  for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+    uint32_t* target = (uint32_t*)((uint8_t*)locked_pixels + y * pitch);
+    for (int x = 0; x < DISPLAY_WIDTH; x++) {
+      target[x] = ((bits[(y * 32) + (x >> 3)] >> (7 - (x & 0x07))) & 1) ? set : clear;
+    }
+  }
+  SDL_UnlockTexture(texture);
+}
+
+static void display_upload_gpu_layer(const display_frame_t* frame) {
+  void* locked_pixels;
+  int pitch;
+
+  if (SDL_LockTexture(gpu_texture, NULL, &locked_pixels, &pitch) != 0) {
+    return;
+  }
+
+  for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+    uint32_t* target = (uint32_t*)((uint8_t*)locked_pixels + y * pitch);
+    for (int x = 0; x < DISPLAY_WIDTH; x++) {
+      target[x] = frame->palette[frame->gpu_pixels[x][y]];
+    }
+  }
+  SDL_UnlockTexture(gpu_texture);
+  uploaded_gpu_generation = frame->gpu_generation;
+}
+
+// Sprite images are fixed when the sprite is created, so each one is uploaded
+// once and moving it only changes where the renderer draws it
+static void display_upload_sprite_layer(const display_frame_t* frame, int id) {
+  const display_frame_sprite_t* sprite = &frame->sprites[id];
+  void* locked_pixels;
+  int pitch;
+
+  if (NULL != sprite_textures[id]) {
+    SDL_DestroyTexture(sprite_textures[id]);
+    sprite_textures[id] = NULL;
+  }
+  uploaded_sprite_generation[id] = sprite->generation;
+
+  sprite_textures[id] = display_create_layer(sprite->width, sprite->height, SDL_BLENDMODE_BLEND);
+  if ((NULL == sprite_textures[id]) ||
+      (SDL_LockTexture(sprite_textures[id], NULL, &locked_pixels, &pitch) != 0)) {
+    return;
+  }
+
+  const uint8_t* sprite_pixel = frame->sprite_images + sprite->image_offset;
+  for (int y = 0; y < sprite->height; y++) {
+    uint32_t* target = (uint32_t*)((uint8_t*)locked_pixels + y * pitch);
+    for (int x = 0; x < sprite->width; x++) {
+      target[x] = (*sprite_pixel != 0xff) ? frame->palette[*sprite_pixel] : 0;
+      sprite_pixel++;
+    }
+  }
+  SDL_UnlockTexture(sprite_textures[id]);
+}
+
+static void display_compose_tangerine(const display_frame_t* frame) {
+  static const uint8_t plane_colours[3][3] = {{0xff, 0, 0}, {0, 0xff, 0}, {0, 0, 0xff}};
+
+  for (int index = 0; index < 4; index++) {
+    if (uploaded_hires_generation[index] != frame->hires_generation[index]) {
+      // Red, green and blue add full intensity, then the intensity plane
+      // halves every pixel whose bit is clear
+      display_upload_bitmap(hires_textures[index], frame->hires_bits[index],
+                            0xffffffff, (index == 3) ? 0x808080ff : 0x00000000);
+      uploaded_hires_generation[index] = frame->hires_generation[index];
+    }
+  }
+
+  for (int index = 0; index < 3; index++) {
+    SDL_SetTextureColorMod(hires_textures[index], plane_colours[index][0],
+                           plane_colours[index][1], plane_colours[index][2]);
+    SDL_RenderCopy(layer_renderer, hires_textures[index], NULL, NULL);
+  }
+  SDL_RenderCopy(layer_renderer, hires_textures[3], NULL, NULL);
+}
+
+static void display_compose_gpu(const display_frame_t* frame) {
+  SDL_Rect visible = {frame->border_left, frame->border_top,
+                      DISPLAY_WIDTH - frame->border_left - frame->border_right,
+                      DISPLAY_HEIGHT - frame->border_top - frame->border_bottom};
+
+  if (uploaded_gpu_generation != frame->gpu_generation) {
+    display_upload_gpu_layer(frame);
+  }
+
+  if (frame->show_gpu && (visible.w > 0) && (visible.h > 0)) {
+    SDL_RenderCopy(layer_renderer, gpu_texture, &visible, &visible);
+  }
+}
+
+static void display_compose_sprites(const display_frame_t* frame) {
+  for (int id = 0; id < MAX_SPRITES; id++) {
+    const display_frame_sprite_t* sprite = &frame->sprites[id];
+
+    if (!sprite->visible) {
+      continue;
+    }
+
+    if (uploaded_sprite_generation[id] != sprite->generation) {
+      display_upload_sprite_layer(frame, id);
+    }
+
+    if (NULL != sprite_textures[id]) {
+      SDL_Rect position = {sprite->x, sprite->y, sprite->width, sprite->height};
+      SDL_RenderCopy(layer_renderer, sprite_textures[id], NULL, &position);
+    }
+  }
+}
+
+bool display_layers_initialise(SDL_Renderer* renderer) {
+  layer_renderer = renderer;
+
+  if (SDL_RenderTargetSupported(renderer)) {
+    text_texture = display_create_layer(DISPLAY_WIDTH, DISPLAY_HEIGHT, SDL_BLENDMODE_BLEND);
+    for (int index = 0; index < 4; index++) {
+      hires_textures[index] = display_create_layer(DISPLAY_WIDTH, DISPLAY_HEIGHT,
+                                                   (index == 3) ? SDL_BLENDMODE_MOD : SDL_BLENDMODE_ADD);
+    }
+    gpu_texture = display_create_layer(DISPLAY_WIDTH, DISPLAY_HEIGHT, SDL_BLENDMODE_NONE);
+    colour_vdu_texture = display_create_layer(COLOUR_VDU_WIDTH, COLOUR_VDU_HEIGHT, SDL_BLENDMODE_NONE);
+  }
+
+  if ((NULL == text_texture) || (NULL == hires_textures[0]) || (NULL == hires_textures[1]) ||
+      (NULL == hires_textures[2]) || (NULL == hires_textures[3]) || (NULL == gpu_texture) ||
+      (NULL == colour_vdu_texture)) {
+    printf("Display layers unavailable, compositing in software\r\n");
+    display_layers_close();
+    return false;
+  }
+
+  display_layers_invalidate();
+  return true;
+}
+
+// Marks every layer for upload, e.g. after the renderer lost its textures
+void display_layers_invalidate(void) {
+  uploaded_text_generation = 0;
+  uploaded_gpu_generation = 0;
+  memset(uploaded_hires_generation, 0, sizeof(uploaded_hires_generation));
+  memset(uploaded_sprite_generation, 0, sizeof(uploaded_sprite_generation));
+}
+
+// Uploads the layers of a frame that changed and composites them for its
+// mode. Returns NULL if the layers are unavailable, in which case the caller
+// falls back to display_render_frame().
+SDL_Texture* display_layers_compose(const display_frame_t* frame) {
+  int width;
+  int height;
+
+  if (NULL == text_texture) {
+    return NULL;
+  }
+
+  if (frame->mode == DISPLAY_HIRES_MODE_COLOUR_VDU) {
+    SDL_UpdateTexture(colour_vdu_texture, NULL, frame->colour_vdu_pixels, COLOUR_VDU_WIDTH * sizeof(uint32_t));
+    return colour_vdu_texture;
+  }
+
+  display_get_frame_size(frame, &width, &height);
+  if ((NULL == composed_texture) || (width != composed_width) || (height != composed_height)) {
+    if (NULL != composed_texture) {
+      SDL_DestroyTexture(composed_texture);
+    }
+    composed_texture = SDL_CreateTexture(layer_renderer, SDL_PIXELFORMAT_RGBA8888,
+                                         SDL_TEXTUREACCESS_TARGET, width, height);
+    if (NULL == composed_texture) {
+      printf("Unable to create display texture, compositing in software\r\n");
+      display_layers_close();
+      return NULL;
+    }
+    SDL_SetTextureBlendMode(composed_texture, SDL_BLENDMODE_NONE);
+    composed_width = width;
+    composed_height = height;
+  }
+
+  if (uploaded_text_generation != frame->text_generation) {
+    display_upload_bitmap(text_texture, frame->text_bits, 0xffffffff, 0x00000000);
+    uploaded_text_generation = frame->text_generation;
+  }
+
+  uint8_t red, green, blue, alpha;
+  SDL_GetRenderDrawColor(layer_renderer, &red, &green, &blue, &alpha);
+  SDL_SetRenderTarget(layer_renderer, composed_texture);
+  SDL_SetRenderDrawColor(layer_renderer, 0, 0, 0, 0xff);
+  SDL_RenderClear(layer_renderer);
+
+  if (frame->mode == DISPLAY_HIRES_MODE_TANGERINE) {
+    display_compose_tangerine(frame);
+  } else if (frame->mode == DISPLAY_HIRES_MODE_EXTENDED) {
+    display_compose_gpu(frame);
+  }
+
+  // Text is white over the graphics; sprites cover both
+  SDL_RenderCopy(layer_renderer, text_texture, NULL, NULL);
+  if (frame->mode == DISPLAY_HIRES_MODE_EXTENDED) {
+    display_compose_sprites(frame);
+  }
+
+  SDL_SetRenderTarget(layer_renderer, NULL);
+  SDL_SetRenderDrawColor(layer_renderer, red, green, blue, alpha);
+  return composed_texture;
+}
+
+void display_layers_close(void) {
+  SDL_Texture** textures[] = {&composed_texture, &text_texture, &hires_textures[0], &hires_textures[1],
+                              &hires_textures[2], &hires_textures[3], &gpu_texture, &colour_vdu_texture};
+
+  for (size_t i = 0; i < sizeof(textures) / sizeof(textures[0]); i++) {
+    if (NULL != *textures[i]) {
+      SDL_DestroyTexture(*textures[i]);
+      *textures[i] = NULL;
+    }
+  }
+  for (int id = 0; id < MAX_SPRITES; id++) {
+    if (NULL != sprite_textures[id]) {
+      SDL_DestroyTexture(sprite_textures[id]);
+      sprite_textures[id] = NULL;
+    }
+  }
+}
+
 bool display_updated_event() {
   bool rv = display_updated;
   display_updated = false;
@@ -310,6 +664,8 @@ void display_get_render_size(int* width, int* height) {
 
 uint8_t* display_get_hires_memory_pointer(int board_index) {
   if ((board_index >= 0) && (board_index <= 3)) {
+    // The caller may write through the pointer
+    hires_generation[board_index]++;
     return &display_hires_memory[board_index][0];
   } else {
     return NULL;
@@ -357,6 +713,7 @@ void display_gpu_set_colour(uint8_t x, uint8_t y, uint8_t colour) {
     gpu_pixels[x][y] = (gpu_pixels[x][y] & (uint8_t)~full_mask) | (colour & full_mask);
   }
 
+  gpu_generation++;
   display_updated = true;
 }
 
@@ -564,6 +921,7 @@ void display_gpu_fill_rectangle(uint8_t x1, uint8_t y1, uint8_t x2, uint8_t y2,
 }
 
 void display_gpu_scroll(int h, int v, uint8_t colour) {
+  gpu_generation++;
   if (h > 0) {
     for (int y = 0; y < DISPLAY_HEIGHT; ++y) {
       for (int x = DISPLAY_WIDTH - 1; x >= h; --x) {
@@ -660,6 +1018,7 @@ void display_gpu_sprite_create(uint8_t id, int16_t x, int16_t y, uint8_t group,
     free(gpu_sprite_table[id].image_ptr);
   }
   gpu_sprite_table[id].image_ptr = malloc((int)width * (int)height + 2);
+  sprite_generation[id]++;
   if (NULL == gpu_sprite_table[id].image_ptr) {
     gpu_reg[GPU_ERROR_REGISTER] = GPU_STATUS_ALLOCATION;
     return;
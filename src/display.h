@@ -1,12 +1,15 @@
 #ifndef __DISPLAY_H__
 #define __DISPLAY_H__
 
+#include "colour_vdu.h"
 #include "system.h"
+#include <SDL.h>
 #include <stdbool.h>
 #include <stdint.h>
 
 #define DISPLAY_WIDTH  256
 #define DISPLAY_HEIGHT 256
+#define DISPLAY_MAX_SPRITES 64
 
 typedef enum {
   DISPLAY_HIRES_MODE_NONE,
@@ -15,7 +18,46 @@ typedef enum {
   DISPLAY_HIRES_MODE_COLOUR_VDU
 } display_hires_mode_t;
 
-extern void display_render(uint32_t* pixels);
+typedef struct display_frame_sprite_t {
+  bool visible;
+  int16_t x;
+  int16_t y;
+  uint8_t width;
+  uint8_t height;
+  uint32_t generation;
+  size_t image_offset;
+} display_frame_sprite_t;
+
+// Everything the display shows, captured by the emulation thread and drawn by
+// the UI thread. Each layer carries a generation that changes with its
+// contents, so unchanged layers are neither copied nor uploaded again.
+typedef struct display_frame_t {
+  display_hires_mode_t mode;
+  uint32_t text_generation;
+  uint8_t text_bits[8192];
+  uint32_t hires_generation[4];
+  uint8_t hires_bits[4][8192];
+  uint32_t gpu_generation;
+  uint8_t gpu_pixels[DISPLAY_WIDTH][DISPLAY_HEIGHT];
+  uint32_t palette[256];
+  bool show_gpu;
+  uint8_t border_left;
+  uint8_t border_top;
+  uint8_t border_right;
+  uint8_t border_bottom;
+  display_frame_sprite_t sprites[DISPLAY_MAX_SPRITES];
+  uint8_t* sprite_images;
+  size_t sprite_images_size;
+  uint32_t colour_vdu_pixels[COLOUR_VDU_WIDTH * COLOUR_VDU_HEIGHT];
+} display_frame_t;
+
+extern void display_capture_frame(display_frame_t* frame);
+extern void display_get_frame_size(const display_frame_t* frame, int* width, int* height);
+extern void display_render_frame(const display_frame_t* frame, uint32_t* pixels);
+extern bool display_layers_initialise(SDL_Renderer* renderer);
+extern SDL_Texture* display_layers_compose(const display_frame_t* frame);
+extern void display_layers_invalidate(void);
+extern void display_layers_close(void);
 extern bool display_updated_event();
 extern uint8_t* display_get_hires_memory_pointer(int board_index);
 extern void display_set_hires_mode(display_hires_mode_t new_mode);
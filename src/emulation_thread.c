@@ -0,0 +1,440 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "emulation_thread.h"
+
+#include <SDL.h>
+#include <errno.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "audio_output.h"
+#include "colour_vdu.h"
+#include "cpu_6502.h"
+#include "debugger.h"
+#include "function_return_codes.h"
+#include "gdb_stub.h"
+#include "joystick.h"
+#include "keyboard.h"
+#include "system.h"
+
+// The emulated machine runs on its own thread in slices of
+// EMULATION_SLICE_MS. Completed frames go to the UI thread through a
+// lock-free triple buffer and input comes back through a single-producer,
+// single-consumer queue, so presenting a frame never delays emulation.
+// Anything else the UI does to the machine, such as menu commands, runs
+// between slices under emulation_thread_lock().
+//
+// Slices are paced against absolute CLOCK_MONOTONIC deadlines, so rounding
+// and oversleeping do not accumulate. A late slice is caught up by running
+// the next one straight away, up to EMULATION_MAX_CATCH_UP slices behind;
+// past that the backlog is dropped rather than run flat out.
+//
+// With vsync the UI thread posts vsync_sem after every present, and the
+// next slice starts then and covers one measured refresh interval, so each
+// displayed frame holds exactly one refresh worth of emulation. The slice is
+// stretched or shrunk slightly to track the monotonic clock, which is also
+// what the audio device consumes samples against, so sound neither starves
+// nor backs up. If no frame is presented the deadline still applies.
+
+#define EMULATION_SLICE_MS     20
+#define EMULATION_SLICE_NS     (EMULATION_SLICE_MS * 1000000LL)
+#define EMULATION_MAX_CATCH_UP 5
+#define STATS_PERIOD_NS        1000000000LL
+#define FRAME_COUNT        3
+#define FRAME_INDEX_MASK   0x03
+#define FRAME_FRESH        0x04
+#define INPUT_QUEUE_SIZE   256
+
+typedef struct emulation_input_t {
+  emulation_input_type_t type;
+  uint8_t value;
+} emulation_input_t;
+
+static SDL_Thread* thread = NULL;
+static SDL_mutex* emulation_mutex = NULL;
+static atomic_bool running;
+static atomic_int lock_waiters;
+static int clock_frequency;
+
+static atomic_bool vsync_locked;
+static atomic_llong refresh_interval;
+static SDL_sem* vsync_sem = NULL;
+
+// Statistics, gathered by the emulation thread over STATS_PERIOD_NS and
+// published under stats_mutex
+static SDL_mutex* stats_mutex = NULL;
+static emulation_stats_t stats;
+
+// Triple buffer: the emulation thread owns back_frame, the UI thread owns
+// front_frame and they swap through middle_frame, which carries FRAME_FRESH
+// while it holds a frame the UI has not taken yet
+static display_frame_t* frames[FRAME_COUNT];
+static int back_frame = 0;
+static atomic_int middle_frame;
+static int front_frame = 2;
+static atomic_bool frame_requested;
+static atomic_bool frame_event_pending;
+static uint32_t frame_event_type = (uint32_t)-1;
+
+// Written by the UI thread at input_head, read by the emulation thread at
+// input_tail
+static emulation_input_t input_queue[INPUT_QUEUE_SIZE];
+static atomic_uint input_head;
+static atomic_uint input_tail;
+
+static void emulation_thread_apply_input(void) {
+  unsigned int tail = atomic_load_explicit(&input_tail, memory_order_relaxed);
+  unsigned int head = atomic_load_explicit(&input_head, memory_order_acquire);
+
+  while (tail != head) {
+    const emulation_input_t* input = &input_queue[tail % INPUT_QUEUE_SIZE];
+
+    switch (input->type) {
+      case EMULATION_INPUT_KEYPRESS:
+        keyboard_keypress(input->value);
+        break;
+
+      case EMULATION_INPUT_JOYSTICK:
+        joystick_set_keys(input->value);
+        break;
+
+      case EMULATION_INPUT_HEX_KEYPAD:
+        keyboard_use_hex_keypad(input->value != 0);
+        break;
+
+      case EMULATION_INPUT_RESET:
+        system_reset();
+        break;
+
+      case EMULATION_INPUT_DEBUG_CONTINUE:
+        debugger_continue();
+        break;
+
+      case EMULATION_INPUT_DEBUG_STEP:
+        debugger_step();
+        break;
+    }
+    tail++;
+  }
+  atomic_store_explicit(&input_tail, tail, memory_order_release);
+}
+
+static void emulation_thread_publish_frame(void) {
+  display_capture_frame(frames[back_frame]);
+  back_frame = atomic_exchange(&middle_frame, back_frame | FRAME_FRESH) & FRAME_INDEX_MASK;
+
+  // Wake the UI thread once per frame it has not collected yet
+  if (!atomic_exchange(&frame_event_pending, true)) {
+    SDL_Event event;
+    SDL_zero(event);
+    event.type = frame_event_type;
+    SDL_PushEvent(&event);
+  }
+}
+
+static int64_t timespec_to_ns(const struct timespec* time) {
+  return (int64_t)time->tv_sec * 1000000000LL + time->tv_nsec;
+}
+
+static struct timespec ns_to_timespec(int64_t time) {
+  return (struct timespec){(time_t)(time / 1000000000LL), (long)(time % 1000000000LL)};
+}
+
+static int64_t monotonic_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return timespec_to_ns(&now);
+}
+
+static int emulation_thread_run(void* data) {
+  (void)data;
+  int64_t deadline = monotonic_ns();
+  int64_t previous_start = deadline;
+  int64_t slice_ns = EMULATION_SLICE_NS;
+  int64_t cycle_fraction = 0;
+  int cycle_debt = 0;
+
+  int64_t period_start = deadline;
+  uint64_t period_cycles = 0;
+  int64_t period_idle = 0;
+  unsigned int period_slices = 0;
+  double period_sum = 0.0;
+  double period_sum_squares = 0.0;
+  unsigned int period_dropped = 0;
+
+  while (atomic_load(&running)) {
+    int64_t start = monotonic_ns();
+    double slice_period = (double)(start - previous_start) / 1000000.0;
+    previous_start = start;
+
+    // Let a waiting UI command in before taking the machine again
+    if (atomic_load(&lock_waiters) > 0) {
+      SDL_Delay(1);
+    }
+
+    SDL_LockMutex(emulation_mutex);
+    emulation_thread_apply_input();
+    gdb_stub_poll();
+
+    // Instructions overrun the budget by a few cycles and a slice rarely
+    // holds a whole number of them; carry both into the next slice so the
+    // long-run rate matches clock_frequency exactly
+    int64_t cycle_time = (int64_t)clock_frequency * slice_ns + cycle_fraction;
+    int budget = (int)(cycle_time / 1000000000LL) + cycle_debt;
+    cycle_fraction = cycle_time % 1000000000LL;
+    uint64_t cycles = cpu_6502_get_cycles();
+    cpu_6502_execute(budget);
+    audio_output_sync(cpu_6502_get_cycles());
+    cycles = cpu_6502_get_cycles() - cycles;
+    cycle_debt = budget - (int)cycles;
+    if (cycle_debt > 0) {
+      // Stopped in the debugger; don't save up cycles to run later
+      cycle_debt = 0;
+    }
+
+    if (colour_vdu_get_enabled() && colour_vdu_output_changed_event()) {
+      display_set_hires_mode(colour_vdu_output_selected()
+        ? DISPLAY_HIRES_MODE_COLOUR_VDU
+        : DISPLAY_HIRES_MODE_NONE);
+    }
+
+    bool colour_vdu_updated = colour_vdu_updated_event();
+    if (display_updated_event() ||
+        ((display_get_hires_mode() == DISPLAY_HIRES_MODE_COLOUR_VDU) && colour_vdu_updated) ||
+        atomic_exchange(&frame_requested, false)) {
+      emulation_thread_publish_frame();
+    }
+    SDL_UnlockMutex(emulation_mutex);
+
+    deadline += slice_ns;
+    int64_t now = monotonic_ns();
+    bool vsync = atomic_load(&vsync_locked);
+    int64_t interval = vsync ? atomic_load(&refresh_interval) : EMULATION_SLICE_NS;
+
+    if (now - deadline > EMULATION_MAX_CATCH_UP * interval) {
+      deadline = now;
+      period_dropped++;
+    } else if (vsync) {
+      // Never run more than a frame ahead, whatever the presents do
+      if (deadline - now > interval) {
+        struct timespec wake_time = ns_to_timespec(deadline - interval);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake_time, NULL) == EINTR) {
+        }
+      }
+
+      // Wait for the next present, allowing it a quarter of a refresh past
+      // the deadline before giving up on it
+      int64_t wait = deadline + interval / 4 - monotonic_ns();
+      if (wait > 0) {
+        SDL_SemWaitTimeout(vsync_sem, (uint32_t)((wait + 999999) / 1000000));
+      }
+      int64_t woken = monotonic_ns();
+      period_idle += woken - now;
+      now = woken;
+    } else if (now < deadline) {
+      struct timespec wake_time = ns_to_timespec(deadline);
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake_time, NULL) == EINTR) {
+      }
+      int64_t woken = monotonic_ns();
+      period_idle += woken - now;
+      now = woken;
+    }
+
+    // Under vsync, steer the emulated time towards the clock an eighth of
+    // the error per slice
+    slice_ns = interval;
+    if (vsync) {
+      slice_ns += (now - deadline) / 8;
+      if (slice_ns < interval / 2) {
+        slice_ns = interval / 2;
+      } else if (slice_ns > interval * 2) {
+        slice_ns = interval * 2;
+      }
+    }
+
+    period_cycles += cycles;
+    if (period_slices++ > 0) {
+      period_sum += slice_period;
+      period_sum_squares += slice_period * slice_period;
+    }
+
+    if (now - period_start >= STATS_PERIOD_NS) {
+      double seconds = (double)(now - period_start) / 1000000000.0;
+      double samples = period_slices > 1 ? (double)(period_slices - 1) : 1.0;
+      double mean = period_sum / samples;
+      double variance = period_sum_squares / samples - mean * mean;
+
+      SDL_LockMutex(stats_mutex);
+      stats.emulated_mhz = (double)period_cycles / seconds / 1000000.0;
+      stats.slice_time_ms = mean;
+      stats.slice_jitter_ms = variance > 0.0 ? sqrt(variance) : 0.0;
+      stats.idle_percent = 100.0 * (double)period_idle / (double)(now - period_start);
+      stats.dropped_slices = period_dropped;
+      SDL_UnlockMutex(stats_mutex);
+
+      period_start = now;
+      period_cycles = 0;
+      period_idle = 0;
+      period_slices = 0;
+      period_sum = 0.0;
+      period_sum_squares = 0.0;
+      period_dropped = 0;
+    }
+  }
+
+  return 0;
+}
+
+int emulation_thread_start(int cpu_clock_frequency) {
+  for (int i = 0; i < FRAME_COUNT; i++) {
+    frames[i] = calloc(1, sizeof(display_frame_t));
+    if (NULL == frames[i]) {
+      printf("Unable to allocate display frames\r\n");
+      emulation_thread_stop();
+      return RV_MEMORY_ALLOCATION_FAILURE;
+    }
+  }
+
+  frame_event_type = SDL_RegisterEvents(1);
+  emulation_mutex = SDL_CreateMutex();
+  stats_mutex = SDL_CreateMutex();
+  vsync_sem = SDL_CreateSemaphore(0);
+  if ((frame_event_type == (uint32_t)-1) || (NULL == emulation_mutex) ||
+      (NULL == stats_mutex) || (NULL == vsync_sem)) {
+    printf("Unable to create emulation thread: %s\r\n", SDL_GetError());
+    emulation_thread_stop();
+    return RV_MEMORY_ALLOCATION_FAILURE;
+  }
+
+  clock_frequency = cpu_clock_frequency;
+  atomic_store(&refresh_interval, EMULATION_SLICE_NS);
+  stats = (emulation_stats_t){0};
+  back_frame = 0;
+  atomic_store(&middle_frame, 1);
+  front_frame = 2;
+  atomic_store(&frame_requested, true);
+  atomic_store(&running, true);
+
+  thread = SDL_CreateThread(emulation_thread_run, "emulation", NULL);
+  if (NULL == thread) {
+    printf("Unable to create emulation thread: %s\r\n", SDL_GetError());
+    atomic_store(&running, false);
+    emulation_thread_stop();
+    return RV_MEMORY_ALLOCATION_FAILURE;
+  }
+
+  return RV_OK;
+}
+
+void emulation_thread_stop(void) {
+  atomic_store(&running, false);
+  if (NULL != thread) {
+    SDL_WaitThread(thread, NULL);
+    thread = NULL;
+  }
+
+  if (NULL != emulation_mutex) {
+    SDL_DestroyMutex(emulation_mutex);
+    emulation_mutex = NULL;
+  }
+
+  if (NULL != stats_mutex) {
+    SDL_DestroyMutex(stats_mutex);
+    stats_mutex = NULL;
+  }
+
+  if (NULL != vsync_sem) {
+    SDL_DestroySemaphore(vsync_sem);
+    vsync_sem = NULL;
+  }
+
+  for (int i = 0; i < FRAME_COUNT; i++) {
+    if (NULL != frames[i]) {
+      free(frames[i]->sprite_images);
+      free(frames[i]);
+      frames[i] = NULL;
+    }
+  }
+}
+
+// Stops the machine between slices so the UI thread can change its state
+void emulation_thread_lock(void) {
+  atomic_fetch_add(&lock_waiters, 1);
+  SDL_LockMutex(emulation_mutex);
+  atomic_fetch_sub(&lock_waiters, 1);
+}
+
+void emulation_thread_unlock(void) {
+  SDL_UnlockMutex(emulation_mutex);
+}
+
+// Call with the emulation thread locked
+void emulation_thread_set_clock_frequency(int cpu_clock_frequency) {
+  clock_frequency = cpu_clock_frequency;
+}
+
+// Starts or stops running one slice per presented frame. refresh_interval_ns
+// is the display's refresh period.
+void emulation_thread_set_vsync(bool enabled, int64_t refresh_interval_ns) {
+  atomic_store(&refresh_interval, refresh_interval_ns);
+  atomic_store(&vsync_locked, enabled);
+  SDL_SemPost(vsync_sem);
+}
+
+// Called by the UI thread after each vsync'd present with the latest measured
+// refresh period
+void emulation_thread_vsync_presented(int64_t refresh_interval_ns) {
+  atomic_store(&refresh_interval, refresh_interval_ns);
+  if (SDL_SemValue(vsync_sem) == 0) {
+    SDL_SemPost(vsync_sem);
+  }
+}
+
+// Queues input from the UI thread for the start of the next slice. Returns
+// false if the queue is full.
+bool emulation_thread_send_input(emulation_input_type_t type, uint8_t value) {
+  unsigned int head = atomic_load_explicit(&input_head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit(&input_tail, memory_order_acquire);
+
+  if (head - tail >= INPUT_QUEUE_SIZE) {
+    return false;
+  }
+
+  input_queue[head % INPUT_QUEUE_SIZE] = (emulation_input_t){type, value};
+  atomic_store_explicit(&input_head, head + 1, memory_order_release);
+  return true;
+}
+
+// Asks for a frame after the next slice even if the display has not changed,
+// e.g. after a menu command loaded a snapshot
+void emulation_thread_request_frame(void) {
+  atomic_store(&frame_requested, true);
+}
+
+// Returns the newest published frame, or NULL if there is none since the last
+// call. The frame stays valid until the next call.
+const display_frame_t* emulation_thread_acquire_frame(void) {
+  atomic_store(&frame_event_pending, false);
+
+  if ((atomic_load(&middle_frame) & FRAME_FRESH) == 0) {
+    return NULL;
+  }
+
+  front_frame = atomic_exchange(&middle_frame, front_frame) & FRAME_INDEX_MASK;
+  return frames[front_frame];
+}
+
+// SDL event type pushed when a frame is published
+uint32_t emulation_thread_frame_event(void) {
+  return frame_event_type;
+}
+
+// Copies the figures for the last complete statistics period
+void emulation_thread_get_stats(emulation_stats_t* current_stats) {
+  SDL_LockMutex(stats_mutex);
+  *current_stats = stats;
+  SDL_UnlockMutex(stats_mutex);
+}
@@ -0,0 +1,39 @@
+#ifndef __EMULATION_THREAD_H__
+#define __EMULATION_THREAD_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "display.h"
+
+typedef enum {
+  EMULATION_INPUT_KEYPRESS,
+  EMULATION_INPUT_JOYSTICK,
+  EMULATION_INPUT_HEX_KEYPAD,
+  EMULATION_INPUT_RESET,
+  EMULATION_INPUT_DEBUG_CONTINUE,
+  EMULATION_INPUT_DEBUG_STEP
+} emulation_input_type_t;
+
+typedef struct emulation_stats_t {
+  double emulated_mhz;
+  double slice_time_ms;
+  double slice_jitter_ms;
+  double idle_percent;
+  unsigned int dropped_slices;
+} emulation_stats_t;
+
+extern int emulation_thread_start(int cpu_clock_frequency);
+extern void emulation_thread_stop(void);
+extern void emulation_thread_lock(void);
+extern void emulation_thread_unlock(void);
+extern void emulation_thread_set_clock_frequency(int cpu_clock_frequency);
+extern void emulation_thread_set_vsync(bool enabled, int64_t refresh_interval_ns);
+extern void emulation_thread_vsync_presented(int64_t refresh_interval_ns);
+extern bool emulation_thread_send_input(emulation_input_type_t type, uint8_t value);
+extern void emulation_thread_request_frame(void);
+extern const display_frame_t* emulation_thread_acquire_frame(void);
+extern uint32_t emulation_thread_frame_event(void);
+extern void emulation_thread_get_stats(emulation_stats_t* current_stats);
+
+#endif // __EMULATION_THREAD_H__
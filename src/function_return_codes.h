@@ -7,5 +7,9 @@
 #define RV_FILE_READ_ERROR           -3
 #define RV_MEMORY_ALLOCATION_FAILURE -4
 #define RV_DEVICE_NOT_ADDED          -5
+#define RV_FILE_WRITE_ERROR          -6
+#define RV_INVALID_PARAMETER         -7
+#define RV_DEVICE_OPEN_ERROR         -8
+#define RV_FILE_IN_USE               -9
 
 #endif // __FUNCTION_RETURN_CODES_H__
@@ -0,0 +1,771 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "gdb_stub.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cpu_6502.h"
+#include "debugger.h"
+#include "function_return_codes.h"
+#include "system.h"
+
+// GDB remote serial protocol server. The listening and client sockets are
+// non-blocking and serviced from gdb_stub_poll() once per emulation slice, so
+// the emulator keeps rendering while a debugger is attached or the CPU is
+// stopped. Execution control goes through the debugger module.
+
+#define GDB_PACKET_SIZE 4096
+#define GDB_OUTPUT_SIZE (2 * GDB_PACKET_SIZE + 16)
+#define GDB_REGISTER_COUNT 6
+
+static const char target_xml[] =
+  "<?xml version=\"1.0\"?>"
+  "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+  "<target version=\"1.0\">"
+  "<feature name=\"org.microtan65.m6502\">"
+  "<reg name=\"a\" bitsize=\"8\" type=\"uint8\" regnum=\"0\"/>"
+  "<reg name=\"x\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"y\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"p\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"sp\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+  "</feature>"
+  "</target>";
+
+static int listen_socket = -1;
+static int client_socket = -1;
+static char socket_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+
+static char input[GDB_PACKET_SIZE + 4];
+static size_t input_length = 0;
+static char output[GDB_OUTPUT_SIZE];
+static size_t output_length = 0;
+static char last_packet[GDB_OUTPUT_SIZE];
+static size_t last_packet_length = 0;
+
+static bool ack_mode = true;
+// Set after a continue or step (or a '?' before the CPU has halted) until
+// the stop reply has been sent
+static bool waiting_for_stop = false;
+
+static void set_non_blocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+static void drop_client(void) {
+  if (client_socket >= 0) {
+    close(client_socket);
+    client_socket = -1;
+    printf("GDB: client disconnected\r\n");
+  }
+
+  input_length = 0;
+  output_length = 0;
+  last_packet_length = 0;
+  waiting_for_stop = false;
+  debugger_continue();
+}
+
+static void flush_output(void) {
+  size_t sent = 0;
+
+  while ((client_socket >= 0) && (sent < output_length)) {
+    ssize_t count = send(client_socket, output + sent, output_length - sent, MSG_NOSIGNAL);
+
+    if (count < 0) {
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+        drop_client();
+        return;
+      }
+
+      break;
+    }
+
+    sent += (size_t)count;
+  }
+
+  memmove(output, output + sent, output_length - sent);
+  output_length -= sent;
+}
+
+static void queue_raw(const char* data, size_t length) {
+  if (output_length + length > sizeof(output)) {
+    flush_output();
+  }
+
+  if (output_length + length <= sizeof(output)) {
+    memcpy(output + output_length, data, length);
+    output_length += length;
+  }
+}
+
+static void send_packet(const char* payload) {
+  size_t length = strlen(payload);
+  uint8_t checksum = 0;
+
+  if (length > GDB_OUTPUT_SIZE - 4) {
+    length = GDB_OUTPUT_SIZE - 4;
+  }
+
+  last_packet[0] = '$';
+  for (size_t n = 0; n < length; n++) {
+    last_packet[n + 1] = payload[n];
+    checksum += (uint8_t)payload[n];
+  }
+
+  snprintf(last_packet + length + 1, 4, "#%02x", checksum);
+  last_packet_length = length + 4;
+  queue_raw(last_packet, last_packet_length);
+}
+
+static int hex_digit(char c) {
+  if ((c >= '0') && (c <= '9')) {
+    return c - '0';
+  }
+
+  if ((c >= 'a') && (c <= 'f')) {
+    return c - 'a' + 10;
+  }
+
+  if ((c >= 'A') && (c <= 'F')) {
+    return c - 'A' + 10;
+  }
+
+  return -1;
+}
+
+// Parses a hex number, returning a pointer past it or NULL if there was none
+static const char* parse_hex(const char* text, unsigned long* value) {
+  const char* start = text;
+
+  *value = 0;
+
+  while (hex_digit(*text) >= 0) {
+    *value = (*value << 4) | (unsigned long)hex_digit(*text);
+    text++;
+  }
+
+  return (text == start) ? NULL : text;
+}
+
+static bool parse_hex_bytes(const char* text, uint8_t* bytes, size_t count) {
+  for (size_t n = 0; n < count; n++) {
+    int high = hex_digit(text[n * 2]);
+    int low = (high < 0) ? -1 : hex_digit(text[n * 2 + 1]);
+
+    if (low < 0) {
+      return false;
+    }
+
+    bytes[n] = (uint8_t)((high << 4) | low);
+  }
+
+  return true;
+}
+
+static void get_registers(uint8_t* registers) {
+  uint16_t pc = cpu_6502_get_pc();
+
+  registers[0] = cpu_6502_get_a();
+  registers[1] = cpu_6502_get_x();
+  registers[2] = cpu_6502_get_y();
+  registers[3] = cpu_6502_get_psw();
+  registers[4] = cpu_6502_get_sp();
+  registers[5] = (uint8_t)(pc & 0xff);
+  registers[6] = (uint8_t)(pc >> 8);
+}
+
+static void set_registers(const uint8_t* registers) {
+  cpu_6502_set_registers((uint16_t)(registers[5] | (registers[6] << 8)), registers[0],
+                         registers[1], registers[2], registers[4], registers[3]);
+}
+
+static void send_stop_reply(void) {
+  uint16_t address;
+  char reply[32];
+
+  switch (debugger_get_stop_reason(&address)) {
+    case DEBUGGER_STOP_BREAKPOINT:
+      send_packet("T05swbreak:;");
+      break;
+
+    case DEBUGGER_STOP_WATCH_READ:
+      snprintf(reply, sizeof(reply), "T05rwatch:%04x;", address);
+      send_packet(reply);
+      break;
+
+    case DEBUGGER_STOP_WATCH_WRITE:
+      snprintf(reply, sizeof(reply), "T05watch:%04x;", address);
+      send_packet(reply);
+      break;
+
+    case DEBUGGER_STOP_REQUESTED:
+      send_packet("S02");
+      break;
+
+    default:
+      send_packet("S05");
+      break;
+  }
+}
+
+static void handle_read_registers(void) {
+  uint8_t registers[GDB_REGISTER_COUNT + 1];
+  char reply[sizeof(registers) * 2 + 1];
+
+  get_registers(registers);
+
+  for (size_t n = 0; n < sizeof(registers); n++) {
+    snprintf(reply + n * 2, 3, "%02x", registers[n]);
+  }
+
+  send_packet(reply);
+}
+
+static void handle_write_registers(const char* data) {
+  uint8_t registers[GDB_REGISTER_COUNT + 1];
+
+  if ((strlen(data) < sizeof(registers) * 2) || !parse_hex_bytes(data, registers, sizeof(registers))) {
+    send_packet("E01");
+    return;
+  }
+
+  set_registers(registers);
+  send_packet("OK");
+}
+
+static void handle_read_register(const char* data) {
+  uint8_t registers[GDB_REGISTER_COUNT + 1];
+  unsigned long number;
+  char reply[8];
+
+  if (!parse_hex(data, &number) || (number >= GDB_REGISTER_COUNT)) {
+    send_packet("E01");
+    return;
+  }
+
+  get_registers(registers);
+
+  if (number == GDB_REGISTER_COUNT - 1) {
+    snprintf(reply, sizeof(reply), "%02x%02x", registers[5], registers[6]);
+  } else {
+    snprintf(reply, sizeof(reply), "%02x", registers[number]);
+  }
+
+  send_packet(reply);
+}
+
+static void handle_write_register(const char* data) {
+  uint8_t registers[GDB_REGISTER_COUNT + 1];
+  unsigned long number;
+  uint8_t value[2];
+
+  data = parse_hex(data, &number);
+
+  if (!data || (*data != '=') || (number >= GDB_REGISTER_COUNT)) {
+    send_packet("E01");
+    return;
+  }
+
+  size_t size = (number == GDB_REGISTER_COUNT - 1) ? 2 : 1;
+
+  if ((strlen(data + 1) < size * 2) || !parse_hex_bytes(data + 1, value, size)) {
+    send_packet("E01");
+    return;
+  }
+
+  get_registers(registers);
+  memcpy(registers + number, value, size);
+  set_registers(registers);
+  send_packet("OK");
+}
+
+// Memory is accessed directly, so inspecting it has no side effects
+static void handle_read_memory(const char* data) {
+  unsigned long address;
+  unsigned long length;
+  char reply[GDB_PACKET_SIZE];
+
+  data = parse_hex(data, &address);
+
+  if (!data || (*data != ',') || !parse_hex(data + 1, &length)) {
+    send_packet("E01");
+    return;
+  }
+
+  if (length > (sizeof(reply) - 1) / 2) {
+    length = (sizeof(reply) - 1) / 2;
+  }
+
+  // Device registers and memory are not read, as reading can have side
+  // effects; the reply stops short at the first such address
+  unsigned long n;
+
+  for (n = 0; n < length; n++) {
+    if (system_address_has_device_storage((uint16_t)(address + n))) {
+      break;
+    }
+
+    snprintf(reply + n * 2, 3, "%02x", *system_get_memory_pointer((uint16_t)(address + n)));
+  }
+
+  if ((n == 0) && (length > 0)) {
+    send_packet("E0E");
+    return;
+  }
+
+  reply[n * 2] = '\0';
+  send_packet(reply);
+}
+
+static void handle_write_memory(const char* data) {
+  unsigned long address;
+  unsigned long length;
+
+  data = parse_hex(data, &address);
+
+  // The length is checked before it is doubled so that it cannot wrap
+  if (!data || (*data != ',') || !(data = parse_hex(data + 1, &length)) || (*data != ':') ||
+      (length > 0x10000) || (length > strlen(data + 1) / 2)) {
+    send_packet("E01");
+    return;
+  }
+
+  data++;
+
+  for (unsigned long n = 0; n < length; n++) {
+    if (system_address_has_device_storage((uint16_t)(address + n))) {
+      send_packet("E0E");
+      return;
+    }
+  }
+
+  for (unsigned long n = 0; n < length; n++) {
+    if (!parse_hex_bytes(data + n * 2, system_get_memory_pointer((uint16_t)(address + n)), 1)) {
+      send_packet("E01");
+      return;
+    }
+  }
+
+  send_packet("OK");
+}
+
+static void handle_breakpoint(const char* data, bool insert) {
+  unsigned long type;
+  unsigned long address;
+  unsigned long length;
+  int rv = RV_OK;
+
+  data = parse_hex(data, &type);
+
+  if (!data || (*data != ',') || !(data = parse_hex(data + 1, &address)) || (*data != ',') ||
+      !parse_hex(data + 1, &length) || (address > 0xffff)) {
+    send_packet("E01");
+    return;
+  }
+
+  if (length == 0) {
+    length = 1;
+  }
+
+  uint16_t end = (address + length - 1 > 0xffff) ? 0xffff : (uint16_t)(address + length - 1);
+
+  switch (type) {
+    case 0:
+    case 1:
+      if (insert) {
+        rv = debugger_add_breakpoint((int)address, NULL);
+      } else {
+        rv = debugger_remove_breakpoint((int)address, NULL);
+      }
+      break;
+
+    case 2:
+    case 3:
+    case 4: {
+      debugger_watch_type_t watch_type = (type == 2) ? DEBUGGER_WATCH_WRITE
+                                         : (type == 3) ? DEBUGGER_WATCH_READ
+                                         : DEBUGGER_WATCH_ACCESS;
+      if (insert) {
+        rv = debugger_add_watchpoint((uint16_t)address, end, watch_type);
+      } else {
+        rv = debugger_remove_watchpoint((uint16_t)address, end, watch_type);
+      }
+      break;
+    }
+
+    default:
+      send_packet("");
+      return;
+  }
+
+  send_packet((rv == RV_OK) ? "OK" : "E0E");
+}
+
+static void handle_features(const char* data) {
+  unsigned long offset;
+  unsigned long length;
+  char reply[GDB_PACKET_SIZE];
+
+  data = parse_hex(data, &offset);
+
+  if (!data || (*data != ',') || !parse_hex(data + 1, &length)) {
+    send_packet("E01");
+    return;
+  }
+
+  size_t total = sizeof(target_xml) - 1;
+
+  if (offset >= total) {
+    send_packet("l");
+    return;
+  }
+
+  if (length > sizeof(reply) - 2) {
+    length = sizeof(reply) - 2;
+  }
+
+  size_t count = (total - offset < length) ? total - offset : length;
+  reply[0] = (offset + count < total) ? 'm' : 'l';
+  memcpy(reply + 1, target_xml + offset, count);
+  reply[count + 1] = '\0';
+  send_packet(reply);
+}
+
+static void resume(bool step, const char* address) {
+  unsigned long pc;
+
+  if (address && parse_hex(address, &pc)) {
+    cpu_6502_set_registers((uint16_t)pc, cpu_6502_get_a(), cpu_6502_get_x(), cpu_6502_get_y(),
+                           cpu_6502_get_sp(), cpu_6502_get_psw());
+  }
+
+  if (step) {
+    debugger_step();
+  } else {
+    debugger_continue();
+  }
+
+  waiting_for_stop = true;
+}
+
+static void handle_packet(char* packet) {
+  char reply[64];
+
+  switch (packet[0]) {
+    case '?':
+      if (debugger_is_stopped()) {
+        send_stop_reply();
+      } else {
+        waiting_for_stop = true;
+      }
+      break;
+
+    case 'g':
+      handle_read_registers();
+      break;
+
+    case 'G':
+      handle_write_registers(packet + 1);
+      break;
+
+    case 'p':
+      handle_read_register(packet + 1);
+      break;
+
+    case 'P':
+      handle_write_register(packet + 1);
+      break;
+
+    case 'm':
+      handle_read_memory(packet + 1);
+      break;
+
+    case 'M':
+      handle_write_memory(packet + 1);
+      break;
+
+    case 'c':
+      resume(false, packet + 1);
+      break;
+
+    case 's':
+      resume(true, packet + 1);
+      break;
+
+    case 'Z':
+      handle_breakpoint(packet + 1, true);
+      break;
+
+    case 'z':
+      handle_breakpoint(packet + 1, false);
+      break;
+
+    case 'H':
+      send_packet("OK");
+      break;
+
+    case 'D':
+      send_packet("OK");
+      flush_output();
+      drop_client();
+      break;
+
+    case 'k':
+      drop_client();
+      break;
+
+    case 'q':
+      if (strncmp(packet, "qSupported", 10) == 0) {
+        snprintf(reply, sizeof(reply), "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+;swbreak+",
+                 GDB_PACKET_SIZE);
+        send_packet(reply);
+      } else if (strncmp(packet, "qXfer:features:read:target.xml:", 31) == 0) {
+        handle_features(packet + 31);
+      } else if (strcmp(packet, "qAttached") == 0) {
+        send_packet("1");
+      } else if (strcmp(packet, "qC") == 0) {
+        send_packet("QC1");
+      } else if (strcmp(packet, "qfThreadInfo") == 0) {
+        send_packet("m1");
+      } else if (strcmp(packet, "qsThreadInfo") == 0) {
+        send_packet("l");
+      } else {
+        send_packet("");
+      }
+      break;
+
+    case 'Q':
+      if (strcmp(packet, "QStartNoAckMode") == 0) {
+        send_packet("OK");
+        ack_mode = false;
+      } else {
+        send_packet("");
+      }
+      break;
+
+    case 'T':
+      send_packet("OK");
+      break;
+
+    default:
+      send_packet("");
+      break;
+  }
+}
+
+// Extracts and handles every complete packet in the input buffer
+static void process_input(void) {
+  size_t start = 0;
+
+  while ((client_socket >= 0) && (start < input_length)) {
+    char c = input[start];
+
+    if (c == '\x03') {
+      debugger_stop();
+      waiting_for_stop = true;
+      start++;
+    } else if (c == '-') {
+      if (last_packet_length > 0) {
+        queue_raw(last_packet, last_packet_length);
+      }
+      start++;
+    } else if (c != '$') {
+      start++;
+    } else {
+      char* end = memchr(input + start, '#', input_length - start);
+
+      if (!end || ((size_t)(end - input) + 3 > input_length)) {
+        break;
+      }
+
+      uint8_t checksum = 0;
+      for (char* p = input + start + 1; p < end; p++) {
+        checksum += (uint8_t)*p;
+      }
+
+      int high = hex_digit(end[1]);
+      int low = hex_digit(end[2]);
+      bool valid = (high >= 0) && (low >= 0) && (((high << 4) | low) == checksum);
+      *end = '\0';
+
+      if (ack_mode) {
+        queue_raw(valid ? "+" : "-", 1);
+      }
+
+      if (valid) {
+        handle_packet(input + start + 1);
+      }
+
+      start = (size_t)(end - input) + 3;
+    }
+  }
+
+  if (client_socket < 0) {
+    return;
+  }
+
+  memmove(input, input + start, input_length - start);
+  input_length -= start;
+
+  if (input_length == sizeof(input)) {
+    // Oversized packet; discard it
+    input_length = 0;
+  }
+}
+
+static void accept_client(void) {
+  int fd = accept(listen_socket, NULL, NULL);
+
+  if (fd < 0) {
+    return;
+  }
+
+  if (client_socket >= 0) {
+    // One debugger at a time
+    close(fd);
+    return;
+  }
+
+  set_non_blocking(fd);
+  client_socket = fd;
+  ack_mode = true;
+  waiting_for_stop = false;
+  printf("GDB: client connected\r\n");
+  // GDB expects the target to be halted when it attaches
+  debugger_stop();
+}
+
+// address is a TCP port number on the loopback interface or a Unix socket path
+int gdb_stub_start(const char* address) {
+  char* end;
+  unsigned long port = strtoul(address, &end, 10);
+
+  if ((end != address) && (*end == '\0')) {
+    struct sockaddr_in addr;
+    int enable = 1;
+
+    if ((port == 0) || (port > 65535)) {
+      printf("GDB: invalid port [%s]\r\n", address);
+      return RV_INVALID_PARAMETER;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (listen_socket >= 0) {
+      setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+      if (bind(listen_socket, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(listen_socket);
+        listen_socket = -1;
+      }
+    }
+  } else {
+    struct sockaddr_un addr;
+
+    if (strlen(address) >= sizeof(addr.sun_path)) {
+      printf("GDB: socket path too long [%s]\r\n", address);
+      return RV_INVALID_PARAMETER;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, address);
+    unlink(address);
+    listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (listen_socket >= 0) {
+      if (bind(listen_socket, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(listen_socket);
+        listen_socket = -1;
+      } else {
+        strcpy(socket_path, address);
+      }
+    }
+  }
+
+  if ((listen_socket < 0) || (listen(listen_socket, 1) != 0)) {
+    printf("GDB: unable to listen on [%s]: %s\r\n", address, strerror(errno));
+    gdb_stub_close();
+    return RV_FILE_OPEN_ERROR;
+  }
+
+  set_non_blocking(listen_socket);
+  printf("GDB: listening on [%s]\r\n", address);
+  return RV_OK;
+}
+
+// Called once per emulation slice; never blocks
+void gdb_stub_poll(void) {
+  if (listen_socket < 0) {
+    return;
+  }
+
+  accept_client();
+
+  if (client_socket < 0) {
+    return;
+  }
+
+  while (input_length < sizeof(input)) {
+    ssize_t count = recv(client_socket, input + input_length, sizeof(input) - input_length, 0);
+
+    if (count == 0) {
+      drop_client();
+      return;
+    }
+
+    if (count < 0) {
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+        drop_client();
+        return;
+      }
+
+      break;
+    }
+
+    input_length += (size_t)count;
+  }
+
+  process_input();
+
+  if ((client_socket >= 0) && waiting_for_stop && debugger_is_stopped()) {
+    waiting_for_stop = false;
+    send_stop_reply();
+  }
+
+  flush_output();
+}
+
+bool gdb_stub_connected(void) {
+  return client_socket >= 0;
+}
+
+void gdb_stub_close(void) {
+  if (client_socket >= 0) {
+    drop_client();
+  }
+
+  if (listen_socket >= 0) {
+    close(listen_socket);
+    listen_socket = -1;
+  }
+
+  if (socket_path[0] != '\0') {
+    unlink(socket_path);
+    socket_path[0] = '\0';
+  }
+}
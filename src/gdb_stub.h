@@ -0,0 +1,11 @@
+#ifndef __GDB_STUB_H__
+#define __GDB_STUB_H__
+
+#include <stdbool.h>
+
+extern int gdb_stub_start(const char* address);
+extern void gdb_stub_poll(void);
+extern bool gdb_stub_connected(void);
+extern void gdb_stub_close(void);
+
+#endif // __GDB_STUB_H__
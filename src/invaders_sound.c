@@ -1,11 +1,14 @@
+#include "audio_output.h"
+#include "cpu_6502.h"
 #include "external_filenames.h"
 #include "invaders_sound.h"
 #include "system.h"
 #include <SDL.h>
-#include <SDL_mixer.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 /* ---------------------------------------------------------------------------
  * Space Invaders Sound Effects Handler
@@ -17,9 +20,14 @@
  *   Bit 3 (0x08): Saucer (looping)
  *   Bit 2 (0x04): Laser
  *   Bit 1 (0x02): Heartbeat (alternating between two samples)
+ *
+ * The WAV files are converted once at start-up to the audio output's format
+ * and played by voices mixed in with the AY8910s.  A register write syncs
+ * the mix to its CPU cycle first, so effects start on their exact sample.
  * --------------------------------------------------------------------------*/
 
 #define MAX_SOUNDS 6
+#define MAX_VOICES 8 /* one for the saucer loop, the rest for one-shots */
 
 typedef enum {
   SND_SAUCER = 0,
@@ -31,8 +39,20 @@ typedef enum {
   SND_EXPLOSION
 } sound_id_t;
 
-static Mix_Chunk* sounds[MAX_SOUNDS + 1];
-static int saucer_channel = -1; /* Channel for looping saucer sound */
+typedef struct {
+  int16_t* samples;
+  size_t length;
+} sound_t;
+
+typedef struct {
+  const sound_t* sound;
+  size_t position;
+  bool loop;
+} voice_t;
+
+static sound_t sounds[MAX_SOUNDS + 1];
+static voice_t voices[MAX_VOICES];
+static int saucer_channel = -1; /* Voice for looping saucer sound */
 static bool invaders_sound_initialized = false;
 
 static uint8_t heartbeat = 0;
@@ -51,38 +71,126 @@ static const char* sound_files[] = {
 };
 
 /* ---------------------------------------------------------------------------
- * Cleanup - free all sound chunks
+ * Stop one voice, or all of them with -1
+ * --------------------------------------------------------------------------*/
+static void halt_voice(int voice) {
+  for (int i = 0; i < MAX_VOICES; i++) {
+    if ((voice < 0) || (voice == i))
+      voices[i].sound = NULL;
+  }
+}
+
+/* ---------------------------------------------------------------------------
+ * Audio output source - adds every playing voice to the mix
+ * --------------------------------------------------------------------------*/
+static void render_voices(float* mix, int num_samples) {
+  for (int i = 0; i < MAX_VOICES; i++) {
+    voice_t* voice = &voices[i];
+    int position = 0;
+
+    while (voice->sound && (position < num_samples)) {
+      size_t remaining = voice->sound->length - voice->position;
+      size_t count = (size_t)(num_samples - position);
+      const int16_t* samples = voice->sound->samples + voice->position;
+
+      if (count > remaining)
+        count = remaining;
+
+      for (size_t n = 0; n < count; n++) {
+        mix[position + (int)n] += samples[n];
+      }
+
+      position += (int)count;
+      voice->position += count;
+
+      if (voice->position >= voice->sound->length) {
+        voice->position = 0;
+        if (!voice->loop)
+          voice->sound = NULL;
+      }
+    }
+  }
+}
+
+/* ---------------------------------------------------------------------------
+ * Cleanup - free all sounds
  * --------------------------------------------------------------------------*/
 void invaders_sound_close(void) {
   if (!invaders_sound_initialized)
     return;
 
   /* Stop all sounds */
-  Mix_HaltChannel(-1);
+  halt_voice(-1);
 
-  /* Free sound chunks */
+  /* Free sounds */
   for (int i = 0; i <= MAX_SOUNDS; i++) {
-    if (sounds[i]) {
-      Mix_FreeChunk(sounds[i]);
-      sounds[i] = NULL;
-    }
+    free(sounds[i].samples);
+    sounds[i].samples = NULL;
+    sounds[i].length = 0;
   }
 
-  Mix_CloseAudio();
+  audio_output_close();
   invaders_sound_initialized = false;
 }
 
 /* ---------------------------------------------------------------------------
  * Play a sound effect
  *
- * loop: -1 = infinite loop, 0 = play once, >0 = loop N times
- * Returns channel number or -1 on error
+ * loops: -1 = infinite loop, 0 = play once
+ * Returns voice number or -1 on error
  * --------------------------------------------------------------------------*/
 static int play_sound(sound_id_t sound, int loops) {
-  if (!invaders_sound_initialized || !sounds[sound])
+  if (!invaders_sound_initialized || !sounds[sound].samples)
     return -1;
 
-  return Mix_PlayChannel(-1, sounds[sound], loops);
+  for (int i = 0; i < MAX_VOICES; i++) {
+    if (!voices[i].sound) {
+      voices[i].sound = &sounds[sound];
+      voices[i].position = 0;
+      voices[i].loop = loops < 0;
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/* ---------------------------------------------------------------------------
+ * Load a WAV file converted to 16-bit mono at the audio output's rate
+ * --------------------------------------------------------------------------*/
+static bool load_sound(const char* filename, sound_t* sound) {
+  SDL_AudioSpec spec;
+  SDL_AudioCVT cvt;
+  Uint8* data = NULL;
+  Uint32 length = 0;
+
+  if (!SDL_LoadWAV(filename, &spec, &data, &length))
+    return false;
+
+  if (SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq,
+                        AUDIO_S16SYS, 1, AUDIO_OUTPUT_FREQUENCY) < 0) {
+    SDL_FreeWAV(data);
+    return false;
+  }
+
+  cvt.len = (int)length;
+  cvt.buf = malloc((size_t)length * (size_t)cvt.len_mult);
+  if (!cvt.buf) {
+    SDL_FreeWAV(data);
+    return false;
+  }
+
+  memcpy(cvt.buf, data, length);
+  SDL_FreeWAV(data);
+
+  if (SDL_ConvertAudio(&cvt) != 0) {
+    free(cvt.buf);
+    return false;
+  }
+
+  sound->samples = (int16_t*)cvt.buf;
+  sound->length = (size_t)cvt.len_cvt / sizeof(int16_t);
+  return true;
 }
 
 /* ---------------------------------------------------------------------------
@@ -96,10 +204,13 @@ void invaders_sound_write_callback(uint16_t address, uint8_t value) {
     return;
   }
 
+  /* Everything up to this cycle was mixed with the old voices */
+  audio_output_sync(cpu_6502_get_cycles());
+
   /* Bit 7: Disable all sounds */
   if (value & 0x80) {
     /* Stop everything and purge */
-    Mix_HaltChannel(-1);
+    halt_voice(-1);
     saucer_channel = -1;
     prev_value = value;
     return;
@@ -113,7 +224,7 @@ void invaders_sound_write_callback(uint16_t address, uint8_t value) {
     } else {
       /* Stop saucer, play end sound */
       if (saucer_channel >= 0) {
-        Mix_HaltChannel(saucer_channel);
+        halt_voice(saucer_channel);
         saucer_channel = -1;
       }
       play_sound(SND_SAUCEREND, 0);
@@ -164,7 +275,8 @@ void invaders_sound_reset(uint8_t bank, uint16_t address) {
   if (!invaders_sound_initialized)
     return;
 
-  Mix_HaltChannel(-1);
+  audio_output_sync(cpu_6502_get_cycles());
+  halt_voice(-1);
   saucer_channel = -1;
   heartbeat = 0;
   prev_value = 0xFF;
@@ -172,7 +284,7 @@ void invaders_sound_reset(uint8_t bank, uint16_t address) {
 }
 
 /* ---------------------------------------------------------------------------
- * Initialize SDL_mixer and load WAV files
+ * Load WAV files and join the audio output
  * --------------------------------------------------------------------------*/
 int invaders_sound_initialise(uint8_t bank, uint16_t address, uint16_t param, char* identifier) {
   (void)bank;
@@ -182,28 +294,22 @@ int invaders_sound_initialise(uint8_t bank, uint16_t address, uint16_t param, ch
   if (invaders_sound_initialized)
     return 0;
 
-  /* SDL_mixer should already be initialized by main, but check */
-  if (Mix_OpenAudio(22050, MIX_DEFAULT_FORMAT, 2, 2048) != 0) {
-    printf("Warning: Mix_OpenAudio failed: %s\n", Mix_GetError());
-    printf("         Space Invaders sound effects disabled\n");
-    return -1;
-  }
-
-  /* Allocate 8 mixing channels (one for saucer loop, rest for one-shots) */
-  Mix_AllocateChannels(8);
-
   /* Load all sound effects */
   for (int i = 0; i <= MAX_SOUNDS; i++) {
-    sounds[i] = Mix_LoadWAV(sound_files[i]);
-    if (!sounds[i]) {
+    if (!load_sound(sound_files[i], &sounds[i])) {
       printf("Warning: Failed to load %s: %s\n",
              sound_files[i],
-             Mix_GetError());
+             SDL_GetError());
       /* Continue anyway - missing sounds just won't play */
     }
   }
   system_register_memory_mapped_device(address, address, NULL, invaders_sound_write_callback, true);
 
+  /* The effects are silent, not disabled, if there is no device */
+  halt_voice(-1);
+  audio_output_add_source(render_voices);
+  audio_output_open();
+
   invaders_sound_initialized = true;
   return 0;
 }
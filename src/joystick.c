@@ -28,8 +28,8 @@ joystick_definition_t joystick_definition_table[] =
     {SDL_SCANCODE_LEFT, 0, 1, 4, 2, 1},
     {SDL_SCANCODE_RIGHT, 0, 1, 6, 0, 1}};
 
-void joystick() {
-  static uint8_t previous_joystick_keys = 0;
+// Reads the joystick keys on the UI thread, one bit per table entry
+uint8_t joystick_read_keys(void) {
   uint8_t joystick_keys = 0;
   const uint8_t* key_state = SDL_GetKeyboardState(NULL);
   int joystick_count = (int)(sizeof(joystick_definition_table) / sizeof(joystick_definition_table[0]));
@@ -40,6 +40,14 @@ void joystick() {
     }
   }
 
+  return joystick_keys;
+}
+
+// Applies keys from joystick_read_keys() to the emulated hardware
+void joystick_set_keys(uint8_t joystick_keys) {
+  static uint8_t previous_joystick_keys = 0;
+  int joystick_count = (int)(sizeof(joystick_definition_table) / sizeof(joystick_definition_table[0]));
+
   if (joystick_keys == previous_joystick_keys) {
     return;
   }
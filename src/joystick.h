@@ -2,7 +2,9 @@
 #define __JOYSTICK_H__
 
 #include <SDL.h>
+#include <stdint.h>
 
-extern bool joystick();
+extern uint8_t joystick_read_keys(void);
+extern void joystick_set_keys(uint8_t joystick_keys);
 
 #endif // __JOYSTICK_H__
@@ -11,10 +11,16 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "audio_capture.h"
+#include "audio_output.h"
 #include "colour_vdu.h"
 #include "cpu_6502.h"
+#include "cpu_trace.h"
+#include "debugger.h"
 #include "display.h"
+#include "emulation_thread.h"
 #include "eprom.h"
+#include "gdb_stub.h"
 #include "function_return_codes.h"
 #include "invaders_sound.h"
 #include "joystick.h"
@@ -22,14 +28,17 @@
 #include "menu_bar.h"
 #include "popup.h"
 #include "rtc.h"
+#include "stats_overlay.h"
 #include "system.h"
 #include "tandos.h"
 #include "via_6522.h"
 
 #define DISPLAY_SWITCH_REDRAW_FRAMES    10
 #define MICROTAN_DEFAULT_CLOCK_FREQUENCY 750000
-#define LOOP_EXECUTE_TIME_MS             20
+#define EVENT_WAIT_TIME_MS               20
 #define MICROTAN_CLOCK_OPTION_COUNT      4
+#define DEFAULT_REFRESH_RATE             60
+#define VSYNC_FAILURE_PRESENTS           30
 
 const char* SETTINGS_FILE = "microtan_settings.txt";
 
@@ -43,6 +52,14 @@ static const int MICROTAN_CLOCK_OPTIONS[MICROTAN_CLOCK_OPTION_COUNT] = {
 #define PATH_MAX 4096
 #endif
 
+// Draw the emulation pacing figures over the display
+static bool show_stats = false;
+
+// Present in step with the display refresh; vsync_active is false when the
+// renderer could not provide it
+static bool vsync_requested = false;
+static bool vsync_active = false;
+
 static bool is_supported_clock_frequency(int clock_frequency);
 
 static bool environment_value_is_set(const char* name) {
@@ -131,7 +148,8 @@ static void update_file_dialog_directory(const char* selected_file, char* output
   output[directory_length] = '\0';
 }
 
-void save_window_settings(SDL_Window* window, int cpu_clock_frequency, const char* file_dialog_directory) {
+void save_window_settings(SDL_Window* window, int cpu_clock_frequency,
+                          bool vsync, const char* file_dialog_directory) {
   int x, y, width, height;
   SDL_GetWindowSize(window, &width, &height);
   SDL_GetWindowPosition(window, &x, &y);
@@ -139,10 +157,11 @@ void save_window_settings(SDL_Window* window, int cpu_clock_frequency, const cha
 
   if (file) {
     const char* save_directory = (file_dialog_directory && (*file_dialog_directory != '\0')) ? file_dialog_directory : ".";
-    fprintf(file, "%d %d %d %d %d %d %d %lld\n%s\n",
+    fprintf(file, "%d %d %d %d %d %d %d %lld %d\n%s\n",
             x, y, width, height, (int)display_get_hires_mode(),
             cpu_clock_frequency, colour_vdu_get_enabled() ? 1 : 0,
-            (long long)rtc_get_offset_seconds(), save_directory);
+            (long long)rtc_get_offset_seconds(), vsync ? 1 : 0,
+            save_directory);
     tandos_save_settings(file);
     fclose(file);
   }
@@ -151,7 +170,7 @@ void save_window_settings(SDL_Window* window, int cpu_clock_frequency, const cha
 void load_window_settings(int* x, int* y, int* width, int* height,
                           display_hires_mode_t* display_mode,
                           int* cpu_clock_frequency, bool* colour_vdu_enabled,
-                          char* file_dialog_directory,
+                          bool* vsync, char* file_dialog_directory,
                           size_t file_dialog_directory_size) {
   FILE* file = fopen(SETTINGS_FILE, "r");
   char geometry_line[256];
@@ -159,6 +178,7 @@ void load_window_settings(int* x, int* y, int* width, int* height,
   *display_mode = DISPLAY_HIRES_MODE_NONE;
   *cpu_clock_frequency = MICROTAN_DEFAULT_CLOCK_FREQUENCY;
   *colour_vdu_enabled = false;
+  *vsync = false;
   choose_default_file_directory(file_dialog_directory, file_dialog_directory_size);
   rtc_set_offset_seconds(0);
 
@@ -167,13 +187,14 @@ void load_window_settings(int* x, int* y, int* width, int* height,
     int cpu_clock_frequency_raw = MICROTAN_DEFAULT_CLOCK_FREQUENCY;
     int colour_vdu_enabled_raw = 0;
     long long rtc_offset_seconds_raw = 0;
+    int vsync_raw = 0;
     int values_read = 0;
 
     if (fgets(geometry_line, sizeof(geometry_line), file) != NULL) {
-      values_read = sscanf(geometry_line, "%d %d %d %d %d %d %d %lld",
+      values_read = sscanf(geometry_line, "%d %d %d %d %d %d %d %lld %d",
                            x, y, width, height, &display_mode_raw,
                            &cpu_clock_frequency_raw, &colour_vdu_enabled_raw,
-                           &rtc_offset_seconds_raw);
+                           &rtc_offset_seconds_raw, &vsync_raw);
     }
 
     if (values_read < 4) {
@@ -194,6 +215,9 @@ void load_window_settings(int* x, int* y, int* width, int* height,
     if (values_read >= 8) {
       rtc_set_offset_seconds((int64_t)rtc_offset_seconds_raw);
     }
+    if (values_read >= 9) {
+      *vsync = vsync_raw != 0;
+    }
 
     // Optional persisted file-dialog directory line.
     if (fgets(path_line, sizeof(path_line), file) != NULL) {
@@ -307,11 +331,8 @@ static bool parse_hex_range(const char* text, uint16_t* start, uint16_t* end) {
 }
 
 static void integer_scaled_display_size(int requested_height,
+                                        int native_width, int native_height,
                                         int* width, int* height) {
-  int native_width;
-  int native_height;
-  display_get_render_size(&native_width, &native_height);
-
   int requested_display_height = requested_height - MENU_BAR_HEIGHT;
   int scale = (requested_display_height + native_height / 2) / native_height;
   if (scale < 2) {
@@ -323,19 +344,56 @@ static void integer_scaled_display_size(int requested_height,
 }
 
 static void resize_window_to_integer_scale(SDL_Window* window,
-                                           int requested_height) {
+                                           int requested_height,
+                                           int native_width,
+                                           int native_height) {
   int width;
   int height;
   int target_width;
   int target_height;
   SDL_GetWindowSize(window, &width, &height);
-  integer_scaled_display_size(requested_height, &target_width, &target_height);
+  integer_scaled_display_size(requested_height, native_width, native_height,
+                              &target_width, &target_height);
 
   if ((width != target_width) || (height != target_height)) {
     SDL_SetWindowSize(window, target_width, target_height);
   }
 }
 
+static int64_t monotonic_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Nominal refresh period of the display showing the window
+static int64_t display_refresh_interval(SDL_Window* window) {
+  SDL_DisplayMode mode;
+  int display_index = SDL_GetWindowDisplayIndex(window);
+
+  if ((display_index >= 0) &&
+      (SDL_GetCurrentDisplayMode(display_index, &mode) == 0) &&
+      (mode.refresh_rate > 0)) {
+    return 1000000000LL / mode.refresh_rate;
+  }
+  return 1000000000LL / DEFAULT_REFRESH_RATE;
+}
+
+// Switches vsync on the renderer and tells the emulation thread to pace from
+// presents or from its own clock. Returns whether vsync is in effect.
+static bool apply_vsync(SDL_Renderer* renderer, SDL_Window* window,
+                        bool enabled, int64_t* refresh_interval) {
+  if ((SDL_RenderSetVSync(renderer, enabled ? 1 : 0) != 0) && enabled) {
+    printf("VSync unavailable, pacing from the system clock: %s\r\n",
+           SDL_GetError());
+    enabled = false;
+  }
+
+  *refresh_interval = display_refresh_interval(window);
+  emulation_thread_set_vsync(enabled, *refresh_interval);
+  return enabled;
+}
+
 static bool is_supported_clock_frequency(int clock_frequency) {
   for (int i = 0; i < MICROTAN_CLOCK_OPTION_COUNT; i++) {
     if (MICROTAN_CLOCK_OPTIONS[i] == clock_frequency) {
@@ -361,12 +419,14 @@ typedef enum {
   MENU_COMMAND_LOAD_PROGRAM = 1,
   MENU_COMMAND_SAVE_SNAPSHOT,
   MENU_COMMAND_EXPORT_HEX,
+  MENU_COMMAND_RECORD_AUDIO,
   MENU_COMMAND_QUIT,
   MENU_COMMAND_RESET = 10,
   MENU_COMMAND_CLOCK_750KHZ,
   MENU_COMMAND_CLOCK_1_5MHZ,
   MENU_COMMAND_CLOCK_3MHZ,
   MENU_COMMAND_CLOCK_6MHZ,
+  MENU_COMMAND_CYCLE_EXACT,
   MENU_COMMAND_TANDOS_TOGGLE = 20,
   MENU_COMMAND_DISK_UNIT_0,
   MENU_COMMAND_DISK_UNIT_1,
@@ -383,18 +443,26 @@ typedef enum {
   MENU_COMMAND_DISPLAY_GPU,
   MENU_COMMAND_DISPLAY_COLOUR_VDU,
   MENU_COMMAND_COLOUR_VDU_TOGGLE,
+  MENU_COMMAND_DISPLAY_STATS,
+  MENU_COMMAND_DISPLAY_VSYNC,
   MENU_COMMAND_INPUT_ASCII = 50,
   MENU_COMMAND_INPUT_HEX,
-  MENU_COMMAND_HELP = 60
+  MENU_COMMAND_DEBUG_CONTINUE = 60,
+  MENU_COMMAND_DEBUG_STEP,
+  MENU_COMMAND_DEBUG_CLEAR,
+  MENU_COMMAND_TRACE_TOGGLE,
+  MENU_COMMAND_TRACE_DUMP,
+  MENU_COMMAND_HELP = 70
 } application_menu_command_t;
 
 typedef struct {
-  menu_bar_menu_t menus[6];
-  menu_bar_item_t file_items[5];
-  menu_bar_item_t system_items[6];
+  menu_bar_menu_t menus[7];
+  menu_bar_item_t file_items[6];
+  menu_bar_item_t system_items[8];
   menu_bar_item_t disk_items[13];
-  menu_bar_item_t display_items[6];
+  menu_bar_item_t display_items[9];
   menu_bar_item_t input_items[2];
+  menu_bar_item_t debug_items[6];
   menu_bar_item_t help_items[1];
   char tandos_toggle_label[32];
   char disk_labels[TANDOS_UNIT_COUNT][160];
@@ -418,8 +486,12 @@ static void build_application_menu(application_menu_model_t* model,
                                    MENU_COMMAND_SAVE_SNAPSHOT, true, false);
   model->file_items[2] = menu_item("Export Intel HEX...", NULL,
                                    MENU_COMMAND_EXPORT_HEX, true, false);
-  model->file_items[3] = menu_separator();
-  model->file_items[4] = menu_item("Quit", NULL, MENU_COMMAND_QUIT, true, false);
+  model->file_items[3] = menu_item(audio_capture_is_active()
+                                     ? "Stop recording audio"
+                                     : "Record audio...", NULL,
+                                   MENU_COMMAND_RECORD_AUDIO, true, false);
+  model->file_items[4] = menu_separator();
+  model->file_items[5] = menu_item("Quit", NULL, MENU_COMMAND_QUIT, true, false);
 
   model->system_items[0] = menu_item("Reset", "F5", MENU_COMMAND_RESET,
                                      true, false);
@@ -436,6 +508,10 @@ static void build_application_menu(application_menu_model_t* model,
   model->system_items[5] = menu_item("6 MHz", NULL,
                                      MENU_COMMAND_CLOCK_6MHZ, true,
                                      cpu_clock_frequency == 6000000);
+  model->system_items[6] = menu_separator();
+  model->system_items[7] = menu_item("Cycle-exact CPU", NULL,
+                                     MENU_COMMAND_CYCLE_EXACT, true,
+                                     cpu_6502_get_cycle_exact());
 
   snprintf(model->tandos_toggle_label, sizeof(model->tandos_toggle_label),
            "%s TANDOS card", tandos_get_enabled() ? "Disable" : "Enable");
@@ -483,6 +559,13 @@ static void build_application_menu(application_menu_model_t* model,
   model->display_items[5] = menu_item(model->colour_vdu_toggle_label, NULL,
                                       MENU_COMMAND_COLOUR_VDU_TOGGLE,
                                       true, false);
+  model->display_items[6] = menu_separator();
+  model->display_items[7] = menu_item("Sync to display refresh", NULL,
+                                      MENU_COMMAND_DISPLAY_VSYNC, true,
+                                      vsync_requested);
+  model->display_items[8] = menu_item("Performance statistics", "F8",
+                                      MENU_COMMAND_DISPLAY_STATS, true,
+                                      show_stats);
 
   model->input_items[0] = menu_item("ASCII keyboard", "F3",
                                     MENU_COMMAND_INPUT_ASCII, true,
@@ -490,15 +573,31 @@ static void build_application_menu(application_menu_model_t* model,
   model->input_items[1] = menu_item("Hex keypad", "F2",
                                     MENU_COMMAND_INPUT_HEX, true,
                                     keyboard_using_hex_keypad());
+  model->debug_items[0] = menu_item("Continue", "F6",
+                                    MENU_COMMAND_DEBUG_CONTINUE,
+                                    debugger_is_stopped(), false);
+  model->debug_items[1] = menu_item("Step instruction", "F7",
+                                    MENU_COMMAND_DEBUG_STEP, true, false);
+  model->debug_items[2] = menu_item("Clear breakpoints and watchpoints", NULL,
+                                    MENU_COMMAND_DEBUG_CLEAR, true, false);
+  model->debug_items[3] = menu_separator();
+  model->debug_items[4] = menu_item("Instruction trace", NULL,
+                                    MENU_COMMAND_TRACE_TOGGLE, true,
+                                    cpu_trace_enabled);
+  model->debug_items[5] = menu_item("Dump instruction trace", NULL,
+                                    MENU_COMMAND_TRACE_DUMP,
+                                    cpu_trace_enabled, false);
+
   model->help_items[0] = menu_item("Keyboard shortcuts", NULL,
                                    MENU_COMMAND_HELP, true, false);
 
-  model->menus[0] = (menu_bar_menu_t){"File", model->file_items, 5};
-  model->menus[1] = (menu_bar_menu_t){"System", model->system_items, 6};
+  model->menus[0] = (menu_bar_menu_t){"File", model->file_items, 6};
+  model->menus[1] = (menu_bar_menu_t){"System", model->system_items, 8};
   model->menus[2] = (menu_bar_menu_t){"Disks", model->disk_items, 13};
-  model->menus[3] = (menu_bar_menu_t){"Display", model->display_items, 6};
+  model->menus[3] = (menu_bar_menu_t){"Display", model->display_items, 9};
   model->menus[4] = (menu_bar_menu_t){"Input", model->input_items, 2};
-  model->menus[5] = (menu_bar_menu_t){"Help", model->help_items, 1};
+  model->menus[5] = (menu_bar_menu_t){"Debug", model->debug_items, 6};
+  model->menus[6] = (menu_bar_menu_t){"Help", model->help_items, 1};
 }
 
 static void show_disk_unit_menu(SDL_Renderer* renderer, int unit,
@@ -577,8 +676,13 @@ static void create_blank_disk(SDL_Renderer* renderer,
 
   int tracks;
   int sectors;
-  if ((sscanf(geometry, "%d,%d", &tracks, &sectors) != 2) ||
-      (tandos_create_image(file_name, tracks, sectors) != RV_OK)) {
+  int rv = RV_INVALID_FILE;
+  if (sscanf(geometry, "%d,%d", &tracks, &sectors) == 2) {
+    rv = tandos_create_image(file_name, tracks, sectors);
+  }
+  if (rv == RV_FILE_IN_USE) {
+    popup_show(renderer, "That disk image is mounted. Eject it first.");
+  } else if (rv != RV_OK) {
     popup_show(renderer, "Unable to create disk. Example geometry: 80,10");
   } else {
     popup_show(renderer,
@@ -686,6 +790,26 @@ static void execute_application_menu_command(
       break;
     }
 
+    case MENU_COMMAND_RECORD_AUDIO: {
+      if (audio_capture_is_active()) {
+        audio_capture_stop();
+        popup_show(renderer, "Audio recording saved.");
+        break;
+      }
+      const char* extensions[] = {".wav"};
+      char file_name[PATH_MAX];
+      if (popup_file_select(renderer, "Record Audio", file_dialog_directory,
+                            extensions, 1, true, "recording.wav", file_name,
+                            sizeof(file_name))) {
+        update_file_dialog_directory(file_name, file_dialog_directory,
+                                     file_dialog_directory_size);
+        if (audio_capture_start(file_name) != RV_OK) {
+          popup_show(renderer, "Recording failed. See terminal output for details.");
+        }
+      }
+      break;
+    }
+
     case MENU_COMMAND_QUIT:
       *is_running = false;
       break;
@@ -700,6 +824,38 @@ static void execute_application_menu_command(
     case MENU_COMMAND_CLOCK_6MHZ:
       *cpu_clock_frequency = MICROTAN_CLOCK_OPTIONS[
         command - MENU_COMMAND_CLOCK_750KHZ];
+      colour_vdu_set_clock_frequency(*cpu_clock_frequency);
+      audio_output_set_clock_frequency(*cpu_clock_frequency);
+      break;
+
+    case MENU_COMMAND_CYCLE_EXACT:
+      cpu_6502_set_cycle_exact(!cpu_6502_get_cycle_exact());
+      break;
+
+    case MENU_COMMAND_TRACE_TOGGLE:
+      if (cpu_trace_enabled) {
+        cpu_trace_stop();
+      } else if (cpu_trace_start(CPU_TRACE_DEFAULT_INSTRUCTIONS) == RV_OK) {
+        cpu_trace_dump_on_crash(CPU_TRACE_FILENAME);
+      }
+      break;
+
+    case MENU_COMMAND_TRACE_DUMP:
+      if (cpu_trace_dump(CPU_TRACE_FILENAME) != RV_OK) {
+        popup_show(renderer, "Unable to write " CPU_TRACE_FILENAME);
+      }
+      break;
+
+    case MENU_COMMAND_DEBUG_CONTINUE:
+      debugger_continue();
+      break;
+
+    case MENU_COMMAND_DEBUG_STEP:
+      debugger_step();
+      break;
+
+    case MENU_COMMAND_DEBUG_CLEAR:
+      debugger_clear_all();
       break;
 
     case MENU_COMMAND_TANDOS_TOGGLE:
@@ -728,6 +884,15 @@ static void execute_application_menu_command(
       break;
     }
 
+    case MENU_COMMAND_DISPLAY_STATS:
+      show_stats = !show_stats;
+      break;
+
+    case MENU_COMMAND_DISPLAY_VSYNC:
+      // Applied by the main loop, which owns the window
+      vsync_requested = !vsync_requested;
+      break;
+
     case MENU_COMMAND_INPUT_ASCII:
       keyboard_use_hex_keypad(false);
       break;
@@ -743,6 +908,9 @@ static void execute_application_menu_command(
                  "F2: Select hex keypad input\n"
                  "F3: Select ASCII keyboard input\n"
                  "F5: Reset system\n"
+                 "F6: Continue after a breakpoint\n"
+                 "F7: Step one instruction\n"
+                 "F8: Show performance statistics\n"
                  "Ctrl+A to Ctrl+Z: send control characters\n"
                  "Backspace: send Microtan delete");
       break;
@@ -752,6 +920,81 @@ static void execute_application_menu_command(
   }
   *display_overwritten = true;
 }
+// --break=ADDR, address in hex with an optional leading '$'
+static bool parse_breakpoint_option(const char* text) {
+  char* end;
+
+  if (*text == '$') {
+    text++;
+  }
+
+  unsigned long address = strtoul(text, &end, 16);
+
+  if ((end == text) || (*end != '\0') || (address > 0xffff)) {
+    return false;
+  }
+
+  return debugger_add_breakpoint((int)address, NULL) == RV_OK;
+}
+
+// --watch=START[-END][:r|w|a], addresses in hex, default type is write
+static bool parse_watchpoint_option(const char* text) {
+  debugger_watch_type_t type = DEBUGGER_WATCH_WRITE;
+  char* end;
+
+  if (*text == '$') {
+    text++;
+  }
+
+  unsigned long start = strtoul(text, &end, 16);
+  unsigned long last = start;
+
+  if (end == text) {
+    return false;
+  }
+
+  if (*end == '-') {
+    text = end + 1;
+
+    if (*text == '$') {
+      text++;
+    }
+
+    last = strtoul(text, &end, 16);
+
+    if (end == text) {
+      return false;
+    }
+  }
+
+  if (*end == ':') {
+    switch (end[1]) {
+      case 'r':
+        type = DEBUGGER_WATCH_READ;
+        break;
+
+      case 'w':
+        type = DEBUGGER_WATCH_WRITE;
+        break;
+
+      case 'a':
+        type = DEBUGGER_WATCH_ACCESS;
+        break;
+
+      default:
+        return false;
+    }
+
+    end += 2;
+  }
+
+  if ((*end != '\0') || (last > 0xffff) || (start > last)) {
+    return false;
+  }
+
+  return debugger_add_watchpoint((uint16_t)start, (uint16_t)last, type) == RV_OK;
+}
+
 int main(int argc, char* argv[]) {
   if (system_initialise() != RV_OK) {
     return 0;
@@ -767,17 +1010,58 @@ int main(int argc, char* argv[]) {
   char file_dialog_directory[PATH_MAX];
   load_window_settings(&x, &y, &width, &height, &saved_display_mode,
                        &cpu_clock_frequency, &saved_colour_vdu_enabled,
+                       &vsync_requested,
                        file_dialog_directory, sizeof(file_dialog_directory));
+  colour_vdu_set_clock_frequency(cpu_clock_frequency);
+  audio_output_set_clock_frequency(cpu_clock_frequency);
   colour_vdu_set_enabled(saved_colour_vdu_enabled);
   display_set_hires_mode(saved_display_mode);
   system_reset();
 
-  if (argc > 1) {
-    if (system_load_program_file(argv[1]) != RV_OK) {
-      printf("Failed to load [%s]\r\n", argv[1]);
+  char* program_file_name = NULL;
+  for (int arg = 1; arg < argc; arg++) {
+    if (strcmp(argv[arg], "--cycle-exact") == 0) {
+      cpu_6502_set_cycle_exact(true);
+    } else if (strcmp(argv[arg], "--cpu=6502") == 0) {
+      cpu_6502_set_variant(CPU_6502_VARIANT_NMOS);
+    } else if (strcmp(argv[arg], "--cpu=65c02") == 0) {
+      cpu_6502_set_variant(CPU_6502_VARIANT_65C02);
+    } else if ((strcmp(argv[arg], "--trace") == 0) || (strncmp(argv[arg], "--trace=", 8) == 0)) {
+      size_t instructions = CPU_TRACE_DEFAULT_INSTRUCTIONS;
+      if (argv[arg][7] == '=') {
+        unsigned long millions = strtoul(argv[arg] + 8, NULL, 10);
+        instructions = (millions > SIZE_MAX / 1000000) ? SIZE_MAX : (size_t)millions * 1000000;
+      }
+      if (cpu_trace_start(instructions) == RV_OK) {
+        cpu_trace_dump_on_crash(CPU_TRACE_FILENAME);
+      }
+    } else if (strncmp(argv[arg], "--break=", 8) == 0) {
+      if (!parse_breakpoint_option(argv[arg] + 8)) {
+        printf("Invalid breakpoint [%s]\r\n", argv[arg]);
+      }
+    } else if (strncmp(argv[arg], "--watch=", 8) == 0) {
+      if (!parse_watchpoint_option(argv[arg] + 8)) {
+        printf("Invalid watchpoint [%s]\r\n", argv[arg]);
+      }
+    } else if (strncmp(argv[arg], "--gdb=", 6) == 0) {
+      gdb_stub_start(argv[arg] + 6);
+    } else if (strncmp(argv[arg], "--audio-buffer=", 15) == 0) {
+      audio_output_set_buffer_size(atoi(argv[arg] + 15));
+    } else if (strncmp(argv[arg], "--record-audio=", 15) == 0) {
+      audio_capture_start(argv[arg] + 15);
+    } else if (strncmp(argv[arg], "--", 2) == 0) {
+      printf("Unknown option [%s]\r\n", argv[arg]);
+    } else {
+      program_file_name = argv[arg];
+    }
+  }
+
+  if (program_file_name) {
+    if (system_load_program_file(program_file_name) != RV_OK) {
+      printf("Failed to load [%s]\r\n", program_file_name);
     }
 
-    if (strstr(argv[1], "berzerk") != NULL) {
+    if (strstr(program_file_name, "berzerk") != NULL) {
       keyboard_use_hex_keypad(true);
     }
   }
@@ -800,15 +1084,21 @@ int main(int argc, char* argv[]) {
   }
   if (video_initialise_result != 0) {
     fprintf(stderr, "Unable to initialise SDL video: %s\n", SDL_GetError());
+    audio_capture_stop();
     system_close();
     SDL_Quit();
     return 1;
   }
 
-  integer_scaled_display_size(height, &width, &height);
+  int native_width;
+  int native_height;
+  display_get_render_size(&native_width, &native_height);
+  integer_scaled_display_size(height, native_width, native_height,
+                              &width, &height);
   SDL_Window* window = SDL_CreateWindow("Microtan 65", x, y, width, height, SDL_WINDOW_RESIZABLE);
   if (!window) {
     fprintf(stderr, "Unable to create SDL window: %s\n", SDL_GetError());
+    audio_capture_stop();
     system_close();
     SDL_Quit();
     return 1;
@@ -829,6 +1119,7 @@ int main(int argc, char* argv[]) {
   if (!renderer) {
     fprintf(stderr, "Unable to create SDL renderer: %s\n", SDL_GetError());
     SDL_DestroyWindow(window);
+    audio_capture_stop();
     system_close();
     SDL_Quit();
     return 1;
@@ -838,6 +1129,7 @@ int main(int argc, char* argv[]) {
     fprintf(stderr, "Unable to initialise menu bar.\n");
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
+    audio_capture_stop();
     system_close();
     SDL_Quit();
     return 1;
@@ -850,40 +1142,232 @@ int main(int argc, char* argv[]) {
   display_get_render_size(&render_width, &render_height);
   SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, render_width, render_height);
   SDL_Texture* scanlines = create_scanline_texture(renderer, render_width, render_height);
+  // Layers are composited by the renderer; the pixel array and texture are
+  // the software fallback
+  display_layers_initialise(renderer);
+  SDL_Texture* display_texture = texture;
   uint32_t pixels[COLOUR_VDU_WIDTH * DISPLAY_HEIGHT];
+
+  // From here on the machine belongs to the emulation thread; the UI thread
+  // only touches it between emulation_thread_lock() and _unlock()
+  if (emulation_thread_start(cpu_clock_frequency) != RV_OK) {
+    menu_bar_close(&menu_bar);
+    display_layers_close();
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    audio_capture_stop();
+    system_close();
+    SDL_Quit();
+    return 1;
+  }
+  const uint32_t frame_event = emulation_thread_frame_event();
+  int64_t refresh_interval = display_refresh_interval(window);
+  int64_t last_present = 0;
+  int nonblocking_presents = 0;
+  if (vsync_requested) {
+    vsync_active = apply_vsync(renderer, window, true, &refresh_interval);
+  }
+  bool vsync_applied = vsync_requested;
+  const display_frame_t* frame = NULL;
+  display_hires_mode_t frame_mode = display_get_hires_mode();
+  uint8_t joystick_keys = 0;
+  emulation_stats_t stats = {0};
   bool is_running = true;
   SDL_Event event;
-  struct timespec start_time;
-  struct timespec end_time;
-  struct timespec sleep_time;
   bool display_overwritten = true;
   int forced_redraw_frames = 0;
 
   while (is_running) {
-    clock_gettime(CLOCK_MONOTONIC, &start_time);
-    // Execute LOOP_EXECUTE_TIME_MS's worth of instructions
-    cpu_6502_execute(cpu_clock_frequency * LOOP_EXECUTE_TIME_MS / 1000);
-
-    if (colour_vdu_get_enabled() && colour_vdu_output_changed_event()) {
-      display_set_hires_mode(colour_vdu_output_selected()
-        ? DISPLAY_HIRES_MODE_COLOUR_VDU
-        : DISPLAY_HIRES_MODE_NONE);
-      display_overwritten = true;
-      forced_redraw_frames = DISPLAY_SWITCH_REDRAW_FRAMES;
+    bool menu_changed = false;
+
+    // Sleep until there is a frame or input to deal with. The timeout keeps
+    // the joystick and forced redraws going when neither arrives.
+    bool have_event = SDL_WaitEventTimeout(&event, EVENT_WAIT_TIME_MS);
+    while (have_event) {
+      int menu_command = MENU_BAR_SEPARATOR_COMMAND;
+      if (event.type == frame_event) {
+        // Collected below
+      } else if (menu_bar_handle_event(&menu_bar, renderer, &event,
+                                       menu_model.menus, 7, &menu_command)) {
+        display_overwritten = true;
+        menu_changed = true;
+        if (menu_command != MENU_BAR_SEPARATOR_COMMAND) {
+          emulation_thread_lock();
+          execute_application_menu_command(
+            renderer, menu_command, &is_running, &display_overwritten,
+            &cpu_clock_frequency, file_dialog_directory,
+            sizeof(file_dialog_directory));
+          emulation_thread_set_clock_frequency(cpu_clock_frequency);
+          emulation_thread_unlock();
+          emulation_thread_request_frame();
+        }
+      } else {
+        switch (event.type) {
+          case SDL_QUIT:
+            is_running = false;
+            break;
+
+          case SDL_WINDOWEVENT:
+            switch (event.window.event) {
+              case SDL_WINDOWEVENT_MOVED:
+              case SDL_WINDOWEVENT_DISPLAY_CHANGED:
+                // The window may now be on a display with another refresh
+                if (vsync_active) {
+                  vsync_active = apply_vsync(renderer, window, true,
+                                             &refresh_interval);
+                }
+                break;
+
+              case SDL_WINDOWEVENT_SIZE_CHANGED:
+              case SDL_WINDOWEVENT_RESIZED: {
+                resize_window_to_integer_scale(window, event.window.data2,
+                                               render_width, render_height);
+
+                SDL_RenderClear(renderer);
+                int width, height;
+                SDL_GetWindowSize(window, &width, &height);
+                SDL_Rect dest_rect = {0, MENU_BAR_HEIGHT, width,
+                                      height - MENU_BAR_HEIGHT};
+                SDL_RenderCopy(renderer, display_texture, NULL, &dest_rect);
+                SDL_RenderCopy(renderer, scanlines, NULL, &dest_rect);
+                menu_bar_render(renderer, &menu_bar, menu_model.menus, 7);
+                SDL_RenderPresent(renderer);
+                display_overwritten = true;
+                forced_redraw_frames = DISPLAY_SWITCH_REDRAW_FRAMES;
+                break;
+              }
+            }
+
+            break;
+
+          case SDL_RENDER_TARGETS_RESET:
+            // The renderer dropped the contents of its textures
+            display_layers_invalidate();
+            display_overwritten = true;
+            break;
+
+          case SDL_RENDER_DEVICE_RESET:
+            // Every texture is gone, including the cached menu labels
+            menu_bar_flush_text_cache();
+            stats_overlay_close();
+            display_layers_invalidate();
+            display_overwritten = true;
+            break;
+
+          case SDL_TEXTINPUT: {
+            char* ascii_value = event.text.text;
+
+            while (*ascii_value) {
+              // Microtan requires capitals for all commands, so swap upper/lower case for convenience
+              uint8_t key = (uint8_t)*ascii_value;
+
+              if (((key >= 'A') && (key <= 'Z')) || ((key >= 'a') && (key <= 'z'))) {
+                key ^= 0x20;
+              }
+
+              emulation_thread_send_input(EMULATION_INPUT_KEYPRESS, key);
+              ascii_value++;
+            }
+          } break;
+
+          case SDL_KEYDOWN: {
+            SDL_KeyCode keycode = event.key.keysym.sym;
+
+            if (keycode == SDLK_F2) {
+              emulation_thread_send_input(EMULATION_INPUT_HEX_KEYPAD, true);
+              menu_changed = true;
+            } else if (keycode == SDLK_F3) {
+              emulation_thread_send_input(EMULATION_INPUT_HEX_KEYPAD, false);
+              menu_changed = true;
+            } else if (keycode == SDLK_F5) {
+              emulation_thread_send_input(EMULATION_INPUT_RESET, 0);
+            } else if (keycode == SDLK_F6) {
+              emulation_thread_send_input(EMULATION_INPUT_DEBUG_CONTINUE, 0);
+              menu_changed = true;
+            } else if (keycode == SDLK_F7) {
+              emulation_thread_send_input(EMULATION_INPUT_DEBUG_STEP, 0);
+              menu_changed = true;
+            } else if (keycode == SDLK_F8) {
+              show_stats = !show_stats;
+              display_overwritten = true;
+              menu_changed = true;
+            } else {
+              if (keycode == SDLK_KP_ENTER) {
+                keycode = 0x0a;
+              } else if ((SDL_GetModState() & KMOD_CTRL) && (keycode >= 'a') && (keycode <= 'z')) {
+                keycode -= 0x60;
+              } else if ((SDL_GetModState() & KMOD_CTRL) && (keycode >= 'A') && (keycode <= 'Z')) {
+                keycode -= 0x40;
+              } else if (keycode == 0x08) {
+                keycode = 0x7f;
+              }
+
+              if ((keycode < ' ') || (keycode == 0x7f)) {
+                emulation_thread_send_input(EMULATION_INPUT_KEYPRESS, (uint8_t)keycode);
+              }
+            }
+          } break;
+        } // SDL event switch
+      }
+
+      have_event = SDL_PollEvent(&event);
+    }   // SDL event loop
+
+    // via_6522_print_regs();
+    uint8_t new_joystick_keys = joystick_read_keys();
+    if ((new_joystick_keys != joystick_keys) &&
+        emulation_thread_send_input(EMULATION_INPUT_JOYSTICK, new_joystick_keys)) {
+      joystick_keys = new_joystick_keys;
     }
 
-    build_application_menu(&menu_model, cpu_clock_frequency);
+    const display_frame_t* new_frame = emulation_thread_acquire_frame();
+    if (NULL != new_frame) {
+      frame = new_frame;
+      if (frame->mode != frame_mode) {
+        frame_mode = frame->mode;
+        display_overwritten = true;
+        forced_redraw_frames = DISPLAY_SWITCH_REDRAW_FRAMES;
+      }
+      // The breakpoint and keypad ticks can change from the emulation side,
+      // but only an open dropdown shows them
+      if (menu_bar.active_menu >= 0) {
+        menu_changed = true;
+      }
+    }
+
+    // The figures change once a second; redraw to show them
+    if (show_stats) {
+      emulation_stats_t new_stats;
+      emulation_thread_get_stats(&new_stats);
+      if (memcmp(&new_stats, &stats, sizeof(stats)) != 0) {
+        stats = new_stats;
+        display_overwritten = true;
+      }
+    }
+
+    if (vsync_applied != vsync_requested) {
+      vsync_applied = vsync_requested;
+      vsync_active = apply_vsync(renderer, window, vsync_requested,
+                                 &refresh_interval);
+      nonblocking_presents = 0;
+    }
 
-    // If the display has been updated, re-render the window
-    bool colour_vdu_updated = colour_vdu_updated_event();
-    if ((display_updated_event()) ||
-        ((display_get_hires_mode() == DISPLAY_HIRES_MODE_COLOUR_VDU) && colour_vdu_updated) ||
-        (forced_redraw_frames > 0) ||
-        (display_overwritten)) {
+    if (menu_changed) {
+      emulation_thread_lock();
+      build_application_menu(&menu_model, cpu_clock_frequency);
+      emulation_thread_unlock();
+    }
+
+    // Present a newly published frame, or the last one again when the window
+    // contents were lost
+    if ((NULL != frame) &&
+        ((NULL != new_frame) ||
+         (forced_redraw_frames > 0) ||
+         (display_overwritten))) {
       display_overwritten = false;
       int required_width;
       int required_height;
-      display_get_render_size(&required_width, &required_height);
+      display_get_frame_size(frame, &required_width, &required_height);
       if ((required_width != render_width) || (required_height != render_height)) {
         SDL_DestroyTexture(texture);
         SDL_DestroyTexture(scanlines);
@@ -895,125 +1379,63 @@ int main(int argc, char* argv[]) {
         scanlines = create_scanline_texture(renderer, render_width, render_height);
 
         SDL_GetWindowSize(window, &width, &height);
-        resize_window_to_integer_scale(window, height);
+        resize_window_to_integer_scale(window, height, render_width, render_height);
         forced_redraw_frames = DISPLAY_SWITCH_REDRAW_FRAMES;
       }
-      display_render(pixels);
-      SDL_UpdateTexture(texture, NULL, pixels, render_width * sizeof(Uint32));
+      display_texture = display_layers_compose(frame);
+      if (NULL == display_texture) {
+        display_render_frame(frame, pixels);
+        SDL_UpdateTexture(texture, NULL, pixels, render_width * sizeof(Uint32));
+        display_texture = texture;
+      }
       SDL_RenderClear(renderer);
       SDL_GetWindowSize(window, &width, &height);
       SDL_Rect dest_rect = {0, MENU_BAR_HEIGHT, width,
                             height - MENU_BAR_HEIGHT};
-      SDL_RenderCopy(renderer, texture, NULL, &dest_rect);
+      SDL_RenderCopy(renderer, display_texture, NULL, &dest_rect);
       SDL_RenderCopy(renderer, scanlines, NULL, &dest_rect);
-      menu_bar_render(renderer, &menu_bar, menu_model.menus, 6);
-      SDL_RenderPresent(renderer);
-      if (forced_redraw_frames > 0) {
-        forced_redraw_frames--;
+      if (show_stats) {
+        stats_overlay_render(renderer, menu_bar.font, &dest_rect, &stats);
       }
-    }
+      menu_bar_render(renderer, &menu_bar, menu_model.menus, 7);
+      SDL_RenderPresent(renderer);
 
-    while (SDL_PollEvent(&event)) {
-      int menu_command = MENU_BAR_SEPARATOR_COMMAND;
-      if (menu_bar_handle_event(&menu_bar, renderer, &event,
-                                menu_model.menus, 6, &menu_command)) {
-        display_overwritten = true;
-        if (menu_command != MENU_BAR_SEPARATOR_COMMAND) {
-          execute_application_menu_command(
-            renderer, menu_command, &is_running, &display_overwritten,
-            &cpu_clock_frequency, file_dialog_directory,
-            sizeof(file_dialog_directory));
-          build_application_menu(&menu_model, cpu_clock_frequency);
+      if (vsync_active) {
+        // Refine the refresh period from presents that waited for one
+        // vblank, and give up on vsync if presents stop waiting at all
+        int64_t presented = monotonic_ns();
+        int64_t interval = presented - last_present;
+        last_present = presented;
+        if ((interval > refresh_interval / 2) &&
+            (interval < refresh_interval * 3 / 2)) {
+          refresh_interval += (interval - refresh_interval) / 16;
+          nonblocking_presents = 0;
+        } else if ((interval < refresh_interval / 4) &&
+                   (++nonblocking_presents >= VSYNC_FAILURE_PRESENTS)) {
+          printf("VSync is not blocking, pacing from the system clock\r\n");
+          vsync_active = apply_vsync(renderer, window, false,
+                                     &refresh_interval);
+        }
+        if (vsync_active) {
+          emulation_thread_vsync_presented(refresh_interval);
         }
-        continue;
       }
 
-      switch (event.type) {
-        case SDL_QUIT:
-          is_running = false;
-          break;
-
-        case SDL_WINDOWEVENT:
-          switch (event.window.event) {
-            case SDL_WINDOWEVENT_SIZE_CHANGED:
-            case SDL_WINDOWEVENT_RESIZED: {
-              resize_window_to_integer_scale(window, event.window.data2);
-
-              SDL_RenderClear(renderer);
-              int width, height;
-              SDL_GetWindowSize(window, &width, &height);
-              SDL_Rect dest_rect = {0, MENU_BAR_HEIGHT, width,
-                                    height - MENU_BAR_HEIGHT};
-              SDL_RenderCopy(renderer, texture, NULL, &dest_rect);
-              SDL_RenderCopy(renderer, scanlines, NULL, &dest_rect);
-              menu_bar_render(renderer, &menu_bar, menu_model.menus, 6);
-              SDL_RenderPresent(renderer);
-              display_overwritten = true;
-              forced_redraw_frames = DISPLAY_SWITCH_REDRAW_FRAMES;
-              break;
-            }
-          }
-
-          break;
-
-        case SDL_TEXTINPUT: {
-          char* ascii_value = event.text.text;
-
-          while (*ascii_value) {
-            // Microtan requires capitals for all commands, so swap upper/lower case for convenience
-            uint8_t key = (uint8_t)*ascii_value;
-
-            if (((key >= 'A') && (key <= 'Z')) || ((key >= 'a') && (key <= 'z'))) {
-              key ^= 0x20;
-            }
-
-            keyboard_keypress(key);
-            ascii_value++;
-          }
-        } break;
-
-        case SDL_KEYDOWN: {
-          SDL_KeyCode keycode = event.key.keysym.sym;
-
-          if (keycode == SDLK_F2) {
-            keyboard_use_hex_keypad(true);
-          } else if (keycode == SDLK_F3) {
-            keyboard_use_hex_keypad(false);
-          } else if (keycode == SDLK_F5) {
-            system_reset();
-          } else {
-            if (keycode == SDLK_KP_ENTER) {
-              keycode = 0x0a;
-            } else if ((SDL_GetModState() & KMOD_CTRL) && (keycode >= 'a') && (keycode <= 'z')) {
-              keycode -= 0x60;
-            } else if ((SDL_GetModState() & KMOD_CTRL) && (keycode >= 'A') && (keycode <= 'Z')) {
-              keycode -= 0x40;
-            } else if (keycode == 0x08) {
-              keycode = 0x7f;
-            }
-
-            if ((keycode < ' ') || (keycode == 0x7f)) {
-              keyboard_keypress(keycode);
-            }
-          }
-        } break;
-      } // SDL event switch
-    }   // SDL event loop
-
-    // via_6522_print_regs();
-    joystick();
-    clock_gettime(CLOCK_MONOTONIC, &end_time);
-    long elapsed_time = (end_time.tv_sec - start_time.tv_sec) * 1000 + (end_time.tv_nsec - start_time.tv_nsec) / 1000000;
-
-    if (elapsed_time < LOOP_EXECUTE_TIME_MS) {
-      sleep_time.tv_sec = 0;
-      sleep_time.tv_nsec = (LOOP_EXECUTE_TIME_MS - elapsed_time) * 1000000;
-      nanosleep(&sleep_time, NULL);
+      if (forced_redraw_frames > 0) {
+        forced_redraw_frames--;
+      }
     }
   } // main loop
 
-  save_window_settings(window, cpu_clock_frequency, file_dialog_directory);
+  emulation_thread_stop();
+  audio_capture_stop();
+  save_window_settings(window, cpu_clock_frequency, vsync_requested,
+                       file_dialog_directory);
+  cpu_trace_stop();
+  gdb_stub_close();
   menu_bar_close(&menu_bar);
+  stats_overlay_close();
+  display_layers_close();
   SDL_DestroyTexture(texture);
   SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
@@ -3,6 +3,7 @@
 #include "external_filenames.h"
 
 #include <stddef.h>
+#include <string.h>
 
 #define MENU_FONT_SIZE       16
 #define MENU_TOP_PADDING     12
@@ -12,6 +13,8 @@
 #define MENU_CHECK_WIDTH     20
 #define MENU_SHORTCUT_GAP    36
 #define MENU_MIN_WIDTH       180
+#define MENU_TEXT_CACHE_SIZE 96
+#define MENU_TEXT_MAX_LENGTH 160
 
 static const SDL_Color MENU_TEXT = {25, 30, 28, 255};
 static const SDL_Color MENU_DISABLED = {125, 125, 118, 255};
@@ -21,6 +24,23 @@ static const SDL_Color MENU_HIGHLIGHT = {166, 74, 0, 255};
 static const SDL_Color MENU_HIGHLIGHT_TEXT = {255, 255, 245, 255};
 static const SDL_Color MENU_BORDER = {55, 61, 57, 255};
 
+// Rendered labels, keyed by text, colour and font. Labels are rebuilt by
+// snprintf whenever the menu model is, so entries are matched by content;
+// ones that stop being drawn age out when the cache is full.
+typedef struct {
+  TTF_Font* font;
+  SDL_Color colour;
+  char text[MENU_TEXT_MAX_LENGTH];
+  SDL_Texture* texture;
+  int width;
+  int height;
+  unsigned int last_used;
+} menu_text_entry_t;
+
+static menu_text_entry_t text_cache[MENU_TEXT_CACHE_SIZE];
+static SDL_Renderer* text_cache_renderer = NULL;
+static unsigned int text_cache_clock = 0;
+
 static bool item_is_separator(const menu_bar_item_t* item) {
   return item->command == MENU_BAR_SEPARATOR_COMMAND;
 }
@@ -33,12 +53,76 @@ static int text_width(TTF_Font* font, const char* text) {
   return width;
 }
 
+static bool same_colour(SDL_Color a, SDL_Color b) {
+  return (a.r == b.r) && (a.g == b.g) && (a.b == b.b) && (a.a == b.a);
+}
+
+static menu_text_entry_t* cached_text(SDL_Renderer* renderer, TTF_Font* font,
+                                      const char* text, SDL_Color colour) {
+  if (strlen(text) >= MENU_TEXT_MAX_LENGTH) {
+    return NULL;
+  }
+
+  // Textures belong to the renderer that made them
+  if (renderer != text_cache_renderer) {
+    menu_bar_flush_text_cache();
+    text_cache_renderer = renderer;
+  }
+
+  text_cache_clock++;
+  menu_text_entry_t* oldest = &text_cache[0];
+  for (int i = 0; i < MENU_TEXT_CACHE_SIZE; i++) {
+    menu_text_entry_t* entry = &text_cache[i];
+    if ((entry->texture != NULL) && (entry->font == font) &&
+        same_colour(entry->colour, colour) && (strcmp(entry->text, text) == 0)) {
+      entry->last_used = text_cache_clock;
+      return entry;
+    }
+    if ((entry->texture == NULL) ||
+        ((oldest->texture != NULL) && (entry->last_used < oldest->last_used))) {
+      oldest = entry;
+    }
+  }
+
+  SDL_Surface* surface = TTF_RenderUTF8_Blended(font, text, colour);
+  if (!surface) {
+    return NULL;
+  }
+  SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
+  int width = surface->w;
+  int height = surface->h;
+  SDL_FreeSurface(surface);
+  if (!texture) {
+    return NULL;
+  }
+
+  if (oldest->texture) {
+    SDL_DestroyTexture(oldest->texture);
+  }
+  oldest->font = font;
+  oldest->colour = colour;
+  strcpy(oldest->text, text);
+  oldest->texture = texture;
+  oldest->width = width;
+  oldest->height = height;
+  oldest->last_used = text_cache_clock;
+  return oldest;
+}
+
 static void draw_text(SDL_Renderer* renderer, TTF_Font* font,
                       const char* text, SDL_Color colour, int x, int y) {
   if (!renderer || !font || !text || !*text) {
     return;
   }
 
+  menu_text_entry_t* entry = cached_text(renderer, font, text, colour);
+  if (entry) {
+    SDL_Rect destination = {x, y, entry->width, entry->height};
+    SDL_RenderCopy(renderer, entry->texture, NULL, &destination);
+    return;
+  }
+
+  // Too long to cache
   SDL_Surface* surface = TTF_RenderUTF8_Blended(font, text, colour);
   if (!surface) {
     return;
@@ -196,7 +280,19 @@ bool menu_bar_initialise(menu_bar_state_t* state) {
   return state->font != NULL;
 }
 
+// Drops every cached label texture, e.g. after the renderer lost them
+void menu_bar_flush_text_cache(void) {
+  for (int i = 0; i < MENU_TEXT_CACHE_SIZE; i++) {
+    if (text_cache[i].texture) {
+      SDL_DestroyTexture(text_cache[i].texture);
+    }
+    text_cache[i] = (menu_text_entry_t){0};
+  }
+  text_cache_renderer = NULL;
+}
+
 void menu_bar_close(menu_bar_state_t* state) {
+  menu_bar_flush_text_cache();
   if (state && state->font) {
     TTF_CloseFont(state->font);
     state->font = NULL;
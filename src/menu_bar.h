@@ -30,6 +30,7 @@ typedef struct {
 
 extern bool menu_bar_initialise(menu_bar_state_t* state);
 extern void menu_bar_close(menu_bar_state_t* state);
+extern void menu_bar_flush_text_cache(void);
 extern bool menu_bar_handle_event(menu_bar_state_t* state,
                                   SDL_Renderer* renderer,
                                   const SDL_Event* event,
@@ -1,3 +1,6 @@
+// d_type and realpath
+#define _DEFAULT_SOURCE
+
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 #include <dirent.h>
@@ -17,6 +20,8 @@
 #define POPUP_MAX_ITEMS 32
 #define POPUP_BUTTON_GAP 10
 #define POPUP_BUTTON_MIN_WIDTH 96
+#define POPUP_SCAN_BATCH 256
+#define POPUP_LISTING_CACHE_SIZE 8
 
 #ifndef PATH_MAX
 #define PATH_MAX 4096
@@ -673,10 +678,44 @@ bool popup_prompt_input(SDL_Renderer* renderer, const char* title, const char* p
   return accepted;
 }
 typedef struct popup_file_entry_t {
-  char name[PATH_MAX];
+  char* name;
   bool is_dir;
 } popup_file_entry_t;
 
+typedef struct popup_file_list_t {
+  popup_file_entry_t* entries;
+  int count;
+  int capacity;
+} popup_file_list_t;
+
+// A directory read on a worker thread. Entries are handed over in batches
+// through pending, so the dialog can show and sort them as they arrive.
+typedef struct popup_directory_scan_t {
+  SDL_Thread* thread;
+  SDL_mutex* mutex;
+  SDL_atomic_t cancel;
+  char directory[PATH_MAX];
+  const char* const* extensions;
+  int extension_count;
+  popup_file_list_t pending;
+  bool finished;
+  bool failed;
+} popup_directory_scan_t;
+
+// Complete listings of recently shown directories. A listing is reused while
+// the directory's modification time, which changes whenever an entry is
+// added, removed or renamed, is the same.
+typedef struct popup_listing_cache_t {
+  char directory[PATH_MAX];
+  char filter[256];
+  struct timespec mtime;
+  popup_file_list_t list;
+  uint32_t last_used;
+} popup_listing_cache_t;
+
+static popup_listing_cache_t listing_cache[POPUP_LISTING_CACHE_SIZE];
+static uint32_t listing_cache_clock = 0;
+
 static bool popup_name_has_extension(const char* file_name, const char* const* extensions, int extension_count) {
   if (!extensions || extension_count <= 0) {
     return true;
@@ -731,89 +770,297 @@ static bool popup_is_directory_path(const char* path) {
   return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
 }
 
-static bool popup_append_file_entry(popup_file_entry_t** entries, int* count, int* capacity, const char* name, bool is_dir) {
-  if (*count >= *capacity) {
-    int new_capacity = (*capacity == 0) ? 64 : (*capacity * 2);
-    popup_file_entry_t* new_entries = (popup_file_entry_t*)realloc(*entries, (size_t)new_capacity * sizeof(popup_file_entry_t));
+static bool popup_file_list_reserve(popup_file_list_t* list, int count) {
+  if (count <= list->capacity) {
+    return true;
+  }
 
-    if (!new_entries) {
-      return false;
-    }
+  int new_capacity = (list->capacity == 0) ? 64 : list->capacity;
+  while (new_capacity < count) {
+    new_capacity *= 2;
+  }
 
-    *entries = new_entries;
-    *capacity = new_capacity;
+  popup_file_entry_t* new_entries = (popup_file_entry_t*)realloc(list->entries, (size_t)new_capacity * sizeof(popup_file_entry_t));
+  if (!new_entries) {
+    return false;
   }
 
-  popup_file_entry_t* entry = &(*entries)[*count];
-  snprintf(entry->name, sizeof(entry->name), "%s", name);
-  entry->is_dir = is_dir;
-  (*count)++;
+  list->entries = new_entries;
+  list->capacity = new_capacity;
   return true;
 }
 
-static bool popup_list_directory(const char* directory,
-                                 popup_file_entry_t** entries_out,
-                                 int* count_out,
-                                 const char* const* extensions,
-                                 int extension_count) {
-  DIR* dir = opendir(directory);
-  if (!dir) {
+static bool popup_append_file_entry(popup_file_list_t* list, const char* name, bool is_dir) {
+  if (!popup_file_list_reserve(list, list->count + 1)) {
     return false;
   }
 
-  popup_file_entry_t* entries = NULL;
-  int count = 0;
-  int capacity = 0;
+  char* copy = strdup(name);
+  if (!copy) {
+    return false;
+  }
+
+  list->entries[list->count].name = copy;
+  list->entries[list->count].is_dir = is_dir;
+  list->count++;
+  return true;
+}
+
+static void popup_file_list_free(popup_file_list_t* list) {
+  for (int i = 0; i < list->count; i++) {
+    free(list->entries[i].name);
+  }
+  free(list->entries);
+  *list = (popup_file_list_t){0};
+}
 
-  if (strcmp(directory, "/") != 0) {
-    if (!popup_append_file_entry(&entries, &count, &capacity, "..", true)) {
-      closedir(dir);
-      free(entries);
+static bool popup_file_list_copy(popup_file_list_t* output, const popup_file_list_t* input) {
+  for (int i = 0; i < input->count; i++) {
+    if (!popup_append_file_entry(output, input->entries[i].name, input->entries[i].is_dir)) {
       return false;
     }
   }
+  return true;
+}
+
+// Sorts batch and merges it into the already sorted list, taking ownership
+// of its names. *tracked_index follows the entry it pointed at.
+static bool popup_file_list_merge(popup_file_list_t* list, popup_file_entry_t* batch, int batch_count, int* tracked_index) {
+  if (batch_count == 0) {
+    return true;
+  }
+  if (!popup_file_list_reserve(list, list->count + batch_count)) {
+    return false;
+  }
+
+  qsort(batch, (size_t)batch_count, sizeof(popup_file_entry_t), popup_file_entry_compare);
+
+  // Merge from the back so neither array needs a copy
+  int i = list->count - 1;
+  int j = batch_count - 1;
+  int k = list->count + batch_count - 1;
+  int tracked = *tracked_index;
+  while (j >= 0) {
+    if ((i >= 0) && (popup_file_entry_compare(&list->entries[i], &batch[j]) > 0)) {
+      if (i == tracked) {
+        *tracked_index = k;
+      }
+      list->entries[k--] = list->entries[i--];
+    } else {
+      list->entries[k--] = batch[j--];
+    }
+  }
+  list->count += batch_count;
+  return true;
+}
+
+// Avoids a stat() per entry when the file system reports the type
+static bool popup_entry_is_directory(const char* directory, const struct dirent* item, bool* is_dir) {
+#ifdef _DIRENT_HAVE_D_TYPE
+  if (item->d_type == DT_DIR) {
+    *is_dir = true;
+    return true;
+  }
+  if (item->d_type == DT_REG) {
+    *is_dir = false;
+    return true;
+  }
+#endif
+
+  // Unknown type or a link to something
+  char full_path[PATH_MAX];
+  struct stat st;
+  if (!popup_join_path(full_path, sizeof(full_path), directory, item->d_name) ||
+      (stat(full_path, &st) != 0)) {
+    return false;
+  }
+
+  *is_dir = S_ISDIR(st.st_mode);
+  return true;
+}
+
+static void popup_scan_hand_over(popup_directory_scan_t* scan, popup_file_list_t* batch) {
+  SDL_LockMutex(scan->mutex);
+  if (popup_file_list_reserve(&scan->pending, scan->pending.count + batch->count)) {
+    memcpy(&scan->pending.entries[scan->pending.count], batch->entries,
+           (size_t)batch->count * sizeof(popup_file_entry_t));
+    scan->pending.count += batch->count;
+    batch->count = 0;
+  }
+  SDL_UnlockMutex(scan->mutex);
+
+  // Couldn't hand them over; drop them rather than grow without bound
+  popup_file_list_free(batch);
+}
+
+static int popup_scan_thread(void* data) {
+  popup_directory_scan_t* scan = (popup_directory_scan_t*)data;
+  DIR* dir = opendir(scan->directory);
+
+  if (!dir) {
+    SDL_LockMutex(scan->mutex);
+    scan->failed = true;
+    scan->finished = true;
+    SDL_UnlockMutex(scan->mutex);
+    return 0;
+  }
 
+  popup_file_list_t batch = {0};
   struct dirent* item;
-  while ((item = readdir(dir)) != NULL) {
+  while ((SDL_AtomicGet(&scan->cancel) == 0) && ((item = readdir(dir)) != NULL)) {
     if ((strcmp(item->d_name, ".") == 0) ||
         (strcmp(item->d_name, "..") == 0)) {
       continue;
     }
 
-    char full_path[PATH_MAX];
-    if (!popup_join_path(full_path, sizeof(full_path), directory, item->d_name)) {
+    bool is_dir;
+    if (!popup_entry_is_directory(scan->directory, item, &is_dir)) {
       continue;
     }
 
-    struct stat st;
-    if (stat(full_path, &st) != 0) {
+    if (!is_dir && !popup_name_has_extension(item->d_name, scan->extensions, scan->extension_count)) {
       continue;
     }
 
-    bool is_dir = S_ISDIR(st.st_mode);
+    popup_append_file_entry(&batch, item->d_name, is_dir);
+    if (batch.count >= POPUP_SCAN_BATCH) {
+      popup_scan_hand_over(scan, &batch);
+    }
+  }
 
-    if (!is_dir && !popup_name_has_extension(item->d_name, extensions, extension_count)) {
-      continue;
+  closedir(dir);
+  popup_scan_hand_over(scan, &batch);
+
+  SDL_LockMutex(scan->mutex);
+  scan->finished = true;
+  SDL_UnlockMutex(scan->mutex);
+  return 0;
+}
+
+static popup_directory_scan_t* popup_scan_start(const char* directory, const char* const* extensions, int extension_count) {
+  popup_directory_scan_t* scan = (popup_directory_scan_t*)calloc(1, sizeof(popup_directory_scan_t));
+  if (!scan) {
+    return NULL;
+  }
+
+  snprintf(scan->directory, sizeof(scan->directory), "%s", directory);
+  scan->extensions = extensions;
+  scan->extension_count = extension_count;
+  scan->mutex = SDL_CreateMutex();
+  if (scan->mutex) {
+    scan->thread = SDL_CreateThread(popup_scan_thread, "directory scan", scan);
+  }
+
+  if (!scan->thread) {
+    if (scan->mutex) {
+      SDL_DestroyMutex(scan->mutex);
     }
+    free(scan);
+    return NULL;
+  }
 
-    if (!popup_append_file_entry(&entries, &count, &capacity, item->d_name, is_dir)) {
-      closedir(dir);
-      free(entries);
-      return false;
+  return scan;
+}
+
+static void popup_scan_close(popup_directory_scan_t* scan) {
+  if (!scan) {
+    return;
+  }
+
+  SDL_AtomicSet(&scan->cancel, 1);
+  SDL_WaitThread(scan->thread, NULL);
+  SDL_DestroyMutex(scan->mutex);
+  popup_file_list_free(&scan->pending);
+  free(scan);
+}
+
+// Moves entries found so far into list. Returns true once the scan has
+// finished, with *failed set if the directory could not be opened.
+static bool popup_scan_collect(popup_directory_scan_t* scan, popup_file_list_t* list, int* tracked_index, bool* failed) {
+  SDL_LockMutex(scan->mutex);
+  bool finished = scan->finished;
+  *failed = scan->failed;
+  if (!popup_file_list_merge(list, scan->pending.entries, scan->pending.count, tracked_index)) {
+    // Out of memory; keep what is listed so far
+    for (int i = 0; i < scan->pending.count; i++) {
+      free(scan->pending.entries[i].name);
     }
   }
+  scan->pending.count = 0;
+  SDL_UnlockMutex(scan->mutex);
+  return finished;
+}
 
-  closedir(dir);
+static void popup_listing_filter(char* output, size_t output_size, const char* const* extensions, int extension_count) {
+  output[0] = '\0';
+  for (int i = 0; i < extension_count; i++) {
+    size_t length = strlen(output);
+    snprintf(output + length, output_size - length, "%s|", extensions[i] ? extensions[i] : "");
+  }
+}
+
+static popup_listing_cache_t* popup_listing_cache_find(const char* directory, const char* filter) {
+  for (int i = 0; i < POPUP_LISTING_CACHE_SIZE; i++) {
+    popup_listing_cache_t* cached = &listing_cache[i];
+    if ((cached->directory[0] != '\0') &&
+        (strcmp(cached->directory, directory) == 0) &&
+        (strcmp(cached->filter, filter) == 0)) {
+      return cached;
+    }
+  }
+  return NULL;
+}
+
+static bool popup_directory_mtime(const char* directory, struct timespec* mtime) {
+  struct stat st;
+  if (stat(directory, &st) != 0) {
+    return false;
+  }
+  *mtime = st.st_mtim;
+  return true;
+}
 
-  if (count > 1) {
-    qsort(entries, (size_t)count, sizeof(popup_file_entry_t), popup_file_entry_compare);
+// Fills list from the cache if the directory is unchanged since it was read
+static bool popup_listing_cache_load(const char* directory, const char* filter, popup_file_list_t* list) {
+  struct timespec mtime;
+  popup_listing_cache_t* cached = popup_listing_cache_find(directory, filter);
+  if (!cached || !popup_directory_mtime(directory, &mtime) ||
+      (mtime.tv_sec != cached->mtime.tv_sec) ||
+      (mtime.tv_nsec != cached->mtime.tv_nsec)) {
+    return false;
   }
 
-  *entries_out = entries;
-  *count_out = count;
+  cached->last_used = ++listing_cache_clock;
+  if (!popup_file_list_copy(list, &cached->list)) {
+    popup_file_list_free(list);
+    return false;
+  }
   return true;
 }
 
+static void popup_listing_cache_store(const char* directory, const char* filter, const struct timespec* mtime, const popup_file_list_t* list) {
+  popup_listing_cache_t* cached = popup_listing_cache_find(directory, filter);
+  if (!cached) {
+    cached = &listing_cache[0];
+    for (int i = 1; i < POPUP_LISTING_CACHE_SIZE; i++) {
+      if (listing_cache[i].last_used < cached->last_used) {
+        cached = &listing_cache[i];
+      }
+    }
+  }
+
+  popup_file_list_free(&cached->list);
+  cached->directory[0] = '\0';
+  if (!popup_file_list_copy(&cached->list, list)) {
+    popup_file_list_free(&cached->list);
+    return;
+  }
+  snprintf(cached->directory, sizeof(cached->directory), "%s", directory);
+  snprintf(cached->filter, sizeof(cached->filter), "%s", filter);
+  cached->mtime = *mtime;
+  cached->last_used = ++listing_cache_clock;
+}
+
 static bool popup_resolve_start_directory(const char* start_directory, char* output, size_t output_size) {
   if (start_directory && *start_directory && popup_is_directory_path(start_directory)) {
     char resolved[PATH_MAX];
@@ -902,8 +1149,11 @@ bool popup_file_select(SDL_Renderer* renderer,
     snprintf(typed_name, sizeof(typed_name), "%s", default_name);
   }
 
-  popup_file_entry_t* entries = NULL;
-  int entry_count = 0;
+  popup_file_list_t list = {0};
+  popup_directory_scan_t* scan = NULL;
+  struct timespec scan_mtime = {0, 0};
+  char filter[256];
+  popup_listing_filter(filter, sizeof(filter), extensions, extension_count);
   int selected_index = 0;
   int hovered_index = -1;
   int scroll_offset = 0;
@@ -918,17 +1168,26 @@ bool popup_file_select(SDL_Renderer* renderer,
 
   while (!done) {
     if (refresh_entries) {
-      free(entries);
-      entries = NULL;
-      entry_count = 0;
-
-      if (!popup_list_directory(current_directory, &entries, &entry_count, extensions, extension_count)) {
-        popup_show(renderer, "Unable to open directory.");
-        break;
+      popup_scan_close(scan);
+      scan = NULL;
+      popup_file_list_free(&list);
+
+      if (!popup_listing_cache_load(current_directory, filter, &list)) {
+        // Read it in the background, listing entries as they arrive
+        if ((strcmp(current_directory, "/") != 0) &&
+            !popup_append_file_entry(&list, "..", true)) {
+          popup_show(renderer, "Unable to open directory.");
+          break;
+        }
+        if (!popup_directory_mtime(current_directory, &scan_mtime) ||
+            ((scan = popup_scan_start(current_directory, extensions, extension_count)) == NULL)) {
+          popup_show(renderer, "Unable to open directory.");
+          break;
+        }
       }
 
-      if (selected_index >= entry_count) {
-        selected_index = (entry_count > 0) ? (entry_count - 1) : 0;
+      if (selected_index >= list.count) {
+        selected_index = (list.count > 0) ? (list.count - 1) : 0;
       }
       if (selected_index < 0) {
         selected_index = 0;
@@ -938,6 +1197,25 @@ bool popup_file_select(SDL_Renderer* renderer,
       refresh_entries = false;
     }
 
+    if (scan) {
+      int previous_count = list.count;
+      bool failed;
+      if (popup_scan_collect(scan, &list, &selected_index, &failed)) {
+        popup_scan_close(scan);
+        scan = NULL;
+        if (failed) {
+          popup_show(renderer, "Unable to open directory.");
+          break;
+        }
+        popup_listing_cache_store(current_directory, filter, &scan_mtime, &list);
+      }
+      if (list.count != previous_count) {
+        hovered_index = -1;
+      }
+    }
+    popup_file_entry_t* entries = list.entries;
+    int entry_count = list.count;
+
     bool activate_selection = false;
     bool activate_selected_entry = false;
     SDL_Event event;
@@ -1116,7 +1394,9 @@ bool popup_file_select(SDL_Renderer* renderer,
     char displayed_path[PATH_MAX];
     popup_fit_path(font, current_directory, header_width, displayed_path,
                    sizeof(displayed_path));
-    SDL_Surface* title_surface = TTF_RenderText_Blended(font, title, text_color);
+    char title_line[PATH_MAX];
+    snprintf(title_line, sizeof(title_line), scan ? "%s (reading directory)" : "%s", title);
+    SDL_Surface* title_surface = TTF_RenderText_Blended(font, title_line, text_color);
     SDL_Surface* path_surface = TTF_RenderText_Blended(font, displayed_path,
                                                         text_color);
 
@@ -1237,7 +1517,8 @@ bool popup_file_select(SDL_Renderer* renderer,
     SDL_StopTextInput();
   }
 
-  free(entries);
+  popup_scan_close(scan);
+  popup_file_list_free(&list);
   TTF_CloseFont(font);
   return accepted;
 }
@@ -0,0 +1,72 @@
+#include "stats_overlay.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// One line of pacing figures drawn over the top left of the display. The
+// text only changes once per statistics period, so it is kept as a texture
+// and rebuilt when the figures change.
+
+#define STATS_OVERLAY_MARGIN 4
+
+static const SDL_Color STATS_OVERLAY_TEXT = {255, 255, 160, 255};
+static const SDL_Color STATS_OVERLAY_BACKGROUND = {0, 0, 0, 160};
+
+static SDL_Texture* text_texture = NULL;
+static char text[96];
+static int text_width;
+static int text_height;
+
+void stats_overlay_render(SDL_Renderer* renderer, TTF_Font* font,
+                          const SDL_Rect* display_rect,
+                          const emulation_stats_t* stats) {
+  if (!renderer || !font) {
+    return;
+  }
+
+  char new_text[sizeof(text)];
+  snprintf(new_text, sizeof(new_text),
+           "%.3f MHz  jitter %.2f ms  idle %.0f%%  dropped %u",
+           stats->emulated_mhz, stats->slice_jitter_ms, stats->idle_percent,
+           stats->dropped_slices);
+
+  if ((NULL == text_texture) || (strcmp(new_text, text) != 0)) {
+    stats_overlay_close();
+    SDL_Surface* surface = TTF_RenderUTF8_Blended(font, new_text, STATS_OVERLAY_TEXT);
+    if (!surface) {
+      return;
+    }
+    text_texture = SDL_CreateTextureFromSurface(renderer, surface);
+    text_width = surface->w;
+    text_height = surface->h;
+    SDL_FreeSurface(surface);
+    if (!text_texture) {
+      return;
+    }
+    strcpy(text, new_text);
+  }
+
+  SDL_Rect background = {display_rect->x, display_rect->y,
+                         text_width + STATS_OVERLAY_MARGIN * 2,
+                         text_height + STATS_OVERLAY_MARGIN * 2};
+  SDL_Rect destination = {background.x + STATS_OVERLAY_MARGIN,
+                          background.y + STATS_OVERLAY_MARGIN,
+                          text_width, text_height};
+  SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+  SDL_SetRenderDrawColor(renderer, STATS_OVERLAY_BACKGROUND.r,
+                         STATS_OVERLAY_BACKGROUND.g,
+                         STATS_OVERLAY_BACKGROUND.b,
+                         STATS_OVERLAY_BACKGROUND.a);
+  SDL_RenderFillRect(renderer, &background);
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+  SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+  SDL_RenderCopy(renderer, text_texture, NULL, &destination);
+}
+
+void stats_overlay_close(void) {
+  if (NULL != text_texture) {
+    SDL_DestroyTexture(text_texture);
+    text_texture = NULL;
+  }
+  text[0] = '\0';
+}
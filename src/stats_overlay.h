@@ -0,0 +1,14 @@
+#ifndef __STATS_OVERLAY_H__
+#define __STATS_OVERLAY_H__
+
+#include <SDL.h>
+#include <SDL_ttf.h>
+
+#include "emulation_thread.h"
+
+extern void stats_overlay_render(SDL_Renderer* renderer, TTF_Font* font,
+                                 const SDL_Rect* display_rect,
+                                 const emulation_stats_t* stats);
+extern void stats_overlay_close(void);
+
+#endif // __STATS_OVERLAY_H__
@@ -4,6 +4,7 @@
 #include "ay8910.h"
 #include "colour_vdu.h"
 #include "cpu_6502.h"
+#include "debugger.h"
 #include "display.h"
 #include "eprom.h"
 #include "external_filenames.h"
@@ -17,11 +18,20 @@
 #include "via_6522.h"
 
 #define MAX_DEVICES 32
+#define PAGE_COUNT  256
 memory_mapped_device_t devices[MAX_DEVICES];
 static int device_count = 0;
 static uint8_t system_memory[65536];
 static uint8_t memory_read_only[65536];
 
+// Bus dispatch per 256-byte page. Pages without devices go straight to RAM,
+// and only watched pages pass through the debugger's checking callbacks.
+static memory_read_callback page_read[PAGE_COUNT];
+static memory_write_callback page_write[PAGE_COUNT];
+static memory_read_callback page_bus_read[PAGE_COUNT];
+static memory_write_callback page_bus_write[PAGE_COUNT];
+static bool page_watched[PAGE_COUNT];
+
 static void read_and_ignore(void* ptr, size_t size, size_t count, FILE* file) {
   size_t items_read = fread(ptr, size, count, file);
   (void)items_read;
@@ -97,7 +107,7 @@ device_configuration_t system_devices[] =
     {display_initialise, NULL, NULL, 0x03, 0x8000, 0x0000, "hires blue"},
     {display_initialise, NULL, NULL, 0x04, 0x8000, 0x0000, "hires intensity"},
     {display_initialise, NULL, display_close, 0x00, 0xbf00, 0x0000, "gpu"},
-    {colour_vdu_initialise, colour_vdu_reset, NULL, 0x00, 0xa000, 0x0000, "colour vdu"},
+    {colour_vdu_initialise, colour_vdu_reset, colour_vdu_close, 0x00, 0xa000, 0x0000, "colour vdu"},
     {tandos_initialise, tandos_reset, tandos_close, 0x00, 0x0000, 0x0000, "tandos"},
     {via_6522_initialise, via_6522_reset, NULL, 0x00, 0xbfc0, 0x0000, NULL},
     {via_6522_initialise, via_6522_reset, NULL, 0x00, 0xbfe0, 0x0000, NULL},
@@ -109,6 +119,49 @@ device_configuration_t system_devices[] =
     {cpu_6502_initialise, cpu_6502_reset, NULL, 0x00, 0x0000, 0x0000, NULL},
     {NULL, NULL, NULL, 0x00, 0x0000, 0x0000, NULL}};
 
+static uint8_t ram_read(uint16_t address) {
+  return system_memory[address];
+}
+
+static void ram_write(uint16_t address, uint8_t value) {
+  if (!memory_read_only[address]) {
+    system_memory[address] = value;
+  }
+}
+
+static uint8_t device_read(uint16_t address);
+static void device_write(uint16_t address, uint8_t value);
+
+static uint8_t watched_read(uint16_t address) {
+  uint8_t value = page_bus_read[address >> 8](address);
+  debugger_memory_access(address, value, false);
+  return value;
+}
+
+static void watched_write(uint16_t address, uint8_t value) {
+  page_bus_write[address >> 8](address, value);
+  debugger_memory_access(address, value, true);
+}
+
+static void update_page(int page) {
+  page_read[page] = page_watched[page] ? watched_read : page_bus_read[page];
+  page_write[page] = page_watched[page] ? watched_write : page_bus_write[page];
+}
+
+static void reset_pages(void) {
+  for (int page = 0; page < PAGE_COUNT; page++) {
+    page_bus_read[page] = ram_read;
+    page_bus_write[page] = ram_write;
+    page_watched[page] = false;
+    update_page(page);
+  }
+}
+
+void system_set_page_watched(uint8_t page, bool watched) {
+  page_watched[page] = watched;
+  update_page(page);
+}
+
 // Register a memory-mapped device
 int system_register_memory_mapped_device(uint16_t start, uint16_t end, memory_read_callback read_cb, memory_write_callback write_cb, bool use_main_ram) {
   if (device_count == MAX_DEVICES) {
@@ -122,11 +175,28 @@ int system_register_memory_mapped_device(uint16_t start, uint16_t end, memory_re
   devices[device_count].write = write_cb;
   devices[device_count].use_main_ram = use_main_ram;
   device_count++;
+
+  for (int page = start >> 8; page <= (end >> 8); page++) {
+    page_bus_read[page] = device_read;
+    page_bus_write[page] = device_write;
+    update_page(page);
+  }
+
   return RV_OK;
 }
 
 // Memory read function
 uint8_t system_read_memory(uint16_t address) {
+  return page_read[address >> 8](address);
+}
+
+// Memory write function
+void system_write_memory(uint16_t address, uint8_t value) {
+  page_write[address >> 8](address, value);
+}
+
+// Read from a page shared with one or more devices
+static uint8_t device_read(uint16_t address) {
   bool registered = false;
   uint8_t rv = 0;
 
@@ -151,8 +221,8 @@ uint8_t system_read_memory(uint16_t address) {
   return system_memory[address];
 }
 
-// Memory write function
-void system_write_memory(uint16_t address, uint8_t value) {
+// Write to a page shared with one or more devices
+static void device_write(uint16_t address, uint8_t value) {
   for (int i = 0; i < device_count; i++) {
     if (address >= devices[i].start_address && address <= devices[i].end_address) {
       if (devices[i].use_main_ram) {
@@ -174,6 +244,23 @@ uint8_t* system_get_memory_pointer(uint16_t address) {
   return system_memory + address;
 }
 
+// True if a device decodes the address from its own storage, so the byte in
+// system memory is not what the CPU would see there
+bool system_address_has_device_storage(uint16_t address) {
+  if (page_bus_read[address >> 8] != device_read) {
+    return false;
+  }
+
+  for (int i = 0; i < device_count; i++) {
+    if ((address >= devices[i].start_address) && (address <= devices[i].end_address) &&
+        !devices[i].use_main_ram) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
 void system_set_read_only(uint16_t start_address, uint16_t end_address) {
   memset(memory_read_only + start_address, 0x01, end_address - start_address + 1);
 }
@@ -511,6 +598,7 @@ void system_reset() {
 
 int system_initialise() {
   memset(memory_read_only, 0, sizeof(memory_read_only));
+  reset_pages();
   device_configuration_ptr_t device = system_devices;
 
   while (NULL != device->initialiser) {
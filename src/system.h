@@ -46,6 +46,8 @@ extern int system_register_memory_mapped_device(uint16_t start, uint16_t end, me
 extern uint8_t system_read_memory(uint16_t address);
 extern void system_write_memory(uint16_t address, uint8_t value);
 extern uint8_t* system_get_memory_pointer(uint16_t address);
+extern bool system_address_has_device_storage(uint16_t address);
+extern void system_set_page_watched(uint8_t page, bool watched);
 extern int system_load_m65_file(char* file_name);
 extern int system_load_intel_hex_file(char* file_name);
 extern int system_load_program_file(char* file_name);
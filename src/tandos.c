@@ -1,10 +1,16 @@
 #include "tandos.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <SDL.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "cpu_6502.h"
 #include "external_filenames.h"
@@ -28,6 +34,11 @@
 #define TANDOS_MAX_TRACKS       80
 #define TANDOS_DEFAULT_TRACKS   80
 #define TANDOS_DEFAULT_SECTORS  10
+#define TANDOS_MAX_SECTORS      (TANDOS_MAX_TRACKS * TANDOS_DEFAULT_SECTORS)
+#define TANDOS_DIRTY_WORDS      ((TANDOS_MAX_SECTORS + 31) / 32)
+// How long the flush thread lets writes gather, so that a SAVE or a file
+// copy goes out as a few large ranges rather than sector by sector
+#define TANDOS_FLUSH_DELAY_MS   250
 
 #define FDC_STATUS_BUSY             0x01
 #define FDC_STATUS_DRQ              0x02
@@ -40,13 +51,20 @@
 #define TANDOS_STATUS_HLD   0x40
 #define TANDOS_STATUS_DRQ   0x80
 
+// Images are mapped rather than read in: shared for read/write mounts, so a
+// sector write is a plain store into the file's pages, and private read-only
+// for write-protected ones, so processes using the same master share memory.
+// The emulation thread marks written sectors in the dirty bitmap and the
+// flush thread writes them back.
 typedef struct {
   uint8_t* data;
-  FILE* file;
   size_t size;
+  atomic_uint dirty[TANDOS_DIRTY_WORDS];
   int tracks;
   int sectors_per_track;
   bool write_protected;
+  dev_t device;
+  ino_t inode;
   char file_name[PATH_MAX];
 } tandos_disk_t;
 
@@ -76,6 +94,13 @@ static size_t transfer_position;
 static size_t transfer_length;
 static uint32_t completion_cycles;
 
+static bool fsync_writes = false;
+static SDL_Thread* flush_thread = NULL;
+static SDL_sem* flush_wake = NULL;
+static SDL_mutex* flush_mutex = NULL; // held while a mapping is flushed or changed
+static atomic_bool flush_pending;
+static atomic_bool flush_stopping;
+
 static bool valid_unit(int unit) {
   return (unit >= 0) && (unit < TANDOS_UNIT_COUNT);
 }
@@ -103,20 +128,94 @@ static void finish_command(void) {
   completion_cycles = 32;
 }
 
-static int flush_sector(int unit, uint8_t* sector) {
-  if (!valid_unit(unit) || !units[unit].file || units[unit].write_protected ||
-      (sector < units[unit].data) ||
-      (sector + TANDOS_SECTOR_SIZE > units[unit].data + units[unit].size)) {
-    return RV_FILE_OPEN_ERROR;
+// Wakes the flush thread, cutting short any delay it is in
+static void request_flush(void) {
+  atomic_store(&flush_pending, true);
+  if (flush_wake) {
+    SDL_SemPost(flush_wake);
   }
+}
 
-  long offset = (long)(sector - units[unit].data);
-  if ((fseek(units[unit].file, offset, SEEK_SET) != 0) ||
-      (fwrite(sector, 1, TANDOS_SECTOR_SIZE, units[unit].file) != TANDOS_SECTOR_SIZE) ||
-      (fflush(units[unit].file) != 0)) {
-    return RV_FILE_READ_ERROR;
+// Called on the emulation thread after a sector has been stored. Only the
+// first write of a batch wakes the flush thread, so the rest gather behind it.
+static void mark_dirty(int unit, size_t index) {
+  atomic_fetch_or(&units[unit].dirty[index / 32], 1u << (index % 32));
+  if (!atomic_exchange(&flush_pending, true) && flush_wake) {
+    SDL_SemPost(flush_wake);
   }
-  return RV_OK;
+}
+
+static void sync_range(int unit, size_t start, size_t end) {
+  int flags = fsync_writes ? MS_SYNC : MS_ASYNC;
+
+  if (msync(units[unit].data + start, end - start, flags) != 0) {
+    fprintf(stderr, "Warning: unable to write back [%s]: %s\n",
+            units[unit].file_name, strerror(errno));
+  }
+}
+
+// Writes back the dirty sectors of a unit, merging neighbouring sectors into
+// page-aligned ranges. The caller holds flush_mutex.
+static void flush_unit(int unit) {
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  size_t sector_count = (size_t)units[unit].tracks * units[unit].sectors_per_track;
+  size_t range_start = 0;
+  size_t range_end = 0;
+
+  if (!units[unit].data) {
+    return;
+  }
+
+  for (size_t word = 0; word < TANDOS_DIRTY_WORDS; word++) {
+    uint32_t bits = atomic_exchange(&units[unit].dirty[word], 0);
+
+    for (size_t bit = 0; bits != 0; bit++, bits >>= 1) {
+      size_t index = word * 32 + bit;
+
+      if (!(bits & 1) || (index >= sector_count)) {
+        continue;
+      }
+
+      size_t start = index * TANDOS_SECTOR_SIZE;
+      size_t end = start + TANDOS_SECTOR_SIZE;
+
+      start -= start % page_size;
+      if (range_end < start) {
+        if (range_end > range_start) {
+          sync_range(unit, range_start, range_end);
+        }
+        range_start = start;
+      }
+      range_end = end;
+    }
+  }
+
+  if (range_end > range_start) {
+    sync_range(unit, range_start, range_end);
+  }
+}
+
+static void flush_all_units(void) {
+  SDL_LockMutex(flush_mutex);
+  for (int unit = 0; unit < TANDOS_UNIT_COUNT; unit++) {
+    flush_unit(unit);
+  }
+  SDL_UnlockMutex(flush_mutex);
+}
+
+static int flush_thread_run(void* data) {
+  (void)data;
+
+  while (!atomic_load(&flush_stopping)) {
+    SDL_SemWait(flush_wake);
+    if (!atomic_load(&flush_stopping)) {
+      SDL_SemWaitTimeout(flush_wake, TANDOS_FLUSH_DELAY_MS);
+    }
+    atomic_store(&flush_pending, false);
+    flush_all_units();
+  }
+
+  return 0;
 }
 
 static bool infer_geometry(size_t size, int* tracks, int* sectors_per_track) {
@@ -329,11 +428,12 @@ static void write_data_register(uint8_t value) {
     uint8_t* destination = sector_pointer(unit, fdc_track, fdc_sector);
     if (!destination) {
       fdc_status = FDC_STATUS_RECORD_NOT_FOUND;
+    } else if (units[unit].write_protected) {
+      // The disk was swapped for a protected one mid-transfer
+      fdc_status = FDC_STATUS_WRITE_PROTECT;
     } else {
       memcpy(destination, transfer_buffer, TANDOS_SECTOR_SIZE);
-      if (flush_sector(unit, destination) != RV_OK) {
-        fdc_status = FDC_STATUS_WRITE_PROTECT;
-      }
+      mark_dirty(unit, (size_t)(destination - units[unit].data) / TANDOS_SECTOR_SIZE);
     }
     finish_command();
   }
@@ -430,6 +530,23 @@ int tandos_initialise(uint8_t bank, uint16_t address, uint16_t param, char* iden
     }
   }
 
+  flush_mutex = SDL_CreateMutex();
+  flush_wake = SDL_CreateSemaphore(0);
+  atomic_store(&flush_stopping, false);
+  atomic_store(&flush_pending, false);
+  if (flush_mutex && flush_wake) {
+    flush_thread = SDL_CreateThread(flush_thread_run, "tandos flush", NULL);
+  }
+  if (!flush_thread) {
+    // Written sectors still reach the image through the shared mapping;
+    // they are just only flushed explicitly on eject and at exit.
+    fprintf(stderr, "Warning: unable to create the TANDOS flush thread: %s\n", SDL_GetError());
+    if (flush_wake) {
+      SDL_DestroySemaphore(flush_wake);
+      flush_wake = NULL;
+    }
+  }
+
   int rv = system_register_memory_mapped_device(
     TANDOS_ROM_BASE, TANDOS_RAM_END, memory_read, memory_write, false);
   if (rv != RV_OK) {
@@ -455,10 +572,27 @@ void tandos_reset(uint8_t bank, uint16_t address) {
   transfer_position = 0;
   transfer_length = 0;
   completion_cycles = 0;
+  request_flush();
 }
 
 void tandos_close(void) {
+  if (flush_thread) {
+    atomic_store(&flush_stopping, true);
+    SDL_SemPost(flush_wake);
+    SDL_WaitThread(flush_thread, NULL);
+    flush_thread = NULL;
+  }
+  if (flush_wake) {
+    SDL_DestroySemaphore(flush_wake);
+    flush_wake = NULL;
+  }
+
   tandos_eject_all();
+
+  if (flush_mutex) {
+    SDL_DestroyMutex(flush_mutex);
+    flush_mutex = NULL;
+  }
 }
 
 void tandos_update(uint32_t elapsed_cycles) {
@@ -487,47 +621,49 @@ int tandos_mount(int unit, const char* file_name, bool write_protected) {
     return RV_INVALID_FILE;
   }
 
-  FILE* file = fopen(file_name, write_protected ? "rb" : "r+b");
-  if (!file) {
+  int fd = open(file_name, write_protected ? O_RDONLY : O_RDWR);
+  if (fd < 0) {
     return RV_FILE_OPEN_ERROR;
   }
 
-  if ((fseek(file, 0, SEEK_END) != 0)) {
-    fclose(file);
+  struct stat file_status;
+  if (fstat(fd, &file_status) != 0) {
+    close(fd);
     return RV_FILE_READ_ERROR;
   }
-  long file_size = ftell(file);
-  if ((file_size <= 0) || (fseek(file, 0, SEEK_SET) != 0)) {
-    fclose(file);
+  if (!S_ISREG(file_status.st_mode) || (file_status.st_size <= 0)) {
+    close(fd);
     return RV_INVALID_FILE;
   }
 
   int tracks;
   int sectors_per_track;
-  if (!infer_geometry((size_t)file_size, &tracks, &sectors_per_track)) {
-    fclose(file);
+  size_t file_size = (size_t)file_status.st_size;
+  if (!infer_geometry(file_size, &tracks, &sectors_per_track)) {
+    close(fd);
     return RV_INVALID_FILE;
   }
 
-  uint8_t* data = malloc((size_t)file_size);
-  if (!data) {
-    fclose(file);
+  void* data = write_protected ?
+    mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0) :
+    mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  // The mapping keeps its own reference to the file
+  close(fd);
+  if (data == MAP_FAILED) {
     return RV_MEMORY_ALLOCATION_FAILURE;
   }
-  if (fread(data, 1, (size_t)file_size, file) != (size_t)file_size) {
-    fclose(file);
-    free(data);
-    return RV_FILE_READ_ERROR;
-  }
 
   tandos_eject(unit);
+  SDL_LockMutex(flush_mutex);
   units[unit].data = data;
-  units[unit].file = file;
-  units[unit].size = (size_t)file_size;
+  units[unit].size = file_size;
   units[unit].tracks = tracks;
   units[unit].sectors_per_track = sectors_per_track;
   units[unit].write_protected = write_protected;
+  units[unit].device = file_status.st_dev;
+  units[unit].inode = file_status.st_ino;
   snprintf(units[unit].file_name, sizeof(units[unit].file_name), "%s", file_name);
+  SDL_UnlockMutex(flush_mutex);
   return RV_OK;
 }
 
@@ -535,11 +671,13 @@ void tandos_eject(int unit) {
   if (!valid_unit(unit)) {
     return;
   }
-  if (units[unit].file) {
-    fclose(units[unit].file);
+  SDL_LockMutex(flush_mutex);
+  if (units[unit].data) {
+    flush_unit(unit);
+    munmap(units[unit].data, units[unit].size);
   }
-  free(units[unit].data);
   memset(&units[unit], 0, sizeof(units[unit]));
+  SDL_UnlockMutex(flush_mutex);
 }
 
 void tandos_eject_all(void) {
@@ -568,6 +706,9 @@ int tandos_unit_sectors_per_track(int unit) {
   return valid_unit(unit) ? units[unit].sectors_per_track : 0;
 }
 
+// The new image is written beside the old one and renamed over it, so a
+// process that has the old file mapped keeps its pages instead of having the
+// file truncated under it. A file mounted here is refused outright.
 int tandos_create_image(const char* file_name, int tracks, int sectors_per_track) {
   if (!file_name || !*file_name ||
       (tracks < TANDOS_MIN_TRACKS) || (tracks > TANDOS_MAX_TRACKS) ||
@@ -575,8 +716,34 @@ int tandos_create_image(const char* file_name, int tracks, int sectors_per_track
     return RV_INVALID_FILE;
   }
 
-  FILE* file = fopen(file_name, "wb");
+  struct stat file_status;
+  bool replacing = stat(file_name, &file_status) == 0;
+  if (replacing) {
+    for (int unit = 0; unit < TANDOS_UNIT_COUNT; unit++) {
+      if (units[unit].data && (units[unit].device == file_status.st_dev) &&
+          (units[unit].inode == file_status.st_ino)) {
+        return RV_FILE_IN_USE;
+      }
+    }
+  }
+
+  char temporary_name[PATH_MAX];
+  if (snprintf(temporary_name, sizeof(temporary_name), "%s.new", file_name) >=
+      (int)sizeof(temporary_name)) {
+    return RV_INVALID_FILE;
+  }
+
+  int fd = open(temporary_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    return RV_FILE_OPEN_ERROR;
+  }
+  if (replacing) {
+    (void)fchmod(fd, file_status.st_mode & 07777);
+  }
+  FILE* file = fdopen(fd, "wb");
   if (!file) {
+    close(fd);
+    unlink(temporary_name);
     return RV_FILE_OPEN_ERROR;
   }
 
@@ -593,7 +760,11 @@ int tandos_create_image(const char* file_name, int tracks, int sectors_per_track
   if (fclose(file) != 0) {
     ok = false;
   }
-  return ok ? RV_OK : RV_FILE_READ_ERROR;
+  if (!ok || (rename(temporary_name, file_name) != 0)) {
+    unlink(temporary_name);
+    return RV_FILE_WRITE_ERROR;
+  }
+  return RV_OK;
 }
 
 void tandos_save_settings(FILE* file) {
@@ -602,6 +773,7 @@ void tandos_save_settings(FILE* file) {
   }
 
   fprintf(file, "tandos_enabled=%d\n", enabled ? 1 : 0);
+  fprintf(file, "tandos_fsync=%d\n", fsync_writes ? 1 : 0);
   for (int unit = 0; unit < TANDOS_UNIT_COUNT; unit++) {
     if (units[unit].data) {
       fprintf(file, "tandos_unit%d=%c:%s\n", unit,
@@ -629,6 +801,12 @@ void tandos_load_settings(FILE* file) {
       continue;
     }
 
+    int fsync_value;
+    if (sscanf(line, "tandos_fsync=%d", &fsync_value) == 1) {
+      fsync_writes = fsync_value != 0;
+      continue;
+    }
+
     int unit;
     char mode;
     int path_offset = 0;
@@ -0,0 +1,191 @@
+// AY8910 synthesis must not depend on how often it is brought up to date:
+// the same register script rendered in whole chunks and in syncs a few
+// cycles apart has to give bit-identical output.
+#include "ay8910.h"
+#include "audio_output.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CLOCK_FREQUENCY 750000
+#define RUN_CYCLES      (2 * CLOCK_FREQUENCY)
+#define RUN_SAMPLES     ((uint64_t)RUN_CYCLES * AUDIO_OUTPUT_FREQUENCY / CLOCK_FREQUENCY)
+
+typedef struct {
+  uint32_t cycle;
+  int chip;
+  int reg;
+  int value;
+} script_entry_t;
+
+// Tone, noise, every envelope shape, envelope restarts and volume-register
+// sample playback, spread over both chips of the sound board
+static const script_entry_t script[] = {
+  {0, 0, AY_AFINE, 0x40},
+  {0, 0, AY_ACOARSE, 0x01},
+  {0, 0, AY_BFINE, 0xa3},
+  {0, 0, AY_NOISEPER, 0x07},
+  {0, 0, AY_ENABLE, 0x2c},       // tone A and B, noise B
+  {0, 0, AY_AVOL, 0x10},         // A follows the envelope
+  {0, 0, AY_BVOL, 0x09},
+  {0, 0, AY_EFINE, 0x30},
+  {0, 0, AY_ESHAPE, 0x08},
+  {0, 1, AY_CFINE, 0x55},
+  {0, 1, AY_ENABLE, 0x3b},       // tone C
+  {0, 1, AY_CVOL, 0x0c},
+  {40000, 0, AY_ESHAPE, 0x0a},
+  {90000, 0, AY_ESHAPE, 0x0e},
+  {140000, 0, AY_ECOARSE, 0x01},
+  {150000, 0, AY_ESHAPE, 0x00},  // one-shot shapes hold
+  {260000, 0, AY_ESHAPE, 0x0d},
+  {380000, 0, AY_EFINE, 0x05},
+  {380000, 0, AY_ESHAPE, 0x0c},
+  {500000, 1, AY_CVOL, 0x10},    // chip 1 joins the envelope of its own
+  {500000, 1, AY_EFINE, 0x11},
+  {500000, 1, AY_ESHAPE, 0x0e},
+  {640001, 0, AY_NOISEPER, 0x00},
+  {700000, 0, AY_AFINE, 0x00},   // period 0 behaves as 1
+  {700000, 0, AY_ACOARSE, 0x00},
+  {820000, 0, AY_ENABLE, 0x3f},  // both chips play samples through volume
+  {820000, 1, AY_ENABLE, 0x3f},
+  {820007, 0, AY_AVOL, 0x0f},
+  {820133, 0, AY_AVOL, 0x03},
+  {820260, 1, AY_BVOL, 0x0b},
+  {820391, 0, AY_AVOL, 0x0c},
+  {820391, 1, AY_BVOL, 0x00},
+  {1000000, 0, AY_AVOL, 0x00},   // chip 0 silent, its generators keep phase
+  {1000000, 0, AY_BVOL, 0x00},
+  {1200000, 0, AY_ENABLE, 0x3e},
+  {1200000, 0, AY_AVOL, 0x10},
+  {1200000, 0, AY_ESHAPE, 0x08},
+};
+
+static uint64_t cycles = 0;
+static audio_output_source_t source = NULL;
+static float* output = NULL;
+static uint64_t rendered = 0;
+
+uint64_t cpu_6502_get_cycles() {
+  return cycles;
+}
+
+int system_register_memory_mapped_device(uint16_t start, uint16_t end, memory_read_callback read_cb,
+                                         memory_write_callback write_cb, bool use_main_ram) {
+  (void)start;
+  (void)end;
+  (void)read_cb;
+  (void)write_cb;
+  (void)use_main_ram;
+  return 0;
+}
+
+int audio_output_open(void) {
+  return 0;
+}
+
+void audio_output_close(void) {
+}
+
+void audio_output_add_source(audio_output_source_t new_source) {
+  source = new_source;
+}
+
+// Renders up to the given cycle in chunks of at most
+// AUDIO_OUTPUT_CHUNK_SAMPLES, as the real mixer does
+void audio_output_sync(uint64_t cycle) {
+  uint64_t target = cycle * AUDIO_OUTPUT_FREQUENCY / CLOCK_FREQUENCY;
+
+  while (rendered < target) {
+    uint64_t count = target - rendered;
+
+    if (count > AUDIO_OUTPUT_CHUNK_SAMPLES) {
+      count = AUDIO_OUTPUT_CHUNK_SAMPLES;
+    }
+
+    source(output + rendered, (int)count);
+    rendered += count;
+  }
+}
+
+// Plays the script, bringing the chips up to date every sync_cycles as well
+// as at each register write
+static void render(float* buffer, uint32_t sync_cycles) {
+  size_t next = 0;
+
+  memset(buffer, 0, RUN_SAMPLES * sizeof(buffer[0]));
+  output = buffer;
+  rendered = 0;
+  cycles = 0;
+  ay8910_initialise(0, 0, 0, NULL);
+
+  while (cycles < RUN_CYCLES) {
+    while ((next < sizeof(script) / sizeof(script[0])) && (script[next].cycle <= cycles)) {
+      ay8910_write_reg(script[next].chip, script[next].reg, script[next].value);
+      next++;
+    }
+
+    cycles += sync_cycles;
+    if ((next < sizeof(script) / sizeof(script[0])) && (script[next].cycle < cycles)) {
+      cycles = script[next].cycle;
+    }
+    if (cycles > RUN_CYCLES) {
+      cycles = RUN_CYCLES;
+    }
+
+    if (sync_cycles < RUN_CYCLES) {
+      audio_output_sync(cycles);
+    }
+  }
+
+  audio_output_sync(RUN_CYCLES);
+  ay8910_close();
+}
+
+int main(void) {
+  static const uint32_t sync_intervals[] = {1, 7, 13, 100, 4093};
+  float* whole = malloc(RUN_SAMPLES * sizeof(float));
+  float* synced = malloc(RUN_SAMPLES * sizeof(float));
+  int failures = 0;
+
+  if (!whole || !synced) {
+    printf("ay8910_test: out of memory\n");
+    return EXIT_FAILURE;
+  }
+
+  // Reference: the chips are only synthesised when a register is written
+  render(whole, RUN_CYCLES);
+
+  float peak = 0.0f;
+  for (uint64_t i = 0; i < RUN_SAMPLES; i++) {
+    peak = (whole[i] > peak) ? whole[i] : peak;
+  }
+  if (peak < 1000.0f) {
+    printf("ay8910_test: reference output is silent\n");
+    failures++;
+  }
+
+  for (size_t n = 0; n < sizeof(sync_intervals) / sizeof(sync_intervals[0]); n++) {
+    render(synced, sync_intervals[n]);
+
+    for (uint64_t i = 0; i < RUN_SAMPLES; i++) {
+      if (memcmp(&whole[i], &synced[i], sizeof(float)) != 0) {
+        printf("ay8910_test: syncing every %u cycles differs at sample %llu (%f, expected %f)\n",
+               sync_intervals[n], (unsigned long long)i, synced[i], whole[i]);
+        failures++;
+        break;
+      }
+    }
+  }
+
+  free(whole);
+  free(synced);
+
+  if (failures) {
+    printf("ay8910_test: %d failure(s)\n", failures);
+    return EXIT_FAILURE;
+  }
+
+  printf("ay8910_test: all tests passed\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,255 @@
+// The Colour VDU draws from cached glyph tiles, decoded rows and a ring
+// framebuffer, redrawing only what changed. Its output must match the
+// original renderer, which drew every pixel of every frame from scratch,
+// under random display RAM, CRTC, scroll and flash/cursor timing changes.
+// The module is included directly so both renderers share its state.
+#include "colour_vdu.c"
+
+#define RENDERS            3000
+#define MAX_WRITES         24
+#define MAX_REPORTED       5
+
+static uint64_t cycles = 0;
+static int failures = 0;
+
+uint64_t cpu_6502_get_cycles() {
+  return cycles;
+}
+
+uint8_t* system_get_memory_pointer(uint16_t address) {
+  static uint8_t memory[65536];
+  return &memory[address];
+}
+
+int system_register_memory_mapped_device(uint16_t start, uint16_t end, memory_read_callback read_cb,
+                                         memory_write_callback write_cb, bool use_main_ram) {
+  (void)start;
+  (void)end;
+  (void)read_cb;
+  (void)write_cb;
+  (void)use_main_ram;
+  return RV_OK;
+}
+
+// The original renderer, drawing each cell straight into the output
+
+static void reference_fill_cell(uint32_t* pixels, int cell_x, int cell_y, uint32_t colour) {
+  for (int y = 0; y < COLOUR_VDU_CELL_HEIGHT; y++) {
+    for (int x = 0; x < COLOUR_VDU_CELL_WIDTH; x++) {
+      pixels[(cell_y * COLOUR_VDU_CELL_HEIGHT + y) * COLOUR_VDU_WIDTH +
+             cell_x * COLOUR_VDU_CELL_WIDTH + x] = colour;
+    }
+  }
+}
+
+static void reference_draw_glyph(uint32_t* pixels, int cell_x, int cell_y, int glyph_index,
+                                 uint32_t foreground, uint32_t background,
+                                 colour_vdu_height_part_t height_part) {
+  const uint8_t* glyph = character_data + glyph_index * SAA5050_CHARACTER_SIZE;
+
+  for (int y = 0; y < COLOUR_VDU_CELL_HEIGHT; y++) {
+    uint8_t row = glyph[colour_vdu_glyph_row(y, height_part)];
+
+    for (int x = 0; x < COLOUR_VDU_CELL_WIDTH; x++) {
+      pixels[(cell_y * COLOUR_VDU_CELL_HEIGHT + y) * COLOUR_VDU_WIDTH +
+             cell_x * COLOUR_VDU_CELL_WIDTH + x] = (row & (0x20U >> x)) ? foreground : background;
+    }
+  }
+}
+
+static void reference_render(uint32_t* pixels, unsigned int now_ms) {
+  bool flash_visible = ((now_ms / 500U) & 1U) == 0;
+  bool cursor_visible = colour_vdu_cursor_visible(now_ms);
+  uint16_t start_address = colour_vdu_start_address();
+  uint16_t cursor_address = (uint16_t)(((crtc_registers[14] & 0x3F) << 8) | crtc_registers[15]);
+  int displayed_rows = colour_vdu_displayed_rows();
+  bool lower_half_valid[COLOUR_VDU_COLUMNS] = {false};
+  bool next_lower_half_valid[COLOUR_VDU_COLUMNS];
+
+  for (int i = 0; i < COLOUR_VDU_WIDTH * COLOUR_VDU_HEIGHT; i++) {
+    pixels[i] = teletext_palette[0];
+  }
+
+  for (int row = 0; row < displayed_rows; row++) {
+    teletext_state_t state = {.foreground = 7};
+
+    memset(next_lower_half_valid, 0, sizeof(next_lower_half_valid));
+
+    for (int column = 0; column < COLOUR_VDU_COLUMNS; column++) {
+      uint16_t display_address = (uint16_t)((start_address + row * COLOUR_VDU_COLUMNS + column) & 0x07FF);
+      uint8_t raw_character = colour_vdu_ram[display_address];
+      uint8_t character = raw_character & 0x7F;
+      bool render_cell = !lower_half_valid[column];
+      bool render_lower = render_cell && state.double_height && (row + 1 < displayed_rows);
+      colour_vdu_height_part_t height_part =
+        state.double_height ? COLOUR_VDU_HEIGHT_TOP : COLOUR_VDU_HEIGHT_NORMAL;
+      uint32_t foreground = teletext_palette[state.foreground];
+      uint32_t background = teletext_palette[state.background];
+      int glyph_index = -1;
+
+      if (raw_character & 0x80) {
+        uint32_t swap = foreground;
+        foreground = background;
+        background = swap;
+      }
+
+      if (character < 0x20) {
+        if (state.graphics && (state.hold || (character == 0x1E)) && state.have_held_mosaic) {
+          glyph_index = colour_vdu_mosaic_glyph(state.held_mosaic, state.separated);
+        }
+        colour_vdu_apply_control(&state, character);
+      } else if (state.conceal || (state.flash && !flash_visible)) {
+        // Drawn as background
+      } else if (state.graphics && colour_vdu_is_mosaic(character)) {
+        state.held_mosaic = colour_vdu_mosaic_bits(character);
+        state.have_held_mosaic = true;
+        glyph_index = colour_vdu_mosaic_glyph(state.held_mosaic, state.separated);
+      } else {
+        glyph_index = character - 0x20;
+      }
+
+      if (render_cell) {
+        if (glyph_index < 0) {
+          reference_fill_cell(pixels, column, row, background);
+          if (render_lower) {
+            reference_fill_cell(pixels, column, row + 1, background);
+          }
+        } else {
+          reference_draw_glyph(pixels, column, row, glyph_index, foreground, background, height_part);
+          if (render_lower) {
+            reference_draw_glyph(pixels, column, row + 1, glyph_index, foreground, background,
+                                 COLOUR_VDU_HEIGHT_BOTTOM);
+          }
+        }
+      }
+
+      if (render_lower) {
+        next_lower_half_valid[column] = true;
+      }
+
+      if (cursor_visible && (display_address == (cursor_address & 0x07FF))) {
+        int cursor_start = crtc_registers[10] & 0x1F;
+        int cursor_end = crtc_registers[11] & 0x1F;
+
+        if (cursor_start >= COLOUR_VDU_CELL_HEIGHT) {
+          cursor_start = COLOUR_VDU_CELL_HEIGHT - 1;
+        }
+        if (cursor_end >= COLOUR_VDU_CELL_HEIGHT) {
+          cursor_end = COLOUR_VDU_CELL_HEIGHT - 1;
+        }
+        if (cursor_end < cursor_start) {
+          cursor_end = cursor_start;
+        }
+
+        for (int y = cursor_start; y <= cursor_end; y++) {
+          for (int x = 0; x < COLOUR_VDU_CELL_WIDTH; x++) {
+            pixels[(row * COLOUR_VDU_CELL_HEIGHT + y) * COLOUR_VDU_WIDTH +
+                   column * COLOUR_VDU_CELL_WIDTH + x] ^= 0xFFFFFF00U;
+          }
+        }
+      }
+    }
+
+    memcpy(lower_half_valid, next_lower_half_valid, sizeof(lower_half_valid));
+  }
+}
+
+static void write_crtc(uint8_t reg, uint8_t value) {
+  colour_vdu_write(COLOUR_VDU_CRTC_BASE, reg);
+  colour_vdu_write(COLOUR_VDU_CRTC_BASE + 1, value);
+}
+
+// Characters weighted towards the control codes that change the layout
+static uint8_t random_character(void) {
+  static const uint8_t controls[] = {
+    0x01, 0x03, 0x06, 0x08, 0x09, 0x0C, 0x0D, 0x0D, 0x12, 0x15, 0x17,
+    0x18, 0x19, 0x1A, 0x1C, 0x1D, 0x1E, 0x1F};
+  int choice = rand() % 8;
+
+  if (choice < 3) {
+    return controls[rand() % (int)sizeof(controls)];
+  }
+  if (choice == 3) {
+    return (uint8_t)(0x80 | rand());
+  }
+  return (uint8_t)(0x20 + rand() % 0x60);
+}
+
+static void random_write(void) {
+  int choice = rand() % 40;
+  uint16_t start = colour_vdu_start_address();
+
+  if (choice < 30) {
+    // Mostly near the top of the screen, where scrolling brings rows in
+    uint16_t offset = (uint16_t)((start + rand() % (COLOUR_VDU_VISIBLE_CELLS + 256)) & 0x07FF);
+    colour_vdu_write(COLOUR_VDU_BASE + offset, random_character());
+  } else if (choice < 34) {
+    // Scroll by whole rows either way
+    start = (uint16_t)((start + (rand() % 7 - 3) * COLOUR_VDU_COLUMNS) & 0x07FF);
+    write_crtc(12, (uint8_t)(start >> 8));
+    write_crtc(13, (uint8_t)start);
+  } else if (choice == 34) {
+    // A start address that is not a whole number of rows away
+    write_crtc(13, (uint8_t)rand());
+  } else if (choice == 35) {
+    write_crtc(6, (uint8_t)((rand() % 4) ? COLOUR_VDU_ROWS : rand() % (COLOUR_VDU_ROWS + 2)));
+  } else if (choice < 38) {
+    uint16_t cursor = (uint16_t)((start + rand() % COLOUR_VDU_VISIBLE_CELLS) & 0x07FF);
+    write_crtc(14, (uint8_t)(cursor >> 8));
+    write_crtc(15, (uint8_t)cursor);
+  } else if (choice == 38) {
+    write_crtc(10, (uint8_t)rand());
+    write_crtc(11, (uint8_t)rand());
+  } else {
+    write_crtc((uint8_t)(rand() % CRTC_REGISTER_COUNT), (uint8_t)rand());
+  }
+}
+
+int main(void) {
+  static uint32_t rendered[COLOUR_VDU_WIDTH * COLOUR_VDU_HEIGHT];
+  static uint32_t expected[COLOUR_VDU_WIDTH * COLOUR_VDU_HEIGHT];
+  int reported = 0;
+
+  srand(5050);
+  for (size_t i = 0; i < sizeof(character_data); i++) {
+    character_data[i] = (uint8_t)(rand() & 0x3F);
+  }
+  memset(colour_vdu_ram, 0x20, sizeof(colour_vdu_ram));
+  colour_vdu_reset(0, 0);
+  colour_vdu_set_enabled(true);
+
+  for (int n = 0; n < RENDERS; n++) {
+    int writes = rand() % MAX_WRITES;
+
+    for (int i = 0; i < writes; i++) {
+      random_write();
+    }
+
+    // Up to half a second at a time, so flash and cursor phases flip
+    cycles += (uint64_t)(rand() % 500) * (DEFAULT_CLOCK_FREQUENCY / 1000);
+
+    colour_vdu_render(rendered);
+    reference_render(expected, (unsigned int)emulated_ms);
+
+    for (int i = 0; i < COLOUR_VDU_WIDTH * COLOUR_VDU_HEIGHT; i++) {
+      if (rendered[i] != expected[i]) {
+        failures++;
+        if (reported++ < MAX_REPORTED) {
+          printf("colour_vdu_test: render %d differs at x %d, y %d (%08X, expected %08X)\n", n,
+                 i % COLOUR_VDU_WIDTH, i / COLOUR_VDU_WIDTH, rendered[i], expected[i]);
+        }
+        break;
+      }
+    }
+  }
+
+  colour_vdu_close();
+
+  if (failures) {
+    printf("colour_vdu_test: %d failure(s)\n", failures);
+    return EXIT_FAILURE;
+  }
+
+  printf("colour_vdu_test: all tests passed\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,272 @@
+// The instruction-at-a-time core and the cycle-exact core must agree: every
+// instruction is run from the same state on both, for the NMOS 6502 and the
+// 65C02, and the registers, cycle count and memory written are compared.
+#include "cpu_6502.h"
+#include "cpu_trace.h"
+#include "debugger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RANDOM_STEPS     200000
+#define MAX_WRITES       16
+#define MAX_REPORTED     10
+
+typedef struct {
+  uint16_t pc;
+  uint8_t a;
+  uint8_t x;
+  uint8_t y;
+  uint8_t sp;
+  uint8_t psw;
+  uint64_t cycles;
+} cpu_state_t;
+
+static uint8_t memories[2][65536];
+static uint8_t* memory = memories[0];
+static uint16_t writes[MAX_WRITES];
+static int write_count = 0;
+static int failures = 0;
+
+bool cpu_trace_enabled = false;
+bool debugger_enabled = false;
+
+#define CHECK(condition)                                              \
+  do {                                                                \
+    if (!(condition)) {                                               \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      failures++;                                                     \
+    }                                                                 \
+  } while (0)
+
+void cpu_trace_record(uint64_t cycle, uint16_t pc, uint8_t opcode,
+                      uint8_t a, uint8_t x, uint8_t y, uint8_t sp,
+                      uint8_t psw) {
+  (void)cycle;
+  (void)pc;
+  (void)opcode;
+  (void)a;
+  (void)x;
+  (void)y;
+  (void)sp;
+  (void)psw;
+}
+
+bool debugger_check(uint16_t pc) {
+  (void)pc;
+  return false;
+}
+
+void rtc_update(void) {
+}
+
+void tandos_update(uint32_t elapsed_cycles) {
+  (void)elapsed_cycles;
+}
+
+bool via_6522_update(int pnTicks) {
+  (void)pnTicks;
+  return false;
+}
+
+int system_register_memory_mapped_device(uint16_t start, uint16_t end, memory_read_callback read_cb,
+                                         memory_write_callback write_cb, bool use_main_ram) {
+  (void)start;
+  (void)end;
+  (void)read_cb;
+  (void)write_cb;
+  (void)use_main_ram;
+  return 0;
+}
+
+uint8_t system_read_memory(uint16_t address) {
+  return memory[address];
+}
+
+void system_write_memory(uint16_t address, uint8_t value) {
+  memory[address] = value;
+  if (write_count < MAX_WRITES) {
+    writes[write_count++] = address;
+  }
+}
+
+static cpu_state_t get_state(void) {
+  cpu_state_t state = {cpu_6502_get_pc(), cpu_6502_get_a(), cpu_6502_get_x(), cpu_6502_get_y(),
+                       cpu_6502_get_sp(), cpu_6502_get_psw(), cpu_6502_get_cycles()};
+  return state;
+}
+
+static void set_state(const cpu_state_t* state) {
+  cpu_6502_set_registers(state->pc, state->a, state->x, state->y, state->sp, state->psw);
+}
+
+// Runs one instruction on the given core; the cycle-exact core banks any
+// overrun, so its budget is cleared before each step
+static cpu_state_t step(const cpu_state_t* from, bool cycle_exact, int memory_index) {
+  memory = memories[memory_index];
+  write_count = 0;
+  cpu_6502_set_cycle_exact(cycle_exact);
+  set_state(from);
+  cpu_6502_execute(1);
+  return get_state();
+}
+
+// Runs the code at $0200 until the PC reaches end, returning the state with
+// the number of cycles taken
+static cpu_state_t run_program(const uint8_t* code, size_t length, uint16_t end, uint8_t x,
+                               uint8_t psw, bool cycle_exact) {
+  cpu_state_t state = {0x0200, 0, x, 0, 0xff, psw, 0};
+  uint64_t start = cpu_6502_get_cycles();
+
+  memset(memories[0], 0, sizeof(memories[0]));
+  memcpy(&memories[0][0x0200], code, length);
+
+  for (int i = 0; (i < 1000) && (state.pc != end); i++) {
+    state = step(&state, cycle_exact, 0);
+  }
+
+  state.cycles -= start;
+  return state;
+}
+
+// CLC; PHP; PLA leaves the pushed copy of P in A, with B and bit 5 set, while
+// P itself never holds B
+static void test_php(cpu_6502_variant_t variant) {
+  static const uint8_t code[] = {0x18, 0x08, 0x68};
+
+  cpu_6502_set_variant(variant);
+  for (int exact = 0; exact < 2; exact++) {
+    cpu_state_t state = run_program(code, sizeof(code), 0x0203, 0, 0x24, exact);
+    CHECK(state.a == 0x34);
+    CHECK(state.psw == 0x24);
+    CHECK(state.sp == 0xff);
+    CHECK(state.cycles == 2 + 3 + 4);
+  }
+}
+
+// DEX; BNE back: two cycles for DEX, three for each taken branch and two for
+// the last one
+static void test_branch_loop(cpu_6502_variant_t variant) {
+  static const uint8_t code[] = {0xca, 0xd0, 0xfd};
+
+  cpu_6502_set_variant(variant);
+  for (int exact = 0; exact < 2; exact++) {
+    cpu_state_t state = run_program(code, sizeof(code), 0x0203, 10, 0x20, exact);
+    CHECK(state.x == 0);
+    CHECK(state.cycles == 10 * 2 + 9 * 3 + 2);
+  }
+}
+
+// BRK pushes B and bit 5; P afterwards has I set and no B
+static void test_brk(cpu_6502_variant_t variant) {
+  static const uint8_t code[] = {0x00, 0xea};
+
+  cpu_6502_set_variant(variant);
+  for (int exact = 0; exact < 2; exact++) {
+    memset(memories[0], 0, sizeof(memories[0]));
+    memcpy(&memories[0][0x0200], code, sizeof(code));
+    memories[0][0xfffe] = 0x00;
+    memories[0][0xffff] = 0x03;
+
+    cpu_state_t from = {0x0200, 0, 0, 0, 0xff, 0x08 | 0x20, 0};
+    cpu_state_t state = step(&from, exact, 0);
+    CHECK(state.pc == 0x0300);
+    CHECK(memories[0][0x01fd] == (0x08 | 0x20 | PSW_B));
+    CHECK(memories[0][0x01ff] == 0x02);
+    CHECK(memories[0][0x01fe] == 0x02);
+    CHECK((state.psw & PSW_B) == 0);
+    CHECK(state.psw & PSW_I);
+    CHECK(((state.psw & PSW_D) != 0) == (variant == CPU_6502_VARIANT_NMOS));
+  }
+}
+
+// Random code from random states: each instruction is run by both cores on
+// identical copies of memory and the results compared
+static void test_random(cpu_6502_variant_t variant, const char* name) {
+  cpu_state_t state = {0, 0, 0, 0, 0, 0x20, 0};
+  int reported = 0;
+
+  cpu_6502_set_variant(variant);
+  srand(6502);
+
+  for (int n = 0; n < RANDOM_STEPS; n++) {
+    // A fresh random state every so often keeps the walk out of loops
+    if ((n % 64) == 0) {
+      for (size_t i = 0; i < sizeof(memories[0]); i++) {
+        memories[0][i] = (uint8_t)rand();
+      }
+      state.pc = (uint16_t)rand();
+      state.a = (uint8_t)rand();
+      state.x = (uint8_t)rand();
+      state.y = (uint8_t)rand();
+      state.sp = (uint8_t)rand();
+      state.psw = (uint8_t)((rand() | 0x20) & ~PSW_B);
+    }
+    memcpy(memories[1], memories[0], sizeof(memories[0]));
+
+    uint8_t opcode = memories[0][state.pc];
+    uint64_t start = cpu_6502_get_cycles();
+    cpu_state_t fast = step(&state, false, 0);
+    uint64_t fast_cycles = fast.cycles - start;
+    uint16_t fast_writes[MAX_WRITES];
+    int fast_write_count = write_count;
+    memcpy(fast_writes, writes, sizeof(writes));
+
+    start = cpu_6502_get_cycles();
+    cpu_state_t exact = step(&state, true, 1);
+    uint64_t exact_cycles = exact.cycles - start;
+
+    bool same = (fast.pc == exact.pc) && (fast.a == exact.a) && (fast.x == exact.x) &&
+                (fast.y == exact.y) && (fast.sp == exact.sp) && (fast.psw == exact.psw) &&
+                (fast_cycles == exact_cycles);
+
+    // The cycle-exact core also makes dummy writes, so compare what ends up
+    // in memory at every address either core wrote
+    for (int i = 0; i < fast_write_count; i++) {
+      same = same && (memories[0][fast_writes[i]] == memories[1][fast_writes[i]]);
+    }
+    for (int i = 0; i < write_count; i++) {
+      same = same && (memories[0][writes[i]] == memories[1][writes[i]]);
+    }
+
+    if (!same) {
+      failures++;
+      if (reported++ < MAX_REPORTED) {
+        printf("cpu_6502_test: %s opcode $%02X at $%04X (A=%02X X=%02X Y=%02X SP=%02X P=%02X): "
+               "fast PC=%04X A=%02X X=%02X Y=%02X SP=%02X P=%02X %llu cycles, "
+               "cycle-exact PC=%04X A=%02X X=%02X Y=%02X SP=%02X P=%02X %llu cycles\n",
+               name, opcode, state.pc, state.a, state.x, state.y, state.sp, state.psw,
+               fast.pc, fast.a, fast.x, fast.y, fast.sp, fast.psw, (unsigned long long)fast_cycles,
+               exact.pc, exact.a, exact.x, exact.y, exact.sp, exact.psw,
+               (unsigned long long)exact_cycles);
+      }
+      memcpy(memories[0], memories[1], sizeof(memories[0]));
+      state = exact;
+      continue;
+    }
+
+    state = fast;
+  }
+}
+
+int main(void) {
+  cpu_6502_initialise(0, 0, 0, NULL);
+
+  test_php(CPU_6502_VARIANT_NMOS);
+  test_php(CPU_6502_VARIANT_65C02);
+  test_brk(CPU_6502_VARIANT_NMOS);
+  test_brk(CPU_6502_VARIANT_65C02);
+  test_branch_loop(CPU_6502_VARIANT_NMOS);
+  test_branch_loop(CPU_6502_VARIANT_65C02);
+  test_random(CPU_6502_VARIANT_NMOS, "6502");
+  test_random(CPU_6502_VARIANT_65C02, "65C02");
+
+  if (failures) {
+    printf("cpu_6502_test: %d failure(s)\n", failures);
+    return EXIT_FAILURE;
+  }
+
+  printf("cpu_6502_test: all tests passed\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,116 @@
+// Breakpoint and watchpoint bookkeeping. The module is included directly so
+// the page map and counters it keeps for the CPU's fast path can be checked.
+#include "debugger.c"
+
+#include <stdlib.h>
+
+static uint8_t register_a = 0;
+static bool page_watched[256];
+
+uint16_t cpu_6502_get_pc() { return 0; }
+uint8_t cpu_6502_get_a() { return register_a; }
+uint8_t cpu_6502_get_x() { return 0; }
+uint8_t cpu_6502_get_y() { return 0; }
+uint8_t cpu_6502_get_sp() { return 0xff; }
+uint8_t cpu_6502_get_psw() { return 0; }
+
+void system_set_page_watched(uint8_t page, bool watched) {
+  page_watched[page] = watched;
+}
+
+static int failures = 0;
+
+#define CHECK(condition)                                              \
+  do {                                                                \
+    if (!(condition)) {                                               \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      failures++;                                                     \
+    }                                                                 \
+  } while (0)
+
+static void test_breakpoints(void) {
+  debugger_condition_t a_is_5 = {DEBUGGER_REGISTER_A, DEBUGGER_COMPARE_EQUAL, 5};
+  debugger_condition_t a_is_6 = {DEBUGGER_REGISTER_A, DEBUGGER_COMPARE_EQUAL, 6};
+
+  debugger_clear_all();
+
+  // A command-line breakpoint, a GDB one and a conditional one share $0400
+  CHECK(debugger_add_breakpoint(0x0400, NULL) == RV_OK);
+  CHECK(debugger_add_breakpoint(0x0400, NULL) == RV_OK);
+  CHECK(debugger_add_breakpoint(0x0400, &a_is_5) == RV_OK);
+  CHECK(breakpoint_map[0x0400] == 3);
+  CHECK(debugger_enabled);
+
+  // Removing one unconditional breakpoint keeps the others
+  CHECK(debugger_remove_breakpoint(0x0400, NULL) == RV_OK);
+  CHECK(breakpoint_map[0x0400] == 2);
+  CHECK(breakpoint_count == 2);
+
+  // A condition must match exactly
+  CHECK(debugger_remove_breakpoint(0x0400, &a_is_6) == RV_INVALID_PARAMETER);
+  CHECK(breakpoint_map[0x0400] == 2);
+  CHECK(debugger_remove_breakpoint(0x0400, &a_is_5) == RV_OK);
+  CHECK(breakpoint_map[0x0400] == 1);
+  CHECK(breakpoints[0].address == 0x0400);
+  CHECK(!breakpoints[0].conditional);
+
+  // Breakpoints on any address are counted separately
+  CHECK(debugger_add_breakpoint(DEBUGGER_ANY_ADDRESS, NULL) == RV_INVALID_PARAMETER);
+  CHECK(debugger_add_breakpoint(DEBUGGER_ANY_ADDRESS, &a_is_5) == RV_OK);
+  CHECK(debugger_add_breakpoint(DEBUGGER_ANY_ADDRESS, &a_is_6) == RV_OK);
+  CHECK(any_address_count == 2);
+  CHECK(debugger_remove_breakpoint(DEBUGGER_ANY_ADDRESS, &a_is_6) == RV_OK);
+  CHECK(any_address_count == 1);
+  CHECK(breakpoint_map[0x0400] == 1);
+
+  // The remaining conditional breakpoint still stops the CPU
+  register_a = 5;
+  CHECK(breakpoint_hit(0x1234));
+  register_a = 6;
+  CHECK(!breakpoint_hit(0x1234));
+  CHECK(breakpoint_hit(0x0400));
+
+  CHECK(debugger_remove_breakpoint(DEBUGGER_ANY_ADDRESS, &a_is_5) == RV_OK);
+  CHECK(debugger_remove_breakpoint(0x0400, NULL) == RV_OK);
+  CHECK(debugger_remove_breakpoint(0x0400, NULL) == RV_INVALID_PARAMETER);
+  CHECK(breakpoint_map[0x0400] == 0);
+  CHECK(any_address_count == 0);
+  CHECK(breakpoint_count == 0);
+  CHECK(!debugger_enabled);
+}
+
+static void test_watchpoints(void) {
+  debugger_clear_all();
+
+  // A GDB write watchpoint and an access watchpoint on the same range
+  CHECK(debugger_add_watchpoint(0x0200, 0x02ff, DEBUGGER_WATCH_WRITE) == RV_OK);
+  CHECK(debugger_add_watchpoint(0x0200, 0x02ff, DEBUGGER_WATCH_ACCESS) == RV_OK);
+  CHECK(debugger_add_watchpoint(0x0300, 0x0300, DEBUGGER_WATCH_READ) == RV_OK);
+  CHECK(page_watched[0x02] && page_watched[0x03]);
+
+  CHECK(debugger_remove_watchpoint(0x0200, 0x02ff, DEBUGGER_WATCH_READ) == RV_INVALID_PARAMETER);
+  CHECK(debugger_remove_watchpoint(0x0200, 0x02ff, DEBUGGER_WATCH_WRITE) == RV_OK);
+  CHECK(watchpoint_count == 2);
+  CHECK(watchpoints[0].type == DEBUGGER_WATCH_ACCESS);
+  CHECK(page_watched[0x02]);
+
+  CHECK(debugger_remove_watchpoint(0x0200, 0x02ff, DEBUGGER_WATCH_ACCESS) == RV_OK);
+  CHECK(!page_watched[0x02] && page_watched[0x03]);
+  CHECK(debugger_remove_watchpoint(0x0300, 0x0300, DEBUGGER_WATCH_READ) == RV_OK);
+  CHECK(!page_watched[0x03]);
+  CHECK(watchpoint_count == 0);
+  CHECK(!debugger_enabled);
+}
+
+int main(void) {
+  test_breakpoints();
+  test_watchpoints();
+
+  if (failures) {
+    printf("debugger_test: %d failure(s)\n", failures);
+    return EXIT_FAILURE;
+  }
+
+  printf("debugger_test: all tests passed\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,210 @@
+// TANDOS image handling: sector write-back through the dirty bitmap, the
+// merging of dirty sectors into msync ranges, the flush thread and
+// protection of mounted images. The module is included directly so the
+// ranges it passes to msync can be recorded.
+#include <sys/mman.h>
+
+static int recorded_msync(void* address, size_t length, int flags);
+#define msync recorded_msync
+#include "tandos.c"
+#undef msync
+
+#define TEST_IMAGE     "build/tandos_test.img"
+#define MAX_RECORDED   16
+
+typedef struct {
+  size_t start;
+  size_t end;
+  int flags;
+} sync_range_t;
+
+static sync_range_t recorded[MAX_RECORDED];
+static atomic_int recorded_count;
+static int failures = 0;
+
+#define CHECK(condition)                                              \
+  do {                                                                \
+    if (!(condition)) {                                               \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      failures++;                                                     \
+    }                                                                 \
+  } while (0)
+
+void cpu_6502_assert_irq(void) {
+}
+
+uint8_t* system_get_memory_pointer(uint16_t address) {
+  static uint8_t memory[65536];
+  return &memory[address];
+}
+
+int system_register_memory_mapped_device(uint16_t start, uint16_t end, memory_read_callback read_cb,
+                                         memory_write_callback write_cb, bool use_main_ram) {
+  (void)start;
+  (void)end;
+  (void)read_cb;
+  (void)write_cb;
+  (void)use_main_ram;
+  return RV_OK;
+}
+
+static int recorded_msync(void* address, size_t length, int flags) {
+  int n = atomic_load(&recorded_count);
+
+  if (n < MAX_RECORDED) {
+    recorded[n].start = (size_t)((uint8_t*)address - units[0].data);
+    recorded[n].end = recorded[n].start + length;
+    recorded[n].flags = flags;
+    atomic_store(&recorded_count, n + 1);
+  }
+
+  return msync(address, length, flags);
+}
+
+// Writes one sector of unit 0 through the FDC registers
+static void write_sector(int track, int sector, uint8_t fill) {
+  io_write(TANDOS_FDC_BASE + 4, 0x20);
+  io_write(TANDOS_FDC_BASE + 1, (uint8_t)track);
+  io_write(TANDOS_FDC_BASE + 2, (uint8_t)sector);
+  io_write(TANDOS_FDC_BASE, 0xA0);
+  for (int i = 0; i < TANDOS_SECTOR_SIZE; i++) {
+    io_write(TANDOS_FDC_BASE + 3, fill);
+  }
+}
+
+// Byte offset of a sector in an 80 track, 10 sector image
+static size_t sector_offset(int track, int sector) {
+  return ((size_t)track * TANDOS_DEFAULT_SECTORS + (size_t)(sector - 1)) * TANDOS_SECTOR_SIZE;
+}
+
+static size_t page_start(size_t offset) {
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  return offset - offset % page_size;
+}
+
+static void flush_now(void) {
+  atomic_store(&recorded_count, 0);
+  flush_unit(0);
+}
+
+static void test_flush_ranges(void) {
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  int sectors_per_page = (int)(page_size / TANDOS_SECTOR_SIZE);
+
+  CHECK(tandos_create_image(TEST_IMAGE, TANDOS_DEFAULT_TRACKS, TANDOS_DEFAULT_SECTORS) == RV_OK);
+  CHECK(tandos_mount(0, TEST_IMAGE, false) == RV_OK);
+
+  // One sector
+  write_sector(3, 2, 0x11);
+  CHECK(atomic_load(&units[0].dirty[31 / 32]) == (1u << 31));
+  flush_now();
+  CHECK(recorded_count == 1);
+  CHECK(recorded[0].start == page_start(sector_offset(3, 2)));
+  CHECK(recorded[0].end == sector_offset(3, 2) + TANDOS_SECTOR_SIZE);
+  CHECK(recorded[0].flags == MS_ASYNC);
+
+  // The bitmap is cleared by the flush
+  flush_now();
+  CHECK(recorded_count == 0);
+
+  // A whole track of adjacent sectors is one range
+  for (int sector = 1; sector <= TANDOS_DEFAULT_SECTORS; sector++) {
+    write_sector(20, sector, 0x22);
+  }
+  flush_now();
+  CHECK(recorded_count == 1);
+  CHECK(recorded[0].start == page_start(sector_offset(20, 1)));
+  CHECK(recorded[0].end == sector_offset(20, TANDOS_DEFAULT_SECTORS) + TANDOS_SECTOR_SIZE);
+
+  // Sectors that are not adjacent but share a page are one range; a sector
+  // pages away is another
+  if (sectors_per_page > 2) {
+    size_t first = page_start(sector_offset(40, 1)) / TANDOS_SECTOR_SIZE + 1;
+    size_t last = first + (size_t)sectors_per_page - 2;
+    int first_track = (int)(first / TANDOS_DEFAULT_SECTORS);
+    int last_track = (int)(last / TANDOS_DEFAULT_SECTORS);
+
+    write_sector(last_track, (int)(last % TANDOS_DEFAULT_SECTORS) + 1, 0x33);
+    write_sector(first_track, (int)(first % TANDOS_DEFAULT_SECTORS) + 1, 0x33);
+    write_sector(70, 5, 0x33);
+    flush_now();
+    CHECK(recorded_count == 2);
+    CHECK(recorded[0].start == page_start(first * TANDOS_SECTOR_SIZE));
+    CHECK(recorded[0].end == (last + 1) * TANDOS_SECTOR_SIZE);
+    CHECK(recorded[1].start == page_start(sector_offset(70, 5)));
+    CHECK(recorded[1].end == sector_offset(70, 5) + TANDOS_SECTOR_SIZE);
+  }
+
+  // The fsync setting makes write-back synchronous
+  fsync_writes = true;
+  write_sector(0, 1, 0x44);
+  flush_now();
+  CHECK((recorded_count == 1) && (recorded[0].flags == MS_SYNC));
+  fsync_writes = false;
+
+  // Eject writes back what is still dirty
+  write_sector(79, 10, 0x55);
+  atomic_store(&recorded_count, 0);
+  tandos_eject(0);
+  CHECK(recorded_count == 1);
+
+  FILE* file = fopen(TEST_IMAGE, "rb");
+  CHECK(file != NULL);
+  if (file) {
+    uint8_t sector[TANDOS_SECTOR_SIZE];
+    CHECK(fseek(file, (long)sector_offset(79, 10), SEEK_SET) == 0);
+    CHECK(fread(sector, 1, sizeof(sector), file) == sizeof(sector));
+    CHECK((sector[0] == 0x55) && (sector[TANDOS_SECTOR_SIZE - 1] == 0x55));
+    fclose(file);
+  }
+}
+
+static void test_flush_thread(void) {
+  CHECK(tandos_mount(0, TEST_IMAGE, false) == RV_OK);
+  atomic_store(&recorded_count, 0);
+
+  // A burst of writes is written back as one range once the thread wakes
+  for (int sector = 1; sector <= TANDOS_DEFAULT_SECTORS; sector++) {
+    write_sector(5, sector, 0x66);
+  }
+  for (int wait = 0; (wait < 100) && (atomic_load(&recorded_count) == 0); wait++) {
+    SDL_Delay(20);
+  }
+  SDL_LockMutex(flush_mutex);
+  CHECK(recorded_count == 1);
+  CHECK(recorded[0].end == sector_offset(5, TANDOS_DEFAULT_SECTORS) + TANDOS_SECTOR_SIZE);
+  SDL_UnlockMutex(flush_mutex);
+
+  tandos_eject(0);
+}
+
+static void test_mounted_image_protected(void) {
+  CHECK(tandos_mount(0, TEST_IMAGE, true) == RV_OK);
+  CHECK(tandos_create_image(TEST_IMAGE, TANDOS_MIN_TRACKS, 9) == RV_FILE_IN_USE);
+  CHECK(tandos_unit_tracks(0) == TANDOS_DEFAULT_TRACKS);
+  CHECK(units[0].data[units[0].size - 1] == 0x55);
+  tandos_eject(0);
+  CHECK(tandos_create_image(TEST_IMAGE, TANDOS_MIN_TRACKS, 9) == RV_OK);
+}
+
+int main(void) {
+  enabled = true;
+
+  test_flush_ranges();
+
+  CHECK(tandos_initialise(0, 0, 0, NULL) == RV_OK);
+  CHECK(flush_thread != NULL);
+  enabled = true;
+  test_flush_thread();
+  test_mounted_image_protected();
+  tandos_close();
+  remove(TEST_IMAGE);
+
+  if (failures) {
+    printf("tandos_test: %d failure(s)\n", failures);
+    return EXIT_FAILURE;
+  }
+
+  printf("tandos_test: all tests passed\n");
+  return EXIT_SUCCESS;
+}
@@ -26,6 +26,7 @@ MODE_FROM_FUNCTION = {
     "absolute_x": "absx",
     "absolute_y": "absy",
     "indirect": "ind",
+    "indirect_page_wrap": "ind",
     "indirect_x": "indx",
     "indirect_y": "indy",
     "relative": "rel",
@@ -68,6 +69,8 @@ TOKEN_RE = re.compile(r"^([A-Za-z\.][A-Za-z0-9_\.]*)\s*(.*)$", a)
 OPCODE_LINE_RE = re.compile(
     r"\{\s*\d+\s*,\s*([a-z0-9_]+)\s*,\s*([a-z0-9_]+)\s*\},\s*//\s*0x([0-9A-Fa-f]{2})"
 )
+# The assembler targets the 65C02 table; the NMOS table only adds undocumented opcodes.
+DEFAULT_OPCODE_TABLE = "cmos_instruction_table"
 LOCAL_REF_RE = re.compile(r"(?<![A-Za-z0-9_])@([A-Za-z_][A-Za-z0-9_]*)")
 
 
@@ -219,9 +222,17 @@ def resolve_local_refs(expr: str, global_scope: Optional[str], location: str) ->
     return LOCAL_REF_RE.sub(repl, expr)
 
 
-def parse_opcode_table(cpu_source: Path) -> Dict[str, Dict[str, int]]:
+def parse_opcode_entries(
+    cpu_source: Path, table_name: str = DEFAULT_OPCODE_TABLE
+) -> List[Tuple[int, str, str]]:
+    """Return (opcode, mnemonic, mode) for every entry of one instruction table."""
     text = cpu_source.read_text(encoding="utf-8")
-    table: Dict[str, Dict[str, int]] = {}
+    table_match = re.search(
+        re.escape(table_name) + r"\[256\]\s*=(.*?)\};", text, re.S
+    )
+    if table_match:
+        text = table_match.group(1)
+    entries: List[Tuple[int, str, str]] = []
 
     for m in OPCODE_LINE_RE.finditer(text):
         inst_fn = m.group(1)
@@ -231,16 +242,34 @@ def parse_opcode_table(cpu_source: Path) -> Dict[str, Dict[str, int]]:
         if mode_fn not in MODE_FROM_FUNCTION:
             continue
 
-        if inst_fn == "brk" and opcode != 0x00:
-            continue
-
         if inst_fn in ACCUMULATOR_ALIASES:
             mnemonic = ACCUMULATOR_ALIASES[inst_fn]
             mode = "acc"
+        elif inst_fn == "nop_read":
+            mnemonic = "NOP"
+            mode = MODE_FROM_FUNCTION[mode_fn]
         else:
             mnemonic = inst_fn.upper()
             mode = MODE_FROM_FUNCTION[mode_fn]
 
+        entries.append((opcode, mnemonic, mode))
+
+    return entries
+
+
+def parse_opcode_table(
+    cpu_source: Path, table_name: str = DEFAULT_OPCODE_TABLE
+) -> Dict[str, Dict[str, int]]:
+    table: Dict[str, Dict[str, int]] = {}
+
+    for opcode, mnemonic, mode in parse_opcode_entries(cpu_source, table_name):
+        if mnemonic == "BRK" and opcode != 0x00:
+            continue
+
+        # Undefined opcodes decode as NOPs; only $EA is assembled.
+        if mnemonic == "NOP" and opcode != 0xEA:
+            continue
+
         table.setdefault(mnemonic, {})[mode] = opcode
 
     # 65C02 aliases often written as INC A / DEC A.
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""Decode an instruction trace written by microtan65.
+
+Traces are recorded with --trace or System > Instruction trace and written to
+microtan_trace.bin by System > Dump instruction trace, or automatically if the
+emulator crashes while tracing. Mnemonics come from the same instruction table
+in cpu_6502.c that asm6502.py assembles from.
+"""
+
+from __future__ import annotations
+
+import argparse
+import struct
+import sys
+from pathlib import Path
+from typing import Dict, Iterator, Tuple
+
+from asm6502 import parse_opcode_entries
+
+
+HEADER = struct.Struct("<8sHBBI")
+RECORD = struct.Struct("<QHBBBBBB")
+MAGIC = b"M65TRACE"
+
+TABLE_FOR_VARIANT = {
+    0: "nmos_instruction_table",
+    1: "cmos_instruction_table",
+}
+
+MODE_TEXT = {
+    "impl": "",
+    "acc": "A",
+    "imm": "#",
+    "zp": "zp",
+    "zpx": "zp,X",
+    "zpy": "zp,Y",
+    "abs": "abs",
+    "absx": "abs,X",
+    "absy": "abs,Y",
+    "ind": "(abs)",
+    "indx": "(zp,X)",
+    "indy": "(zp),Y",
+    "rel": "rel",
+    "zpi": "(zp)",
+    "absindx": "(abs,X)",
+}
+
+
+class TraceError(Exception):
+    pass
+
+
+def load_disassembly(variant: int) -> Dict[int, str]:
+    repo_root = Path(__file__).resolve().parent.parent
+    cpu_source = repo_root / "src" / "cpu_6502.c"
+    table_name = TABLE_FOR_VARIANT.get(variant, TABLE_FOR_VARIANT[1])
+    names: Dict[int, str] = {}
+
+    for opcode, mnemonic, mode in parse_opcode_entries(cpu_source, table_name):
+        names[opcode] = f"{mnemonic} {MODE_TEXT[mode]}".rstrip()
+
+    return names
+
+
+def read_trace(path: Path) -> Tuple[int, Iterator[Tuple[int, ...]], int]:
+    data = path.read_bytes()
+
+    if len(data) < HEADER.size:
+        raise TraceError(f"{path}: file is too short")
+
+    magic, version, variant, record_size, count = HEADER.unpack_from(data)
+
+    if magic != MAGIC:
+        raise TraceError(f"{path}: not a microtan65 trace")
+    if version != 1 or record_size != RECORD.size:
+        raise TraceError(f"{path}: unsupported trace version {version}")
+    if len(data) < HEADER.size + count * RECORD.size:
+        raise TraceError(f"{path}: trace is truncated")
+
+    records = (
+        RECORD.unpack_from(data, HEADER.size + n * RECORD.size) for n in range(count)
+    )
+    return variant, records, count
+
+
+def flags_text(psw: int) -> str:
+    return "".join(
+        name if psw & bit else "."
+        for name, bit in zip("NV-BDIZC", (0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01))
+    )
+
+
+def main(argv: list[str]) -> int:
+    parser = argparse.ArgumentParser(description="Decode a microtan65 instruction trace")
+    parser.add_argument("trace", nargs="?", default="microtan_trace.bin", help="Trace file")
+    parser.add_argument("-n", "--last", type=int, default=0, help="Only show the last N instructions")
+    args = parser.parse_args(argv)
+
+    try:
+        variant, records, count = read_trace(Path(args.trace))
+    except (OSError, TraceError) as exc:
+        print(f"error: {exc}", file=sys.stderr)
+        return 1
+
+    names = load_disassembly(variant)
+    skip = max(0, count - args.last) if args.last > 0 else 0
+
+    print(f"{'cycle':>12}  PC    OP  {'instruction':<14} A  X  Y  SP flags")
+    for index, (cycle, pc, opcode, a, x, y, sp, psw) in enumerate(records):
+        if index < skip:
+            continue
+        name = names.get(opcode, "NOP")
+        print(
+            f"{cycle:12d}  {pc:04X}  {opcode:02X}  {name:<14} "
+            f"{a:02X} {x:02X} {y:02X} {sp:02X} {flags_text(psw)}"
+        )
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))